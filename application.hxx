@@ -1,26 +1,53 @@
 #pragma once
 
 #include "storage.hxx"
+#include "shards.hxx"
+#include "pchCache.hxx"
+#include "remoteIndex.hxx"
 #include "libclang++/libclang++.hxx"
 #include "libclang++/translationUnitCache.hxx"
+#include "util/queue.hxx"
+#include "util/util.hxx"
+#include "util/metrics.hxx"
+#include "util/memoryGovernor.hxx"
+#include <sys/stat.h>
+#include <atomic>
+#include <functional>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <thread>
 
 class Application {
 public:
-  Application (Storage & storage, unsigned int cacheLimit)
+  // With a remote index, find and grep requests are answered by the remote
+  // server, except for files indexed locally (the overlay of files modified
+  // in this checkout).
+  //
+  // The translation unit cache gets its share of the process memory budget;
+  // cacheLimit remains its maximal size.
+  Application (Storage & storage, unsigned int cacheLimit,
+               RemoteIndex * remote = NULL)
     : storage_ (storage),
-      tu_ (cacheLimit)
+      shards_ (storage),
+      remote_ (remote),
+      tu_ (cacheLimit),
+      pch_ (".ct.pch"),
+      published_ (),
+      warmUpStop_ (false)
   {
-    const size_t size = 4096;
-    cwd_ = new char[size];
-    if (getcwd (cwd_, size) == NULL) {
-      // FIXME: correctly handle this case
-     throw std::runtime_error ("Not enough space to store current directory name.");
-    }
+    memoryId_ = MemoryGovernor::global().add
+      ("tuCache", 0.7,
+       [this] () -> size_t { return tu_.memoryUsage(); },
+       [this] (size_t limit) { tu_.setMemoryLimit (limit); });
   }
 
   ~Application () {
-    delete[] cwd_;
+    MemoryGovernor::global().remove (memoryId_);
+    warmUpStop_ = true;
+    if (warmUpThread_.joinable()) {
+      warmUpThread_.join();
+    }
   }
 
 
@@ -33,6 +60,11 @@ public:
   struct IndexArgs {
     std::vector<std::string> exclude;
     bool                     diagnostics;
+    unsigned int             jobs;
+    bool                     pch;
+    std::string              engine;  // "visitor" or "indexer"
+    bool                     snapshot;  // write a snapshot after indexing
+    std::vector<std::string> files;   // files to check for changes (all if empty)
   };
   void index (IndexArgs & args, std::ostream & cout);
   void update (IndexArgs & args, std::ostream & cout);
@@ -44,51 +76,272 @@ public:
     bool        diagnostics;
     bool        mostSpecific;
     bool        fromIndex;
+    std::string contents;     // unsaved buffer contents (if not empty)
   };
   void findDefinition (FindDefinitionArgs & args, std::ostream & cout);
 
 
   struct GrepArgs {
-    std::string usr;
+    std::string  usr;
+    std::string  filePrefix;
+    unsigned int offset;
+    unsigned int limit;
   };
   void grep (const GrepArgs & args, std::ostream & cout);
 
 
+  struct SearchArgs {
+    std::string              pattern;  // glob pattern (substring if no wildcard)
+    std::vector<std::string> kinds;    // kinds of declarations (all if empty)
+    unsigned int             limit;    // maximum number of results (0 for no limit)
+  };
+  void search (const SearchArgs & args, std::ostream & cout);
+
+
+  struct DiagnosticsArgs {
+    std::string fileName;  // file in which diagnostics are located (all if empty)
+    std::string severity;  // minimum severity: "note", "warning", "error" or "fatal"
+  };
+  void diagnostics (const DiagnosticsArgs & args, std::ostream & cout);
+
+  // Diagnostics of a translation unit compiled in directory (defined in
+  // diagnostics.cxx)
+  static std::vector<Storage::Diagnostic> collectDiagnostics
+  (LibClang::TranslationUnit & tu, const std::string & source,
+   const std::string & directory);
+
+
   struct CompleteArgs {
-    std::string fileName;
-    int         line;
-    int         column;
+    std::string  fileName;
+    int          line;
+    int          column;
+    std::string  contents;    // unsaved buffer contents (if not empty)
+    std::string  prefix;      // beginning of the token, before the column
+    unsigned int max;         // maximum number of results (0 for no limit)
   };
   void complete (CompleteArgs & args, std::ostream & cout);
 
 
+  struct PinArgs {
+    std::string fileName;
+    bool        pinned;
+  };
+  void pin (PinArgs & args, std::ostream & cout);
+
+  // Parse, in a background thread, the translation units of the files which
+  // were most recently pinned. They are added to the cache as they become
+  // ready, without delaying other requests.
+  void warmUp ();
+
+
+  struct ConfigArgs {
+    std::string name;
+    std::string value;
+  };
+  void config (ConfigArgs & args, std::ostream & cout);
+
+
+  struct ShardArgs {
+    std::string action;    // "list", "add" or "remove"
+    std::string path;
+    bool        prebuilt;
+  };
+  void shard (ShardArgs & args, std::ostream & cout);
+
+
+  struct FilesArgs {
+    bool hashes;
+  };
+  void files (FilesArgs & args, std::ostream & cout);
+
+
+  struct StatsArgs {
+    bool reset;
+  };
+  void stats (StatsArgs & args, std::ostream & cout);
+
+  // Process-wide metrics (see Metrics), as a JSON object
+  static Json::Value statsJson ();
+
+  // Make clang arguments parse relative to a compilation directory.
+  //
+  // Requests and indexing jobs are handled by several threads sharing the
+  // process working directory: let clang handle the compilation directory
+  // instead of chdir()ing to it.
+  static void addWorkingDirectory (std::vector<std::string> & clArgs,
+                                   const std::string & directory) {
+    clArgs.push_back ("-working-directory");
+    clArgs.push_back (directory);
+  }
+
+
 private:
-  void updateIndex_ (IndexArgs & args, std::ostream & cout);
+  void updateIndex_ (IndexArgs & args, Storage::LoadProfile profile,
+                     std::ostream & cout);
   void findDefinitionFromIndex_  (FindDefinitionArgs & args, std::ostream & cout);
+
+  // Queries against the remote index, merged with the local overlay (defined
+  // in remote.cxx)
+  std::vector<Storage::RefDef> findDefinitionRemote_ (const std::string & fileName,
+                                                      int offset);
+  void grepRemote_ (const GrepArgs & args,
+                    const std::function<void (const Storage::Reference &)> & f);
+
+  // Source files to index in the overlay: those which differ from the remote
+  // index, among the stale ones
+  std::vector<std::string> overlaySources_ (const std::vector<std::string> & stale,
+                                            std::ostream & cout);
   void findDefinitionFromSource_ (FindDefinitionArgs & args, std::ostream & cout);
 
-  LibClang::TranslationUnit & translationUnit_ (std::string fileName) {
+  // Get the translation unit for a source file from the cache, parsing it if
+  // needed. If not empty, contents is used as the up-to-date contents of the
+  // source file, and added to unsaved.
+  //
+  // Cached translation units are only reparsed when the buffer contents or one
+  // of the files they depend on changed since they were last parsed.
+  LibClang::TranslationUnit & translationUnit_ (std::string fileName,
+                                                const std::string & contents,
+                                                LibClang::UnsavedFiles & unsaved) {
+    adoptWarmedUp_();
+
+    // The memory limit may have been lowered since the last request
+    tu_.shrink();
+
+    if (contents != "") {
+      unsaved.addContents (fileName, contents);
+    }
+    const size_t contentsHash = std::hash<std::string>() (contents);
+
     std::string directory;
     std::vector<std::string> clArgs;
     storage_.getCompileCommand (fileName, directory, clArgs);
+    addWorkingDirectory (clArgs, directory);
 
-    // chdir() to the correct directory
-    // (whether we need to parse the TU for the first time or reparse it)
-    chdir (directory.c_str());
+    LibClang::TranslationUnit * cached = tu_.find (fileName);
+    if (cached == NULL) {
+      // Reuse a precompiled header if one was built while indexing, and let
+      // libclang keep a precompiled preamble in memory for later reparses.
+      Timer timer;
+      LibClang::TranslationUnit tu
+        = pch_.parse (index_, fileName, directory, clArgs,
+                      cachedParseOptions_(), /*build=*/false);
 
-    if (!tu_.contains (fileName)) {
-      LibClang::TranslationUnit tu = index_.parse (clArgs);
-      tu_.insert (fileName, tu);
+      // The preamble is only built when the translation unit is first reparsed
+      tu.reparse (unsaved);
+      parseState_[fileName] = currentParseState_ (tu, directory, contentsHash);
+      const double cost = timer.get();
+      Metrics::global().time ("parse", cost);
+      tu_.insert (fileName, tu, cost);
+      publishCacheStats_();
       return tu_.get (fileName);
     } else {
-      LibClang::TranslationUnit & tu = tu_.get (fileName);
-      tu.reparse();
+      LibClang::TranslationUnit & tu = *cached;
+      auto state = parseState_.find (fileName);
+      if (state == parseState_.end() || !state->second.upToDate (contentsHash)) {
+        Timer timer;
+        tu.reparse (unsaved);
+        parseState_[fileName] = currentParseState_ (tu, directory, contentsHash);
+        const double cost = timer.get();
+        Metrics::global().time ("reparse", cost);
+        tu_.reparsed (fileName, cost);
+      }
+      publishCacheStats_();
       return tu;
     }
   }
 
+  // Options of cached translation units: they are reparsed incrementally, and
+  // keep macro expansions so that find requests can be answered from them
+  static unsigned int cachedParseOptions_ () {
+    return clang_defaultEditingTranslationUnitOptions()
+      | CXTranslationUnit_DetailedPreprocessingRecord;
+  }
+
+  // Publish the changes of the translation unit cache statistics since the
+  // last call, so that the counters of all threads add up
+  void publishCacheStats_ () {
+    const LibClang::TranslationUnitCache::Stats stats = tu_.stats();
+    Metrics & metrics = Metrics::global();
+    metrics.count ("tuCache.hits",      (long)stats.hits      - (long)published_.hits);
+    metrics.count ("tuCache.misses",    (long)stats.misses    - (long)published_.misses);
+    metrics.count ("tuCache.evictions", (long)stats.evictions - (long)published_.evictions);
+    metrics.count ("tuCache.size",      (long)stats.size      - (long)published_.size);
+    metrics.count ("tuCache.memory",    (long)stats.memoryUsage - (long)published_.memoryUsage);
+    published_ = stats;
+  }
+
+  // What a translation unit was parsed from
+  struct ParseState {
+    size_t                        contentsHash;
+    std::map<std::string, time_t> mtimes;  // of all files in the TU
+    std::string                   directory;
+
+    // Diagnostics of this parse, collected on demand
+    std::shared_ptr<const std::vector<Storage::Diagnostic> > diagnostics;
+
+    bool upToDate (size_t hash) const {
+      if (hash != contentsHash) {
+        return false;
+      }
+
+      for (auto it = mtimes.begin() ; it != mtimes.end() ; ++it) {
+        if (mtime (it->first) != it->second) {
+          return false;
+        }
+      }
+      return true;
+    }
+
+    static time_t mtime (const std::string & path) {
+      struct stat fileStat;
+      return stat (path.c_str(), &fileStat) == 0 ? fileStat.st_mtime : 0;
+    }
+  };
+
+  static ParseState currentParseState_ (const LibClang::TranslationUnit & tu,
+                                        const std::string & directory,
+                                        size_t contentsHash) {
+    ParseState state;
+    state.contentsHash = contentsHash;
+    state.directory    = directory;
+
+    const std::vector<std::string> files = tu.includedFiles();
+    for (auto it = files.begin() ; it != files.end() ; ++it) {
+      const std::string path = it->compare (0, 1, "/") == 0 ? *it : directory + "/" + *it;
+      state.mtimes[path] = ParseState::mtime (path);
+    }
+    return state;
+  }
+
+  // Translation unit parsed by the warm-up thread
+  struct WarmedUp {
+    std::string               fileName;
+    LibClang::TranslationUnit tu;
+    ParseState                state;
+    double                    cost;
+  };
+
+  // Insert translation units parsed by the warm-up thread into the cache
+  // (defined in pin.cxx)
+  void adoptWarmedUp_ ();
+
+  // Results of the last code completion, which are narrowed down by later
+  // requests at the same place (defined in complete.cxx)
+  struct CompletionCache;
+  std::shared_ptr<CompletionCache> completionCache_;
+
   Storage & storage_;
+  Shards shards_;
+  RemoteIndex * remote_;
   LibClang::Index index_;
+  LibClang::Index warmUpIndex_;
   LibClang::TranslationUnitCache tu_;
-  char* cwd_;
+  PchCache pch_;
+  LibClang::TranslationUnitCache::Stats published_;
+  std::map<std::string, ParseState> parseState_;
+  int memoryId_;
+
+  std::atomic<bool> warmUpStop_;
+  Queue<std::shared_ptr<WarmedUp> > warmedUp_;
+  std::thread warmUpThread_;
 };
@@ -0,0 +1,284 @@
+// Micro-benchmarks of the index and cache hot paths.
+//
+// Results are written to the standard output as a JSON object, so that they
+// can be tracked across releases. The database is created from scratch in a
+// work directory, with deterministic synthetic tags: only the machine and the
+// code under test should make results vary.
+
+#include "storage.hxx"
+#include "sourceFile.hxx"
+#include "libclang++/libclang++.hxx"
+#include "libclang++/translationUnitCache.hxx"
+#include "getopt++/getopt.hxx"
+#include "util/util.hxx"
+#include "json/json.h"
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <random>
+
+
+// Time a function over a number of iterations, and record the results
+class Bench {
+public:
+  Bench (Json::Value & results)
+    : results_ (results)
+  { }
+
+  template <typename F>
+  void run (const std::string & name, unsigned long iterations, F f) {
+    Timer timer;
+    for (unsigned long i = 0 ; i < iterations ; ++i) {
+      f (i);
+    }
+    const double seconds = timer.get();
+
+    Json::Value result;
+    result["name"]         = name;
+    result["iterations"]   = (Json::UInt64) iterations;
+    result["seconds"]      = seconds;
+    result["perIteration"] = iterations > 0 ? seconds / iterations : 0;
+    results_.append (result);
+
+    std::cerr << name << ": " << iterations << " iterations in "
+              << seconds << "s." << std::endl;
+  }
+
+private:
+  Json::Value & results_;
+};
+
+
+static std::string fileName (unsigned int i) {
+  std::ostringstream name;
+  name << "files/f" << i << ".cxx";
+  return name.str();
+}
+
+static std::string usr (unsigned int i) {
+  std::ostringstream name;
+  name << "c:@N@bench@F@symbol" << i << "#";
+  return name.str();
+}
+
+// Tags of the synthetic file i: one tag every 10 bytes, referring to symbols
+// shared by all files
+static std::vector<Storage::Tag> tags (unsigned int i, unsigned int nTags,
+                                       unsigned int nSymbols) {
+  std::mt19937 random (i);
+  std::vector<Storage::Tag> res;
+  for (unsigned int j = 0 ; j < nTags ; ++j) {
+    Storage::Tag tag;
+    const unsigned int symbol = random() % nSymbols;
+    tag.usr      = usr (symbol);
+    tag.kind     = j % 4 == 0 ? "FunctionDecl" : "DeclRefExpr";
+    tag.spelling = "symbol";
+    tag.line1    = tag.line2 = j + 1;
+    tag.col1     = 1;
+    tag.col2     = 6;
+    tag.offset1  = 10 * j;
+    tag.offset2  = 10 * j + 5;
+    tag.isDeclaration = j % 4 == 0;
+    res.push_back (tag);
+  }
+  return res;
+}
+
+
+static void benchStorage (Bench & bench, unsigned int nFiles, unsigned int nTags,
+                          unsigned int nSymbols, unsigned int nQueries) {
+  unlink (".ct.sqlite");
+  unlink (".ct.sqlite-wal");
+  unlink (".ct.sqlite-shm");
+  mkdir ("files", 0755);
+
+  std::vector<std::vector<Storage::Tag> > fileTags;
+  for (unsigned int i = 0 ; i < nFiles ; ++i) {
+    std::ofstream (fileName (i).c_str()) << "// synthetic file" << std::endl;
+    fileTags.push_back (tags (i, nTags, nSymbols));
+  }
+
+  Storage storage;
+  {
+    Storage::Load load (storage, Storage::Bulk);
+    bench.run ("storage.addTags", nFiles, [&] (unsigned long i) {
+        storage.beginFile (fileName (i));
+        storage.addTags (fileName (i), fileTags[i]);
+        load.step();
+      });
+    load.finish();
+  }
+
+  std::mt19937 random (0);
+  bench.run ("storage.findDefinition", nQueries, [&] (unsigned long) {
+      const unsigned int file = random() % nFiles;
+      const unsigned int tag  = random() % nTags;
+      storage.findDefinition (fileName (file), 10 * tag + 2);
+    });
+
+  bench.run ("storage.grep", nQueries, [&] (unsigned long) {
+      unsigned int count = 0;
+      storage.grep (usr (random() % nSymbols), "", 0, 0,
+                    [&count] (const Storage::Reference &) { ++count; });
+    });
+
+  bench.run ("storage.staleSources", 10, [&] (unsigned long) {
+      storage.staleSources();
+    });
+}
+
+
+static void benchSourceFile (Bench & bench, unsigned int nLines,
+                             unsigned int nQueries) {
+  const std::string name = "files/lines.cxx";
+  {
+    std::ofstream file (name.c_str());
+    for (unsigned int i = 0 ; i < nLines ; ++i) {
+      file << "int variable" << i << " = " << i << ";" << std::endl;
+    }
+  }
+
+  std::mt19937 random (0);
+  bench.run ("sourceFile.line", nQueries, [&] (unsigned long) {
+      SourceFileCache::global().get (name)->line (1 + random() % nLines);
+    });
+}
+
+
+static std::string corpusFile (const std::string & corpus, unsigned int i) {
+  std::ostringstream name;
+  name << corpus << "/src/tu" << i << ".cxx";
+  return name.str();
+}
+
+static void benchTranslationUnitCache (Bench & bench, const std::string & corpus,
+                                       unsigned int maxUnits, unsigned int nQueries) {
+  unsigned int nUnits = 0;
+  struct stat fileStat;
+  while (nUnits < maxUnits
+         && stat (corpusFile (corpus, nUnits).c_str(), &fileStat) == 0) {
+    ++nUnits;
+  }
+  if (nUnits == 0) {
+    std::cerr << "No translation unit found in corpus `" << corpus << "'" << std::endl;
+    return;
+  }
+
+  LibClang::Index index;
+  std::vector<LibClang::TranslationUnit> units;
+  bench.run ("libclang.parse", nUnits, [&] (unsigned long i) {
+      std::vector<std::string> args;
+      args.push_back ("-std=c++11");
+      args.push_back ("-I" + corpus + "/src");
+      args.push_back (corpusFile (corpus, i));
+      units.push_back (index.parse (args));
+    });
+
+  // Only about half of the translation units fit in the cache
+  unsigned long memory = 0;
+  {
+    LibClang::TranslationUnitCache probe (~0ul);
+    for (unsigned int i = 0 ; i < units.size() ; ++i) {
+      probe.insert (fileName (i), units[i]);
+    }
+    memory = probe.stats().memoryUsage;
+  }
+  LibClang::TranslationUnitCache cache (memory / 2 + 1);
+
+  bench.run ("tuCache.insert", nQueries, [&] (unsigned long i) {
+      cache.insert (fileName (i % units.size()), units[i % units.size()]);
+    });
+
+  std::mt19937 random (0);
+  bench.run ("tuCache.get", nQueries, [&] (unsigned long) {
+      const std::string name = fileName (random() % units.size());
+      cache.find (name);
+    });
+
+  const LibClang::TranslationUnitCache::Stats stats = cache.stats();
+  std::cerr << "tuCache: " << stats.hits << " hits, "
+            << stats.evictions << " evictions" << std::endl;
+}
+
+
+int main (int argc, char **argv) {
+  Getopt options (argc, argv);
+  options.add ("help", 'h', 0,
+               "print this help message and exit");
+  options.add ("work", 'w', 1,
+               "work directory, where the benchmark database is created");
+  options.add ("corpus", 'c', 1,
+               "directory of a corpus created by generate.py (for libclang benchmarks)");
+  options.add ("files", 'f', 1,
+               "number of synthetic files in the database");
+  options.add ("tags", 't', 1,
+               "number of tags in each file");
+  options.add ("queries", 'q', 1,
+               "number of iterations of query benchmarks");
+
+  try {
+    options.get();
+  } catch (...) {
+    std::cerr << options.usage();
+    return 1;
+  }
+
+  if (options.getCount ("help") > 0) {
+    std::cerr << options.usage();
+    return 0;
+  }
+
+  unsigned int nFiles   = 1000;
+  unsigned int nTags    = 500;
+  unsigned int nQueries = 1000;
+  try {
+    if (options.getCount ("files") > 0)   nFiles   = std::stoul (options["files"]);
+    if (options.getCount ("tags") > 0)    nTags    = std::stoul (options["tags"]);
+    if (options.getCount ("queries") > 0) nQueries = std::stoul (options["queries"]);
+  } catch (...) {
+    std::cerr << "Invalid numeric argument" << std::endl;
+    return 1;
+  }
+  const unsigned int nSymbols = std::max (1u, nFiles * nTags / 20);
+
+  std::string corpus;
+  if (options.getCount ("corpus") > 0) {
+    char * path = realpath (options["corpus"].c_str(), NULL);
+    if (path == NULL) {
+      std::cerr << "Could not find corpus `" << options["corpus"] << "'" << std::endl;
+      return 1;
+    }
+    corpus = path;
+    free (path);
+  }
+
+  const std::string work = options.getCount ("work") > 0
+    ? options["work"] : "bench-work";
+  mkdir (work.c_str(), 0755);
+  if (chdir (work.c_str()) != 0) {
+    std::cerr << "Could not use work directory `" << work << "'" << std::endl;
+    return 1;
+  }
+
+  Json::Value root;
+  root["parameters"]["files"]   = nFiles;
+  root["parameters"]["tags"]    = nTags;
+  root["parameters"]["symbols"] = nSymbols;
+  root["parameters"]["queries"] = nQueries;
+  Json::Value & results = root["benchmarks"];
+  results = Json::Value (Json::arrayValue);
+
+  Bench bench (results);
+  benchStorage (bench, nFiles, nTags, nSymbols, nQueries);
+  benchSourceFile (bench, 100000, nQueries);
+
+  if (corpus != "") {
+    benchTranslationUnitCache (bench, corpus, 8, nQueries);
+  }
+
+  Json::StyledWriter writer;
+  std::cout << writer.write (root);
+  return 0;
+}
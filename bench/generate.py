@@ -0,0 +1,151 @@
+#! /usr/bin/python
+
+"""
+Generate a synthetic C++ code base for benchmarks.
+
+The corpus is made of N translation units, each including a subset of M shared
+headers. Each header defines a chain of class templates, instantiated up to a
+configurable depth. A compilation database is written along with the sources.
+The generated corpus only depends on the parameters (and random seed), so that
+benchmark results can be compared across releases.
+"""
+
+import os
+import sys
+import json
+import optparse
+
+
+def header (j, depth):
+    "Contents of the j-th shared header."
+
+    lines = ["#pragma once", ""]
+    lines.append ("namespace h%d {" % j)
+
+    # Templates instantiating each other, down to the given depth
+    lines.append ("  template <int N> struct Chain {")
+    lines.append ("    Chain<N-1> next;")
+    lines.append ("    int value () const { return N + next.value(); }")
+    lines.append ("  };")
+    lines.append ("  template <> struct Chain<0> {")
+    lines.append ("    int value () const { return 0; }")
+    lines.append ("  };")
+    lines.append ("")
+
+    for k in range (depth):
+        lines.append ("  template <typename T>")
+        lines.append ("  struct Layer%d {" % k)
+        lines.append ("    T data;")
+        lines.append ("    int layer%d (int x) const { return x + %d; }" % (k, k))
+        lines.append ("  };")
+        lines.append ("")
+
+    lines.append ("  inline int entry%d (int x) {" % j)
+    lines.append ("    Chain<%d> chain;" % depth)
+    lines.append ("    return chain.value() + x;")
+    lines.append ("  }")
+    lines.append ("}")
+    return "\n".join (lines) + "\n"
+
+
+def source (i, headers, depth):
+    "Contents of the i-th translation unit, including the given headers."
+
+    lines = []
+    for j in headers:
+        lines.append ("#include \"header%d.hxx\"" % j)
+    lines.append ("")
+
+    lines.append ("int tu%d () {" % i)
+    lines.append ("  int total = 0;")
+    for j in headers:
+        lines.append ("  total += h%d::entry%d (%d);" % (j, j, i))
+        lines.append ("  h%d::Layer%d<int> layer%d;" % (j, depth - 1, j))
+        lines.append ("  total += layer%d.layer%d (total);" % (j, depth - 1))
+    lines.append ("  return total; // bench:complete")
+    lines.append ("}")
+    lines.append ("")
+
+    if i == 0:
+        lines.append ("int main () {")
+        lines.append ("  return tu0 ();")
+        lines.append ("}")
+    return "\n".join (lines) + "\n"
+
+
+def pick (i, headers, includes, seed):
+    """Headers included by the i-th translation unit.
+
+    A simple linear congruential generator is used, rather than the random
+    module, so that the corpus does not depend on the Python version."""
+
+    state = (seed * 2654435761 + i * 40503 + 1) & 0x7fffffff
+    candidates = list (range (headers))
+    chosen = []
+    for _ in range (min (includes, headers)):
+        state = (state * 1103515245 + 12345) & 0x7fffffff
+        chosen.append (candidates.pop (state % len (candidates)))
+    return sorted (chosen)
+
+
+def generate (out, tus, headers, depth, includes, seed):
+    "Write the corpus to directory OUT, and return its description."
+
+    src = os.path.join (os.path.abspath (out), "src")
+    if not os.path.isdir (src):
+        os.makedirs (src)
+
+    depth = max (depth, 1)
+    for j in range (headers):
+        with open (os.path.join (src, "header%d.hxx" % j), "w") as f:
+            f.write (header (j, depth))
+
+    database = []
+    for i in range (tus):
+        included = pick (i, headers, includes, seed)
+        fileName = os.path.join (src, "tu%d.cxx" % i)
+        with open (fileName, "w") as f:
+            f.write (source (i, included, depth))
+
+        database.append ({
+            "directory": src,
+            "file": fileName,
+            "arguments": ["clang++", "-std=c++11", "-I" + src, "-c", fileName],
+        })
+
+    with open (os.path.join (os.path.abspath (out), "compile_commands.json"), "w") as f:
+        json.dump (database, f, indent = 2)
+
+    return {"tus": tus,
+            "headers": headers,
+            "depth": depth,
+            "includes": includes,
+            "seed": seed}
+
+
+def options (parser):
+    "Add corpus parameters to an option parser."
+
+    parser.add_option ("--tus", type = "int", default = 64,
+                       help = "number of translation units")
+    parser.add_option ("--headers", type = "int", default = 16,
+                       help = "number of shared headers")
+    parser.add_option ("--depth", type = "int", default = 8,
+                       help = "depth of template instantiations")
+    parser.add_option ("--includes", type = "int", default = 8,
+                       help = "number of headers included by each translation unit")
+    parser.add_option ("--seed", type = "int", default = 0,
+                       help = "random seed")
+
+
+if __name__ == "__main__":
+    parser = optparse.OptionParser (usage = "%prog [options] OUTPUT_DIR")
+    options (parser)
+    (opts, args) = parser.parse_args ()
+    if len (args) != 1:
+        parser.error ("expected an output directory")
+
+    corpus = generate (args[0], opts.tus, opts.headers, opts.depth,
+                       opts.includes, opts.seed)
+    json.dump (corpus, sys.stdout)
+    sys.stdout.write ("\n")
@@ -0,0 +1,164 @@
+#! /usr/bin/python
+
+"""
+Run the clang-tags benchmark suite.
+
+A synthetic corpus is generated (see generate.py), micro-benchmarks are run
+on the storage and caches (bench_micro), and end-to-end request latencies are
+measured against a real server indexing the corpus. All results are written to
+a single JSON file.
+"""
+
+import os
+import sys
+import json
+import time
+import socket
+import optparse
+import platform
+import subprocess
+
+sys.path.insert (0, os.path.dirname (os.path.abspath (__file__)))
+import generate
+
+
+class Results:
+    "Collect timings, in the same format as bench_micro."
+
+    def __init__ (self):
+        self.benchmarks = []
+
+    def run (self, name, command, cwd, iterations = 1):
+        devnull = open (os.devnull, "w")
+        start = time.time ()
+        for _ in range (iterations):
+            subprocess.check_call (command, cwd = cwd, stdout = devnull)
+        seconds = time.time () - start
+        devnull.close ()
+
+        self.benchmarks.append ({"name": name,
+                                 "iterations": iterations,
+                                 "seconds": seconds,
+                                 "perIteration": seconds / iterations})
+        sys.stderr.write ("%s: %d iterations in %gs.\n" % (name, iterations, seconds))
+
+
+def waitForServer (corpus, timeout = 30):
+    "Wait until the server accepts connections."
+
+    path = os.path.join (corpus, ".ct.sock")
+    deadline = time.time () + timeout
+    while time.time () < deadline:
+        try:
+            s = socket.socket (socket.AF_UNIX, socket.SOCK_STREAM)
+            s.connect (path)
+            s.close ()
+            return
+        except socket.error:
+            time.sleep (0.1)
+    raise RuntimeError ("the server did not start")
+
+
+def position (fileName, marker):
+    "Offset, line and column of the first occurrence of MARKER in a file."
+
+    with open (fileName) as f:
+        contents = f.read ()
+    offset = contents.index (marker)
+    line = contents.count ("\n", 0, offset) + 1
+    column = offset - (contents.rfind ("\n", 0, offset) + 1) + 1
+    return offset, line, column
+
+
+def endToEnd (corpus, iterations):
+    "Measure the latency of requests to a server indexing the corpus."
+
+    results = Results ()
+    clangTags = ["clang-tags"]
+
+    # Requests should go through the server, not a one-shot process
+    os.environ.pop ("CLANG_TAGS_TEST", None)
+
+    subprocess.check_call (clangTags + ["start"], cwd = corpus)
+    try:
+        waitForServer (corpus)
+
+        results.run ("e2e.load",
+                     clangTags + ["load", "compile_commands.json"], corpus)
+        results.run ("e2e.index", clangTags + ["index"], corpus)
+
+        # Touch a header included by most translation units
+        os.utime (os.path.join (corpus, "src", "header0.hxx"), None)
+        results.run ("e2e.update", clangTags + ["update"], corpus)
+
+        source = os.path.join (corpus, "src", "tu0.cxx")
+        offset, _, _ = position (source, "entry")
+        results.run ("e2e.find",
+                     clangTags + ["find-def", "--index", source, str (offset)],
+                     corpus, iterations)
+
+        # The first completion parses the translation unit, later ones reuse it
+        _, line, column = position (source, "total; // bench:complete")
+        complete = clangTags + ["complete", source, str (line), str (column)]
+        results.run ("e2e.complete.cold", complete, corpus)
+        results.run ("e2e.complete", complete, corpus, iterations)
+
+        stats = subprocess.check_output (clangTags + ["stats"], cwd = corpus)
+        try:
+            server = json.loads (stats.decode ("utf-8"))
+        except ValueError:
+            server = None
+    finally:
+        subprocess.call (clangTags + ["stop"], cwd = corpus)
+
+    return results.benchmarks, server
+
+
+def main ():
+    parser = optparse.OptionParser (usage = "%prog [options]")
+    parser.add_option ("--build-dir", default = ".",
+                       help = "build directory, where bench_micro and"
+                       " clang-tags-server can be found")
+    parser.add_option ("--source-dir",
+                       default = os.path.join (os.path.dirname (__file__), ".."),
+                       help = "source directory, where clang-tags can be found")
+    parser.add_option ("--output", default = "bench.json",
+                       help = "output file")
+    parser.add_option ("--iterations", type = "int", default = 20,
+                       help = "number of repetitions of query benchmarks")
+    parser.add_option ("--no-e2e", dest = "e2e", action = "store_false",
+                       default = True,
+                       help = "only run micro-benchmarks")
+    generate.options (parser)
+    (opts, args) = parser.parse_args ()
+
+    buildDir  = os.path.abspath (opts.build_dir)
+    sourceDir = os.path.abspath (opts.source_dir)
+    os.environ["PATH"] = os.pathsep.join ([buildDir, sourceDir, os.environ["PATH"]])
+
+    corpus = os.path.join (buildDir, "bench", "corpus")
+    parameters = generate.generate (corpus, opts.tus, opts.headers, opts.depth,
+                                    opts.includes, opts.seed)
+
+    micro = subprocess.check_output (
+        [os.path.join (buildDir, "bench_micro"),
+         "--work", os.path.join (buildDir, "bench", "work"),
+         "--corpus", corpus])
+    micro = json.loads (micro.decode ("utf-8"))
+
+    results = {"date": time.strftime ("%Y-%m-%dT%H:%M:%S"),
+               "host": platform.node (),
+               "corpus": parameters,
+               "micro": micro}
+
+    if opts.e2e:
+        results["e2e"], results["server"] = endToEnd (corpus, opts.iterations)
+
+    with open (opts.output, "w") as f:
+        json.dump (results, f, indent = 2, sort_keys = True)
+        f.write ("\n")
+    sys.stderr.write ("Results written to %s\n" % opts.output)
+
+
+if __name__ == "__main__":
+    main ()
@@ -1,39 +1,284 @@
 #include "application.hxx"
+#include "util/util.hxx"
+#include "util/queue.hxx"
 #include "json/json.h"
 #include <fstream>
+#include <set>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <exception>
 
-void Application::compilationDatabase (CompilationDatabaseArgs & args,
-                                       std::ostream & cout) {
-  // Change back to the original WD (in case `index` or `update` would have
-  // changed it)
-  chdir (cwd_);
+// Read the elements of a top-level JSON array, one at a time, without loading
+// the whole document in memory. Each object is returned as JSON text, to be
+// parsed separately.
+class JsonArrayReader {
+public:
+  JsonArrayReader (std::istream & in)
+    : in_ (in),
+      pos_ (0),
+      size_ (0),
+      started_ (false)
+  { }
+
+  // Return false at the end of the array
+  bool next (std::string & object) {
+    if (!started_) {
+      started_ = true;
+      char c;
+      if (!nextNonBlank_ (c) || c != '[') {
+        throw std::runtime_error ("expected a JSON array");
+      }
+    }
+
+    object.clear();
+    char c;
+    while (true) {
+      if (!nextNonBlank_ (c)) {
+        throw std::runtime_error ("unexpected end of the JSON array");
+      }
+      if (c == ']') {
+        return false;
+      }
+      if (c == '{') {
+        break;
+      }
+      if (c != ',') {
+        throw std::runtime_error (std::string ("unexpected character in the JSON"
+                                               " array: `") + c + "'");
+      }
+    }
+
+    // Copy the object, up to the matching closing brace
+    object += c;
+    unsigned int depth = 1;
+    bool inString = false;
+    bool escaped  = false;
+    while (depth > 0) {
+      if (!get_ (c)) {
+        throw std::runtime_error ("unexpected end of a JSON object");
+      }
+      object += c;
+
+      if (inString) {
+        if (escaped) {
+          escaped = false;
+        } else if (c == '\\') {
+          escaped = true;
+        } else if (c == '"') {
+          inString = false;
+        }
+      } else if (c == '"') {
+        inString = true;
+      } else if (c == '{' || c == '[') {
+        ++depth;
+      } else if (c == '}' || c == ']') {
+        --depth;
+      }
+    }
+    return true;
+  }
+
+private:
+  bool get_ (char & c) {
+    if (pos_ == size_) {
+      in_.read (buffer_, sizeof (buffer_));
+      size_ = in_.gcount();
+      pos_ = 0;
+      if (size_ == 0) {
+        return false;
+      }
+    }
+    c = buffer_[pos_++];
+    return true;
+  }
+
+  bool nextNonBlank_ (char & c) {
+    while (get_ (c)) {
+      if (c != ' ' && c != '\t' && c != '\n' && c != '\r') {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  std::istream &  in_;
+  char            buffer_[1 << 16];
+  std::streamsize pos_;
+  std::streamsize size_;
+  bool            started_;
+};
+
+
+// A compilation database entry, parsed by a worker thread
+struct CompileCommandEntry {
+  std::string              fileName;
+  Storage::CompileCommand  command;
+  std::string              error;
+};
+
+static CompileCommandEntry parseEntry (const std::string & text) {
+  CompileCommandEntry entry;
 
   Json::Value root;
   Json::Reader reader;
+  if (!reader.parse (text, root, false) || !root.isObject()) {
+    entry.error = reader.getFormattedErrorMessages();
+    return entry;
+  }
+
+  entry.command.directory = root["directory"].asString();
+  entry.fileName = root["file"].asString();
+  if (entry.fileName != "" && entry.fileName[0] != '/'
+      && entry.command.directory != "") {
+    entry.fileName = entry.command.directory + "/" + entry.fileName;
+  }
+
+  // Either an already split argument list, or a shell command line
+  std::vector<std::string> & args = entry.command.args;
+  if (root.isMember ("arguments")) {
+    const Json::Value & arguments = root["arguments"];
+    for (unsigned int i = 0 ; i < arguments.size() ; ++i) {
+      args.push_back (arguments[i].asString());
+    }
+  } else {
+    try {
+      args = shellSplit (root["command"].asString());
+    } catch (std::runtime_error & e) {
+      entry.error = e.what();
+      return entry;
+    }
+  }
+
+  // Drop the compiler itself
+  if (!args.empty()) {
+    args.erase (args.begin());
+  }
+
+  return entry;
+}
+
+
+void Application::compilationDatabase (CompilationDatabaseArgs & args,
+                                       std::ostream & cout) {
+  Timer timer;
 
   std::ifstream json (args.fileName);
-  bool ret = reader.parse (json, root);
-  if ( !ret ) {
-    cout  << "Failed to parse compilation database `" << args.fileName << "'\n"
-          << reader.getFormattedErrorMessages();
+  if (!json) {
+    cout << "Could not open compilation database `" << args.fileName << "'"
+         << std::endl;
+    return;
   }
 
-  auto transaction(storage_.beginTransaction());
+  // Entries are read by the reader thread, parsed by the workers, and written
+  // by this thread: only entries which changed since the last load are
+  // written to the database. Queues are bounded, so that the reader does not
+  // run far ahead of the others with the whole file in memory.
+  Queue<std::string>         texts (1024);
+  Queue<CompileCommandEntry> entries (1024);
+  std::atomic<unsigned int>  running
+    (std::max (2u, std::thread::hardware_concurrency()) - 1);
+
+  std::vector<std::thread> workers;
+  for (unsigned int i = running ; i > 0 ; --i) {
+    workers.push_back (std::thread ([&] {
+          std::string text;
+          while (texts.pop (text)) {
+            entries.push (parseEntry (text));
+          }
+          if (--running == 0) {
+            entries.close();
+          }
+        }));
+  }
 
-  for (unsigned int i=0 ; i<root.size() ; ++i) {
-    std::string fileName = root[i]["file"].asString();
-    std::string directory = root[i]["directory"].asString();
+  std::string error;
+  std::thread reader ([&] {
+      try {
+        JsonArrayReader array (json);
+        std::string text;
+        while (array.next (text)) {
+          texts.push (text);
+        }
+      } catch (std::runtime_error & e) {
+        error = e.what();
+      }
+      texts.close();
+    });
 
-    std::vector<std::string> clArgs;
-    std::istringstream command (root[i]["command"].asString());
-    std::string arg;
-    std::getline (command, arg, ' ');
-    do {
-      std::getline (command, arg, ' ');
-      clArgs.push_back (arg);
-    } while (! command.eof());
+  unsigned int total   = 0;
+  unsigned int changed = 0;
+  unsigned int removed = 0;
+  std::exception_ptr failure;
+  try {
+    const auto stored = storage_.compileCommands();
+    Storage::Load load (storage_, Storage::Incremental);
+
+    std::set<std::string> listed;
+    bool entryErrors = false;
+    CompileCommandEntry entry;
+    while (entries.pop (entry)) {
+      if (entry.error != "") {
+        cout << "Failed to parse compilation database entry:" << std::endl
+             << entry.error << std::endl;
+        entryErrors = true;
+        continue;
+      }
+      if (entry.fileName == "") {
+        continue;
+      }
+      ++total;
+      listed.insert (entry.fileName);
+
+      auto old = stored.find (entry.fileName);
+      if (old != stored.end()
+          && old->second.directory == entry.command.directory
+          && old->second.args      == entry.command.args) {
+        continue;
+      }
+
+      cout << "  " << entry.fileName << std::endl;
+      storage_.setCompileCommand (entry.fileName,
+                                  entry.command.directory,
+                                  entry.command.args);
+      ++changed;
+    }
+
+    // Source files which are not compiled any more. They are only removed
+    // when the whole file could be read: otherwise, they may simply not have
+    // been reached.
+    reader.join();
+    if (error == "" && !entryErrors) {
+      for (auto it = stored.begin() ; it != stored.end() ; ++it) {
+        if (listed.count (it->first) == 0) {
+          cout << "  removed " << it->first << std::endl;
+          storage_.removeFile (it->first);
+          ++removed;
+        }
+      }
+    }
+    load.finish();
+  } catch (...) {
+    // Let the threads finish before reporting the failure
+    failure = std::current_exception();
+    CompileCommandEntry entry;
+    while (entries.pop (entry)) { }
+  }
+
+  if (reader.joinable()) {
+    reader.join();
+  }
+  for (auto worker = workers.begin() ; worker != workers.end() ; ++worker) {
+    worker->join();
+  }
+  if (failure) {
+    std::rethrow_exception (failure);
+  }
 
-    cout << "  " << fileName << std::endl;
-    storage_.setCompileCommand (fileName, directory, clArgs);
+  if (error != "") {
+    cout << "Failed to parse compilation database `" << args.fileName << "'"
+         << std::endl << error << std::endl;
   }
+  cout << total << " compilation commands, " << changed << " updated, "
+       << removed << " removed, in " << timer.get() << "s." << std::endl;
 }
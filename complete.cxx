@@ -1,7 +1,9 @@
 #include "application.hxx"
 
 #include <clang-c/Index.h>
+#include <algorithm>
 #include <cassert>
+#include <cctype>
 
 
 namespace LibClang {
@@ -215,20 +217,135 @@ void printCompletionResult(LibClang::CompletionResult completionResult,
   stream << std::endl;
 }
 
+// Code completions computed at the beginning of a token, from which results
+// are selected as the user types the rest of the token
+struct Application::CompletionCache {
+  CompletionCache (const std::string & fileName, int line, int column,
+                   LibClang::CodeCompletions completions)
+    : fileName    (fileName),
+      line        (line),
+      column      (column),
+      completions (completions)
+  {
+    const unsigned int n = this->completions.size();
+    candidates.reserve (n);
+    for (unsigned int i = 0 ; i < n ; ++i) {
+      LibClang::Completion completion = this->completions[i].get();
+
+      Candidate candidate;
+      candidate.index    = i;
+      candidate.priority = completion.priority();
+      for (unsigned int j = 0, size = completion.size() ; j < size ; ++j) {
+        LibClang::Chunk chunk = completion.chunk (j);
+        if (chunk.kind() == CXCompletionChunk_TypedText) {
+          candidate.typedText = chunk.text();
+          break;
+        }
+      }
+      candidates.push_back (candidate);
+    }
+  }
+
+  struct Candidate {
+    unsigned int index;
+    unsigned int priority;  // smaller values are more likely
+    std::string  typedText;
+  };
+
+  const std::string         fileName;
+  const int                 line;
+  const int                 column;
+  LibClang::CodeCompletions completions;
+  std::vector<Candidate>    candidates;
+};
+
+// How well a completion matches what the user typed:
+//   0: prefix
+//   1: prefix, ignoring case
+//   2: all characters appear in the same order, ignoring case
+//  -1: no match
+static int matchCompletion (const std::string & text, const std::string & prefix) {
+  if (text.compare (0, prefix.size(), prefix) == 0) {
+    return 0;
+  }
+
+  if (prefix.size() <= text.size()) {
+    bool match = true;
+    for (size_t i = 0 ; match && i < prefix.size() ; ++i) {
+      match = tolower ((unsigned char) text[i]) == tolower ((unsigned char) prefix[i]);
+    }
+    if (match) {
+      return 1;
+    }
+  }
+
+  size_t j = 0;
+  for (size_t i = 0 ; i < text.size() && j < prefix.size() ; ++i) {
+    if (tolower ((unsigned char) text[i]) == tolower ((unsigned char) prefix[j])) {
+      ++j;
+    }
+  }
+  return j == prefix.size() ? 2 : -1;
+}
+
 void Application::complete (CompleteArgs & args, std::ostream & cout) {
-  LibClang::TranslationUnit & tu = translationUnit_ (args.fileName);
+  // Completion is requested at the beginning of the token, so that results
+  // can be reused while the rest of the token is typed. An empty prefix starts
+  // a new completion.
+  const int column = args.prefix.size() <= (size_t)args.column
+    ? args.column - args.prefix.size()
+    : args.column;
+
+  CompletionCache * cache = completionCache_.get();
+  if (cache == NULL
+      || args.prefix == ""
+      || cache->fileName != args.fileName
+      || cache->line     != args.line
+      || cache->column   != column) {
+    LibClang::UnsavedFiles unsaved;
+    LibClang::TranslationUnit & tu
+      = translationUnit_ (args.fileName, args.contents, unsaved);
+
+    CXCodeCompleteResults * results
+      = clang_codeCompleteAt(tu.raw(),
+                             args.fileName.c_str(), args.line, column,
+                             unsaved.begin(), unsaved.size(),
+                             clang_defaultCodeCompleteOptions());
+    completionCache_.reset (new CompletionCache (args.fileName, args.line, column,
+                                                 LibClang::CodeCompletions (results)));
+    cache = completionCache_.get();
+  }
 
-  CXCodeCompleteResults * results
-    = clang_codeCompleteAt(tu.raw(),
-                           args.fileName.c_str(), args.line, args.column,
-                           0, 0,
-                           clang_defaultCodeCompleteOptions());
-  LibClang::CodeCompletions completions (results);
-  completions.sort();
+  // Filter candidates
+  typedef std::pair<int, const CompletionCache::Candidate *> Match;
+  std::vector<Match> matches;
+  auto candidate = cache->candidates.begin();
+  auto end       = cache->candidates.end();
+  for ( ; candidate != end ; ++candidate) {
+    const int quality = matchCompletion (candidate->typedText, args.prefix);
+    if (quality >= 0) {
+      matches.push_back (Match (quality, &*candidate));
+    }
+  }
+
+  // Rank them by match quality, then priority
+  auto better = [] (const Match & a, const Match & b) {
+    if (a.first != b.first) {
+      return a.first < b.first;
+    }
+    if (a.second->priority != b.second->priority) {
+      return a.second->priority < b.second->priority;
+    }
+    return a.second->typedText < b.second->typedText;
+  };
+  const size_t n = args.max > 0 && args.max < matches.size()
+    ? args.max
+    : matches.size();
+  std::partial_sort (matches.begin(), matches.begin() + n, matches.end(), better);
 
   cout << std::endl;
 
-  int n = completions.size();
-  for (int i = 0 ; i != n ; ++i)
-    printCompletionResult (completions[i], cout);
+  // Only build completion strings for the selected results
+  for (size_t i = 0 ; i < n ; ++i)
+    printCompletionResult (cache->completions[matches[i].second->index], cout);
 }
@@ -0,0 +1,21 @@
+#include "application.hxx"
+
+void Application::config (ConfigArgs & args, std::ostream & cout) {
+  if (args.value != "") {
+    cout << args.name << " = " << storage_.setPragma (args.name, args.value)
+         << std::endl;
+    return;
+  }
+
+  // Without a name, display all tunables
+  std::vector<std::string> names;
+  if (args.name == "") {
+    names = Storage::tunables();
+  } else {
+    names.push_back (args.name);
+  }
+
+  for (auto name = names.begin() ; name != names.end() ; ++name) {
+    cout << *name << " = " << storage_.pragma (*name) << std::endl;
+  }
+}
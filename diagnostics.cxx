@@ -0,0 +1,113 @@
+#include "application.hxx"
+#include "util/util.hxx"
+
+#include <algorithm>
+#include <iterator>
+#include <set>
+
+std::vector<Storage::Diagnostic>
+Application::collectDiagnostics (LibClang::TranslationUnit & tu,
+                                 const std::string & source,
+                                 const std::string & directory)
+{
+  // Many diagnostics are located in the same files: resolve their names once
+  std::map<CXFile, std::string> fileNames;
+  auto fileName = [&] (CXFile file) -> const std::string & {
+    auto it = fileNames.find (file);
+    if (it == fileNames.end()) {
+      it = fileNames.insert (std::make_pair
+                             (file, LibClang::SourceLocation::fileName (file, directory)))
+        .first;
+    }
+    return it->second;
+  };
+
+  std::vector<Storage::Diagnostic> res;
+  for (unsigned int N = tu.numDiagnostics(),
+         i = 0 ; i < N ; ++i) {
+    const LibClang::TranslationUnit::Diagnostic details = tu.diagnosticDetails (i);
+
+    Storage::Diagnostic diagnostic;
+    LibClang::SourceLocation::Position position;
+    diagnostic.file     = fileName (details.location.expansionFile (position));
+    diagnostic.source   = source;
+    diagnostic.severity = details.severity;
+    diagnostic.line     = position.line;
+    diagnostic.col      = position.column;
+    diagnostic.offset   = position.offset;
+    diagnostic.message  = details.message;
+    diagnostic.option   = details.option;
+
+    for (auto it = details.fixIts.begin() ; it != details.fixIts.end() ; ++it) {
+      Storage::Diagnostic::FixIt fixIt;
+      LibClang::SourceLocation::Position begin, end;
+      fixIt.file        = fileName (it->begin.expansionFile (begin));
+      it->end.expansionFile (end);
+      fixIt.line1       = begin.line;
+      fixIt.col1        = begin.column;
+      fixIt.offset1     = begin.offset;
+      fixIt.line2       = end.line;
+      fixIt.col2        = end.column;
+      fixIt.offset2     = end.offset;
+      fixIt.replacement = it->replacement;
+      diagnostic.fixIts.push_back (fixIt);
+    }
+
+    res.push_back (diagnostic);
+  }
+  return res;
+}
+
+void Application::diagnostics (const DiagnosticsArgs & args, std::ostream & cout) {
+  Timer timer;
+  const int severity = Storage::Diagnostic::severityLevel (args.severity);
+  auto selected = [&] (const Storage::Diagnostic & diagnostic) {
+    return diagnostic.severity >= severity
+      && (args.fileName == "" || diagnostic.file == args.fileName);
+  };
+
+  // Cached translation units were parsed more recently than the index
+  // (possibly from unsaved buffers): their diagnostics replace the stored
+  // ones. They are collected once per parse, without reparsing anything.
+  adoptWarmedUp_();
+  std::vector<Storage::Diagnostic> res;
+  std::set<std::string> parsed;
+  for (auto state = parseState_.begin() ; state != parseState_.end() ; ++state) {
+    if (!tu_.contains (state->first)) {
+      continue;
+    }
+
+    if (!state->second.diagnostics) {
+      state->second.diagnostics.reset
+        (new std::vector<Storage::Diagnostic>
+         (collectDiagnostics (tu_.get (state->first), state->first,
+                              state->second.directory)));
+    }
+    parsed.insert (state->first);
+
+    const std::vector<Storage::Diagnostic> & diagnostics = *state->second.diagnostics;
+    std::copy_if (diagnostics.begin(), diagnostics.end(), std::back_inserter (res),
+                  selected);
+  }
+
+  const std::vector<Storage::Diagnostic> stored
+    = storage_.diagnostics (args.fileName, severity);
+  for (auto it = stored.begin() ; it != stored.end() ; ++it) {
+    if (parsed.count (it->source) == 0) {
+      res.push_back (*it);
+    }
+  }
+
+  std::stable_sort (res.begin(), res.end(),
+                    [] (const Storage::Diagnostic & a, const Storage::Diagnostic & b) {
+                      return std::make_pair (a.file, a.offset)
+                        < std::make_pair (b.file, b.offset);
+                    });
+
+  Json::FastWriter writer;
+  for (auto it = res.begin() ; it != res.end() ; ++it) {
+    cout << writer.write (it->json());
+  }
+
+  Metrics::global().time ("query.diagnostics", timer.get());
+}
@@ -14,9 +14,9 @@ void displayRefDef (const Storage::RefDef & refDef, std::ostream & cout)
 
   // Display reference
   {
-    SourceFile sourceFile (ref.file);
+    const SourceFileCache::Ptr sourceFile = SourceFileCache::global().get (ref.file);
 
-    cout << "-- " << sourceFile.substring (ref.offset1, ref.offset2) << " -- "
+    cout << "-- " << sourceFile->substring (ref.offset1, ref.offset2) << " -- "
          << ref.kind << " " << ref.spelling
          << std::endl;
   }
@@ -39,8 +39,8 @@ void outputRefDef (const Storage::RefDef & refDef, std::ostream & cout)
   Json::Value json = refDef.json();
 
   const Storage::Reference & ref = refDef.ref;
-  SourceFile sourceFile (ref.file);
-  json["ref"]["substring"] = sourceFile.substring (ref.offset1, ref.offset2);
+  const SourceFileCache::Ptr sourceFile = SourceFileCache::global().get (ref.file);
+  json["ref"]["substring"] = sourceFile->substring (ref.offset1, ref.offset2);
 
   cout << writer.write (json);
 }
@@ -86,6 +86,11 @@ void displayCursor (LibClang::Cursor cursor, std::ostream & cout)
   outputRefDef (refDef, cout);
 }
 
+// Display all cursors located at the same place as a target cursor.
+//
+// Only cursors whose source range spans the target are recursed into, so that
+// the traversal follows the path from the translation unit to the target
+// instead of visiting the whole AST.
 class FindDefinition : public LibClang::Visitor<FindDefinition>
 {
 public:
@@ -93,19 +98,36 @@ public:
                   std::ostream & cout)
     : targetLocation_ (targetLocation),
       cout_ (cout)
-  {}
+  {
+    LibClang::SourceLocation::Position position;
+    targetFile_   = targetLocation_.expansionFile (position);
+    targetOffset_ = position.offset;
+  }
 
   CXChildVisitResult visit (LibClang::Cursor cursor,
                             LibClang::Cursor parent)
   {
-    const LibClang::SourceLocation location (cursor.location());
+    LibClang::SourceLocation::Position begin, end;
+    const CXFile beginFile = cursor.begin().expansionFile (begin);
+    const CXFile endFile   = cursor.end().expansionFile (end);
+    if (beginFile != targetFile_ || endFile != targetFile_
+        || end.offset < targetOffset_) {
+      return CXChildVisit_Continue;
+    }
+    if (begin.offset > targetOffset_) {
+      // Top-level declarations of a file are visited in source order: none of
+      // the following ones can span the target
+      return parent.isTranslationUnit()
+        ? CXChildVisit_Break
+        : CXChildVisit_Continue;
+    }
 
     // Skip unexposed cursor kinds
     if (cursor.isUnexposed()) {
       return CXChildVisit_Recurse;
     }
 
-    if (location == targetLocation_) {
+    if (cursor.location() == targetLocation_) {
       displayCursor (cursor, cout_);
     }
 
@@ -114,11 +136,17 @@ public:
 
 private:
   const LibClang::SourceLocation & targetLocation_;
+  CXFile                           targetFile_;
+  unsigned int                     targetOffset_;
   std::ostream & cout_;
 };
 
 void Application::findDefinitionFromIndex_ (FindDefinitionArgs & args, std::ostream & cout) {
-  const auto refDefs = storage_.findDefinition (args.fileName, args.offset);
+  Timer timer;
+  const auto refDefs = remote_
+    ? findDefinitionRemote_ (args.fileName, args.offset)
+    : shards_.findDefinition (args.fileName, args.offset);
+  Metrics::global().time ("query.find", timer.get());
   auto refDef = refDefs.begin();
   const auto end = args.mostSpecific
     ? refDef + 1
@@ -129,12 +157,11 @@ void Application::findDefinitionFromIndex_ (FindDefinitionArgs & args, std::ostr
 }
 
 void Application::findDefinitionFromSource_ (FindDefinitionArgs & args, std::ostream & cout) {
-  std::string directory;
-  std::vector<std::string> clArgs;
-  storage_.getCompileCommand (args.fileName, directory, clArgs);
-
-  LibClang::Index index;
-  LibClang::TranslationUnit tu = index.parse (clArgs);
+  // The translation unit is shared with code completion, and only reparsed
+  // when its sources changed
+  LibClang::UnsavedFiles unsaved;
+  LibClang::TranslationUnit & tu
+    = translationUnit_ (args.fileName, args.contents, unsaved);
 
   // Print clang diagnostics if requested
   if (args.diagnostics) {
@@ -146,6 +173,9 @@ void Application::findDefinitionFromSource_ (FindDefinitionArgs & args, std::ost
 
   // Print cursor definition
   LibClang::Cursor cursor (tu, args.fileName.c_str(), args.offset);
+  if (cursor.isNull()) {
+    return;
+  }
   if (args.mostSpecific) {
     displayCursor (cursor, cout);
   }
@@ -1,16 +1,33 @@
 #include "application.hxx"
 #include "sourceFile.hxx"
+#include "util/util.hxx"
 
 void Application::grep (const GrepArgs & args, std::ostream & cout) {
   Json::FastWriter writer;
+  Timer timer;
+  unsigned int count = 0;
 
-  const auto refs = storage_.grep (args.usr);
-  auto ref = refs.begin ();
-  const auto end = refs.end ();
-  for ( ; ref != end ; ++ref ) {
-    Json::Value json = ref->json();
-    SourceFile file (ref->file);
-    json["lineContents"] = file.line (ref->line1);
+  // Results are written as they are read from the index (or merged from all
+  // shards and the remote index, when some are used)
+  auto output = [&] (const Storage::Reference & ref) {
+    Json::Value json = ref.json();
+    const SourceFileCache::Ptr file = SourceFileCache::global().get (ref.file);
+    json["lineContents"] = file->line (ref.line1);
     cout << writer.write (json);
+
+    if (count++ == 0) {
+      cout << std::flush;
+      Metrics::global().time ("query.grep.first", timer.get());
+      std::cerr << "grep: first result after " << timer.get() << "s." << std::endl;
+    }
+  };
+
+  if (remote_) {
+    grepRemote_ (args, output);
+  } else {
+    shards_.grep (args.usr, args.filePrefix, args.offset, args.limit, output);
   }
+
+  Metrics::global().time ("query.grep", timer.get());
+  std::cerr << "grep: " << count << " results in " << timer.get() << "s." << std::endl;
 }
@@ -2,31 +2,253 @@
 #include "getopt++/getopt.hxx"
 
 #include "util/util.hxx"
+#include "util/queue.hxx"
+#include "util/stringPool.hxx"
 #include "application.hxx"
 
 #include <cstdlib>
 #include <string>
 #include <iostream>
 #include <fstream>
+#include <map>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
 
-class Indexer : public LibClang::Visitor<Indexer> {
+// Tags found by an indexing worker in a given file, waiting to be written to
+// the storage. Duplicates are removed as tags are added.
+class FileTags {
 public:
-  Indexer (const std::string & fileName,
-           const std::vector<std::string> & exclude,
-           Storage & storage,
-           std::ostream & cout)
-    : sourceFile_ (fileName),
-      exclude_    (exclude),
-      storage_    (storage),
-      cout_       (cout)
-  {
-    needsUpdate_[fileName] = storage.beginFile (fileName);
-    storage_.addInclude (fileName, fileName);
+  // Return false if a tag with the same (usr, offset1, offset2) is already
+  // known. USRs are interned by the caller, and compared by address.
+  bool insert (const char * usr, int offset1, int offset2) {
+    return keys_.insert (Key {usr, offset1, offset2}).second;
   }
 
+  // Forget the keys of known tags, once all tags have been inserted (the
+  // interned USRs they point to go away with the translation unit)
+  void releaseKeys () {
+    std::unordered_set<Key, KeyHash>().swap (keys_);
+  }
+
+  std::vector<Storage::Tag> tags;
+
+private:
+  struct Key {
+    const char * usr;
+    int offset1;
+    int offset2;
+
+    bool operator== (const Key & other) const {
+      return offset1 == other.offset1
+        &&   offset2 == other.offset2
+        &&   usr == other.usr;
+    }
+  };
+
+  struct KeyHash {
+    size_t operator() (const Key & key) const {
+      size_t h = std::hash<const char *>() (key.usr);
+      h ^= std::hash<int>() (key.offset1) + 0x9e3779b9 + (h << 6) + (h >> 2);
+      h ^= std::hash<int>() (key.offset2) + 0x9e3779b9 + (h << 6) + (h >> 2);
+      return h;
+    }
+  };
+
+  std::unordered_set<Key, KeyHash> keys_;
+};
+
+// Translation unit to be parsed and indexed by a worker
+struct IndexJob {
+  std::string              fileName;
+  std::string              directory;
+  std::vector<std::string> clArgs;
+};
+
+// Everything a worker found in a translation unit
+struct IndexResult {
+  std::string                                      fileName;
+  std::string                                      error;
+  double                                           parseTime;
+  double                                           indexTime;
+  std::vector<Storage::Diagnostic>                 diagnostics;
+  std::vector<std::string>                         messages; // formatted diagnostics
+  std::vector<std::string>                         files; // in visiting order
+  std::map<std::string, FileTags>                  tags;  // of visited files
+};
+
+
+// Headers already claimed by a translation unit during an indexing run, for
+// each preprocessor configuration. A header included by many translation
+// units compiled with the same configuration only needs to be visited in one
+// of them. Claims are shared by all workers.
+class HeaderClaims {
+public:
+  // Return false if another translation unit already claimed the file
+  bool claim (size_t configuration, const std::string & fileName) {
+    std::lock_guard<std::mutex> lock (mutex_);
+    return claims_.insert (std::make_pair (configuration, fileName)).second;
+  }
+
+private:
+  std::set<std::pair<size_t, std::string> > claims_;
+  std::mutex                                mutex_;
+};
+
+
+// Collects the tags found in a translation unit, whatever the indexing engine.
+// Files which are excluded, or indexed by another translation unit, are
+// skipped.
+class TagCollector {
+public:
+  TagCollector (const std::string & directory,
+                const std::vector<std::string> & exclude,
+                size_t configuration,
+                HeaderClaims & claims,
+                IndexResult & result)
+    : directory_     (directory),
+      exclude_       (exclude),
+      configuration_ (configuration),
+      claims_        (claims),
+      result_        (result),
+      lastFile_      (NULL),
+      lastTags_      (NULL)
+  { }
+
+  ~TagCollector () {
+    for (auto it = names_.begin() ; it != names_.end() ; ++it) {
+      if (it->second) {
+        it->second->releaseKeys();
+      }
+    }
+  }
+
+  // Tags of the given file, or NULL if the file is skipped
+  FileTags * fileTags (CXFile file) {
+    if (file == NULL) {
+      return NULL;
+    }
+
+    // Consecutive cursors are most often located in the same file
+    if (file == lastFile_) {
+      return lastTags_;
+    }
+
+    auto it = files_.find (file);
+    if (it == files_.end()) {
+      it = files_.insert (std::make_pair (file, newFile_ (file))).first;
+    }
+
+    lastFile_ = file;
+    lastTags_ = it->second;
+    return lastTags_;
+  }
+
+  // Add a tag for a cursor referencing usr, located at begin.
+  //
+  // Cursors are visited many times more than there are distinct tags: nothing
+  // is allocated for tags which are already known, and strings are only
+  // copied when a new tag is stored.
+  void add (FileTags & tags,
+            const LibClang::Cursor & cursor,
+            const StringView & usr,
+            const LibClang::SourceLocation::Position & begin) {
+    LibClang::SourceLocation::Position end;
+    cursor.end().expansionFile (end);
+    const StringView interned = usrs_.intern (usr);
+    if (!tags.insert (interned.data(), begin.offset, end.offset)) {
+      return;
+    }
+
+    Storage::Tag tag;
+    tag.usr           = interned.str();
+    tag.kind          = cursor.kindName();
+    tag.spelling      = cursor.spellingRef().str();
+    tag.line1         = begin.line;
+    tag.col1          = begin.column;
+    tag.offset1       = begin.offset;
+    tag.line2         = end.line;
+    tag.col2          = end.column;
+    tag.offset2       = end.offset;
+    tag.isDeclaration = cursor.isDeclaration();
+    tags.tags.push_back (tag);
+  }
+
+private:
+  FileTags * newFile_ (CXFile file) {
+    const String fileName = LibClang::SourceLocation::fileName (file, directory_);
+    if (fileName == "") {
+      return NULL;
+    }
+
+    // Several handles can refer to the same file
+    auto known = names_.find (fileName);
+    if (known != names_.end()) {
+      return known->second;
+    }
+
+    FileTags * tags = NULL;
+    if (!excluded_ (fileName)) {
+      result_.files.push_back (fileName);
+      if (fileName == result_.fileName || claims_.claim (configuration_, fileName)) {
+        tags = &result_.tags[fileName];
+      }
+    }
+
+    names_[fileName] = tags;
+    return tags;
+  }
+
+  bool excluded_ (const String & fileName) const {
+    auto it  = exclude_.begin();
+    auto end = exclude_.end();
+    for ( ; it != end ; ++it) {
+      if (fileName.startsWith (*it)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  const std::string              & directory_;
+  const std::vector<std::string> & exclude_;
+  const size_t                     configuration_;
+  HeaderClaims                   & claims_;
+  IndexResult                    & result_;
+
+  std::unordered_map<CXFile, FileTags *>      files_;
+  std::unordered_map<std::string, FileTags *> names_;
+  StringPool                                  usrs_;   // of this translation unit
+  CXFile                                      lastFile_;
+  FileTags *                                  lastTags_;
+};
+
+
+// "visitor" engine: traverse the whole AST, and collect a tag for each cursor
+// referencing something
+class Indexer : public LibClang::Visitor<Indexer> {
+public:
+  Indexer (TagCollector & collector)
+    : collector_ (collector)
+  { }
+
   CXChildVisitResult visit (LibClang::Cursor cursor,
                             LibClang::Cursor parent)
   {
+    LibClang::SourceLocation::Position begin;
+    const CXFile file = cursor.location().expansionFile (begin);
+
+    // Skip cursors in excluded files, or files indexed by another translation
+    // unit, along with their children
+    FileTags * tags = collector_.fileTags (file);
+    if (tags == NULL) {
+      return file == NULL
+        ? CXChildVisit_Recurse
+        : CXChildVisit_Continue;
+    }
+
     const LibClang::Cursor cursorDef (cursor.referenced());
 
     // Skip non-reference cursors
@@ -34,102 +256,345 @@ public:
       return CXChildVisit_Recurse;
     }
 
-    const std::string usr = cursorDef.USR();
-    if (usr == "") {
+    const LibClang::StringRef usr = cursorDef.USRRef();
+    if (usr.empty()) {
       return CXChildVisit_Recurse;
     }
 
-    const LibClang::SourceLocation::Position begin = cursor.location().expansionLocation();
-    const String fileName = begin.file;
+    collector_.add (*tags, cursor, StringView (usr.c_str(), usr.size()), begin);
+    return CXChildVisit_Recurse;
+  }
 
-    if (fileName == "") {
-      return CXChildVisit_Continue;
+private:
+  TagCollector & collector_;
+};
+
+
+// "indexer" engine: collect the declarations and references reported by
+// libclang's indexing API
+class IndexCallbacks {
+public:
+  IndexCallbacks (TagCollector & collector)
+    : collector_ (collector)
+  { }
+
+  // Record inclusions, even of files which contain no tags
+  void includedFile (CXFile file) {
+    collector_.fileTags (file);
+  }
+
+  void declaration (LibClang::Cursor cursor, const char * usr) {
+    add_ (cursor, usr);
+  }
+
+  void reference (LibClang::Cursor cursor, const char * usr) {
+    add_ (cursor, usr);
+  }
+
+private:
+  void add_ (const LibClang::Cursor & cursor, const char * usr) {
+    if (usr[0] == '\0') {
+      return;
     }
 
-    { // Skip excluded paths
-      auto it  = exclude_.begin();
-      auto end = exclude_.end();
-      for ( ; it != end ; ++it) {
-        if (fileName.startsWith (*it)) {
-          return CXChildVisit_Continue;
+    LibClang::SourceLocation::Position begin;
+    FileTags * tags = collector_.fileTags (cursor.location().expansionFile (begin));
+    if (tags != NULL) {
+      collector_.add (*tags, cursor, StringView (usr), begin);
+    }
+  }
+
+  TagCollector & collector_;
+};
+
+
+// Diagnostics are always stored in the index, but only formatted for the
+// client when requested
+void collectDiagnostics (LibClang::TranslationUnit & tu,
+                         const IndexJob & job,
+                         const Application::IndexArgs & args,
+                         IndexResult & result)
+{
+  result.diagnostics = Application::collectDiagnostics (tu, job.fileName,
+                                                        job.directory);
+  if (args.diagnostics) {
+    for (unsigned int N = tu.numDiagnostics(),
+           i = 0 ; i < N ; ++i) {
+      result.messages.push_back (tu.diagnostic (i));
+    }
+  }
+}
+
+
+// Worker thread: parse and index translation units until the jobs queue is
+// closed. Each worker uses its own libclang index, and never touches the
+// storage: results are sent back to the writer thread.
+void indexWorker (Queue<IndexJob> & jobs,
+                  Queue<IndexResult> & results,
+                  PchCache & pch,
+                  HeaderClaims & claims,
+                  const Application::IndexArgs & args)
+{
+  // Leave the CPU to interactive requests
+  LibClang::Index index;
+  index.setGlobalOptions (CXGlobalOpt_ThreadBackgroundPriorityForAll);
+
+  // Translation units indexed by this worker with the same preprocessor
+  // configuration share an indexing session, in which the bodies of headers
+  // already parsed are skipped. Another configuration may see different
+  // bodies (and holds its own header claims): it gets its own session.
+  std::map<size_t, LibClang::IndexAction> actions;
+  const bool useIndexer = args.engine == "indexer";
+
+  IndexJob job;
+  while (jobs.pop (job)) {
+    IndexResult result;
+    result.fileName  = job.fileName;
+    result.parseTime = 0;
+    result.indexTime = 0;
+
+    try {
+      Timer timer;
+      const size_t config = Storage::configuration (job.directory, job.clArgs);
+      Application::addWorkingDirectory (job.clArgs, job.directory);
+      TagCollector collector (job.directory, args.exclude, config, claims, result);
+
+      if (useIndexer) {
+        // Parsing and indexing happen at once: all the time is accounted for
+        // as parsing time
+        IndexCallbacks callbacks (collector);
+        auto action = actions.find (config);
+        if (action == actions.end()) {
+          action = actions.insert (std::make_pair (config, LibClang::IndexAction (index)))
+            .first;
         }
+        LibClang::TranslationUnit tu
+          = action->second.indexSourceFile (callbacks, job.clArgs,
+                                    CXIndexOpt_SkipParsedBodiesInSession,
+                                    CXTranslationUnit_None);
+        result.parseTime = timer.get();
+        Metrics::global().time ("index.parse", result.parseTime);
+        collectDiagnostics (tu, job, args, result);
+      } else {
+        LibClang::TranslationUnit tu = args.pch
+          ? pch.parse (index, job.fileName, job.directory, job.clArgs,
+                       CXTranslationUnit_DetailedPreprocessingRecord,
+                       /*build=*/true)
+          : index.parse (job.clArgs);
+
+        result.parseTime = timer.get();
+        Metrics::global().time ("index.parse", result.parseTime);
+        timer.reset();
+
+        collectDiagnostics (tu, job, args, result);
+
+        LibClang::Cursor top (tu);
+        Indexer indexer (collector);
+        indexer.visitChildren (top);
+        result.indexTime = timer.get();
+        Metrics::global().time ("index.visit", result.indexTime);
       }
     }
-
-    if (needsUpdate_.count(fileName) == 0) {
-      cout_ << "    " << fileName << std::endl;
-      needsUpdate_[fileName] = storage_.beginFile (fileName);
-      storage_.addInclude (fileName, sourceFile_);
+    catch (std::exception & e) {
+      result.error = e.what();
     }
 
-    if (needsUpdate_[fileName]) {
-      const LibClang::SourceLocation::Position end = cursor.end().expansionLocation();
-      storage_.addTag (usr, cursor.kindStr(), cursor.spelling(), fileName,
-                       begin.line, begin.column, begin.offset,
-                       end.line,   end.column,   end.offset,
-                       cursor.isDeclaration());
+    results.push (std::move (result));
+  }
+}
+
+
+// Pool of indexing workers, which are joined when the pool goes out of scope
+class IndexWorkers {
+public:
+  IndexWorkers (unsigned int size, PchCache & pch,
+                const Application::IndexArgs & args)
+  {
+    for (unsigned int i = 0 ; i < size ; ++i) {
+      threads_.push_back (std::thread (indexWorker,
+                                       std::ref (jobs), std::ref (results),
+                                       std::ref (pch), std::ref (claims_),
+                                       std::cref (args)));
     }
+  }
 
-    return CXChildVisit_Recurse;
+  ~IndexWorkers () {
+    jobs.close();
+    auto it  = threads_.begin();
+    auto end = threads_.end();
+    for ( ; it != end ; ++it) {
+      it->join();
+    }
   }
 
+  Queue<IndexJob>    jobs;
+  Queue<IndexResult> results;
+
 private:
-  const std::string              & sourceFile_;
-  const std::vector<std::string> & exclude_;
-  Storage                        & storage_;
-  std::map<std::string, bool>      needsUpdate_;
-  std::ostream                   & cout_;
+  HeaderClaims             claims_;
+  std::vector<std::thread> threads_;
 };
 
 
+// Write the results of a worker to the storage. Files whose tags were
+// written during this indexing run are added to updated.
+void storeIndexResult (const IndexResult & result,
+                       Storage & storage,
+                       std::set<std::string> & updated,
+                       std::ostream & cout)
+{
+  cout << result.fileName << ":" << std::endl
+       << "  parsing...\t" << result.parseTime << "s." << std::endl;
+
+  if (result.error != "") {
+    cout << "  error: " << result.error << std::endl;
+    return;
+  }
+
+  // Print clang diagnostics if requested
+  auto diag    = result.messages.begin();
+  auto diagEnd = result.messages.end();
+  for ( ; diag != diagEnd ; ++diag) {
+    cout << *diag << std::endl << std::endl;
+  }
+
+  cout << "  indexing..." << std::endl;
+  Timer timer;
+
+  const bool sourceNeedsUpdate = storage.beginFile (result.fileName);
+  storage.addInclude (result.fileName, result.fileName);
+  storage.setDiagnostics (result.fileName, result.diagnostics);
+
+  auto fileName = result.files.begin();
+  auto fileEnd  = result.files.end();
+  for ( ; fileName != fileEnd ; ++fileName) {
+    auto tags = result.tags.find (*fileName);
+
+    bool needsUpdate = sourceNeedsUpdate;
+    if (*fileName != result.fileName) {
+      cout << "    " << *fileName << std::endl;
+      storage.addInclude (*fileName, result.fileName);
+
+      // Visited by another translation unit with the same configuration
+      if (tags == result.tags.end()) {
+        Metrics::global().count ("index.headersSkipped");
+        continue;
+      }
+      needsUpdate = storage.beginFile (*fileName);
+    }
+
+    if (needsUpdate) {
+      storage.addTags (*fileName, tags->second.tags);
+      updated.insert (*fileName);
+    } else if (updated.count (*fileName) > 0) {
+      // Already indexed during this run, in another preprocessor configuration
+      storage.addMissingTags (*fileName, tags->second.tags);
+    }
+  }
+
+  Metrics::global().time ("index.write", timer.get());
+  cout << "  indexing...\t" << result.indexTime + timer.get() << "s." << std::endl;
+}
+
+
 
 void Application::index (IndexArgs & args, std::ostream & cout) {
   cout << std::endl
        << "-- Indexing project" << std::endl;
   storage_.setOption ("exclude", args.exclude);
+  storage_.setOption ("pch", args.pch ? "true" : "false");
+  storage_.setOption ("engine", args.engine);
+  storage_.setOption ("snapshot", args.snapshot ? "true" : "false");
+  if (!args.snapshot) {
+    storage_.removeSnapshot();
+  }
   storage_.cleanIndex();
 
-  updateIndex_ (args, cout);
+  // The whole index is rebuilt
+  args.files.clear();
+  updateIndex_ (args, Storage::Bulk, cout);
 }
 
 void Application::update (IndexArgs & args, std::ostream & cout) {
   cout << std::endl
        << "-- Updating index" << std::endl;
   args.exclude = storage_.getOption ("exclude", Storage::Vector());
+  try {
+    args.pch = storage_.getOption ("pch") == "true";
+  } catch (std::runtime_error &) {
+    // Index created before precompiled headers were supported
+    args.pch = false;
+  }
+  try {
+    args.engine = storage_.getOption ("engine");
+  } catch (std::runtime_error &) {
+    args.engine = "visitor";
+  }
+  try {
+    args.snapshot = storage_.getOption ("snapshot") == "true";
+  } catch (std::runtime_error &) {
+    args.snapshot = false;
+  }
 
-  updateIndex_ (args, cout);
+  updateIndex_ (args, Storage::Incremental, cout);
 }
 
-void Application::updateIndex_ (IndexArgs & args, std::ostream & cout) {
+void Application::updateIndex_ (IndexArgs & args, Storage::LoadProfile profile,
+                                std::ostream & cout) {
   Timer totalTimer;
 
+  const unsigned int jobs = args.jobs > 0 ? args.jobs : 1;
+  if (args.engine != "visitor" && args.engine != "indexer") {
+    cout << "Unknown indexing engine: " << args.engine << std::endl;
+    return;
+  }
+
   {
-    auto transaction(storage_.beginTransaction());
-    std::string fileName;
-    while ((fileName = storage_.nextFile()) != "") {
-      cout << fileName << ":" << std::endl
-           << "  parsing..." << std::flush;
-      Timer timer;
+    IndexWorkers workers (jobs, pch_, args);
+    Storage::Load load (storage_, profile);
+    std::set<std::string> updated;
 
-      LibClang::TranslationUnit tu = translationUnit_(fileName);
+    // The set of files to re-parse is computed once for the whole run
+    Timer scanTimer;
+    std::vector<std::string> sources = storage_.staleSources
+      (std::set<std::string> (args.files.begin(), args.files.end()));
+    if (remote_) {
+      // Only files modified in this checkout are indexed locally
+      sources = overlaySources_ (sources, cout);
+    }
+    Metrics::global().time ("index.scan", scanTimer.get());
+    auto source = sources.begin();
+    unsigned int pending = 0;
 
-      cout << "\t" << timer.get() << "s." << std::endl;
-      timer.reset();
+    while (true) {
+      // Keep all workers busy
+      while (pending < jobs && source != sources.end()) {
+        IndexJob job;
+        job.fileName = *source++;
+        storage_.getCompileCommand (job.fileName, job.directory, job.clArgs);
+        workers.jobs.push (std::move (job));
+        ++pending;
+      }
 
-      // Print clang diagnostics if requested
-      if (args.diagnostics) {
-        for (unsigned int N = tu.numDiagnostics(),
-               i = 0 ; i < N ; ++i) {
-          cout << tu.diagnostic (i) << std::endl << std::endl;
-        }
+      if (pending == 0) {
+        break;
       }
 
-      cout << "  indexing..." << std::endl;
-      LibClang::Cursor top (tu);
-      Indexer indexer (fileName, args.exclude, storage_, cout);
-      indexer.visitChildren (top);
-      cout << "  indexing...\t" << timer.get() << "s." << std::endl;
+      IndexResult result;
+      workers.results.pop (result);
+      --pending;
+      storeIndexResult (result, storage_, updated, cout);
+      load.step();
     }
+    load.finish();
+  }
+
+  if (args.snapshot) {
+    // Written once all tags are committed
+    Timer timer;
+    storage_.writeSnapshot();
+    Metrics::global().time ("index.snapshot", timer.get());
+    cout << "  snapshot...\t" << timer.get() << "s." << std::endl;
   }
 
   cout << totalTimer.get() << "s." << std::endl;
@@ -2,6 +2,10 @@
 #include "translationUnit.hxx"
 #include "sourceLocation.hxx"
 
+#include <atomic>
+#include <map>
+#include <mutex>
+
 namespace LibClang {
   Cursor::Cursor (CXCursor raw)
     : cursor_ (raw)
@@ -34,36 +38,73 @@ namespace LibClang {
     return clang_isDeclaration(clang_getCursorKind(raw()));
   }
 
+  bool Cursor::isTranslationUnit () const {
+    return clang_isTranslationUnit(clang_getCursorKind(raw()));
+  }
+
   Cursor Cursor::referenced () const {
     return clang_getCursorReferenced (raw());
   }
 
   std::string Cursor::kindStr () const {
-    CXCursorKind kind = clang_getCursorKind (raw());
-    CXString kindSpelling = clang_getCursorKindSpelling (kind);
-    std::string res = clang_getCString (kindSpelling);
-    clang_disposeString (kindSpelling);
-    return res;
+    return kindName();
+  }
+
+  // Kind strings are computed the first time each kind is seen. Kinds are
+  // small integers: they are looked up without locking in a table, which is
+  // only written to (under the mutex) for new kinds.
+  const std::string & Cursor::kindName () const {
+    static const unsigned int tableSize = 1024;
+    static std::atomic<const std::string *> table[tableSize];
+    static std::map<int, std::string> names;
+    static std::mutex mutex;
+
+    const CXCursorKind kind = clang_getCursorKind (raw());
+    if (kind >= 0 && kind < int (tableSize)) {
+      const std::string * name = table[kind].load (std::memory_order_acquire);
+      if (name) {
+        return *name;
+      }
+    }
+
+    std::lock_guard<std::mutex> lock (mutex);
+    auto it = names.find (kind);
+    if (it == names.end()) {
+      it = names.insert (std::make_pair (kind,
+                                         StringRef (clang_getCursorKindSpelling (kind))
+                                         .str())).first;
+      if (kind >= 0 && kind < int (tableSize)) {
+        table[kind].store (&it->second, std::memory_order_release);
+      }
+    }
+    return it->second;
   }
 
   std::string Cursor::spelling () const {
-    CXString cursorSpelling = clang_getCursorSpelling (raw());
-    std::string res = clang_getCString (cursorSpelling);
-    clang_disposeString (cursorSpelling);
-    return res;
+    return spellingRef().str();
+  }
+
+  StringRef Cursor::spellingRef () const {
+    return StringRef (clang_getCursorSpelling (raw()));
   }
 
   std::string Cursor::USR () const {
-    CXString cursorUSR = clang_getCursorUSR (raw());
-    std::string res = clang_getCString (cursorUSR);
-    clang_disposeString (cursorUSR);
-    return res;
+    return USRRef().str();
+  }
+
+  StringRef Cursor::USRRef () const {
+    return StringRef (clang_getCursorUSR (raw()));
   }
 
   SourceLocation Cursor::location () const {
     return clang_getCursorLocation (raw());
   }
 
+  SourceLocation Cursor::begin () const {
+    CXSourceRange extent = clang_getCursorExtent (raw());
+    return clang_getRangeStart (extent);
+  }
+
   SourceLocation Cursor::end () const {
     CXSourceRange extent = clang_getCursorExtent (raw());
     return clang_getRangeEnd (extent);
@@ -1,4 +1,5 @@
 #pragma once
+#include "stringRef.hxx"
 #include <clang-c/Index.h>
 #include <string>
 
@@ -73,6 +74,12 @@ namespace LibClang {
      */
     bool isDeclaration () const;
 
+    /** @brief Determine whether the cursor represents a translation unit
+     *
+     * @return true if the cursor represents a whole translation unit
+     */
+    bool isTranslationUnit () const;
+
     /** @brief Get the cursor referenced
      *
      * For cursors which represent references to other entities in the AST,
@@ -95,12 +102,28 @@ namespace LibClang {
      */
     std::string kindStr () const;
 
+    /** @brief Get the kind of cursor, without copying it
+     *
+     * Same as kindStr(), except that the kind string is computed only once
+     * for each kind of cursor, and shared by all cursors of that kind.
+     *
+     * @return a reference to the cursor kind string (valid for the whole
+     *         execution of the program)
+     */
+    const std::string & kindName () const;
+
     /** @brief Get the name of the entity referred to
      *
      * @return the name of the referenced entity, as a string
      */
     std::string spelling () const;
 
+    /** @brief Get the name of the entity referred to, without copying it
+     *
+     * @return the name of the referenced entity, as a StringRef
+     */
+    StringRef spellingRef () const;
+
     /** @brief Get the Unified Symbol Resolution for the entity referenced
      *
      * A Unified Symbol Resolution (USR) is a string that identifies a
@@ -113,6 +136,12 @@ namespace LibClang {
      */
     std::string USR () const;
 
+    /** @brief Get the Unified Symbol Resolution, without copying it
+     *
+     * @return the USR, as a StringRef
+     */
+    StringRef USRRef () const;
+
     /** @brief Get the source location associated to a cursor
      *
      * The location returned corresponds to the first character of the
@@ -123,6 +152,16 @@ namespace LibClang {
      */
     SourceLocation location () const;
 
+    /** @brief Get the beginning of the source range of a cursor
+     *
+     * Contrary to location(), which for declarations points to the declared
+     * name, the location returned corresponds to the first character of the
+     * whole entity (e.g. the return type of a function declaration).
+     *
+     * @return a SourceLocation to the beginning of the entity extent
+     */
+    SourceLocation begin () const;
+
     /** @brief Get the source location associated to a cursor
      *
      * The location returned corresponds to the last character of the referenced
@@ -145,6 +184,7 @@ namespace LibClang {
                                              CXClientData client_data);
     template <typename VISITOR>
     friend class Visitor;
+    friend class IndexAction;
   };
 
   /** @} */
@@ -23,6 +23,40 @@ namespace LibClang {
     return parse (args_c.size(), &(args_c[0]));
   }
 
+  TranslationUnit Index::parse (const std::vector<std::string> & args,
+                                unsigned int options) const {
+    std::vector<const char*> args_c;
+    auto i   = args.begin();
+    auto end = args.end();
+    for ( ; i != end ; ++i) {
+      args_c.push_back (i->c_str());
+    }
+
+    return clang_parseTranslationUnit (raw(), 0,
+                                       &(args_c[0]), args_c.size(),
+                                       0, 0, options);
+  }
+
+  TranslationUnit Index::parse (const std::vector<std::string> & args,
+                                UnsavedFiles & unsaved,
+                                unsigned int options) const {
+    std::vector<const char*> args_c;
+    auto i   = args.begin();
+    auto end = args.end();
+    for ( ; i != end ; ++i) {
+      args_c.push_back (i->c_str());
+    }
+
+    return clang_parseTranslationUnit (raw(), 0,
+                                       &(args_c[0]), args_c.size(),
+                                       unsaved.begin(), unsaved.size(),
+                                       options);
+  }
+
+  void Index::setGlobalOptions (unsigned int options) {
+    clang_CXIndex_setGlobalOptions (raw(), options);
+  }
+
   const CXIndex & Index::raw () const {
     return index_->index_;
   }
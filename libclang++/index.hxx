@@ -4,6 +4,8 @@
 #include <memory>
 #include <vector>
 #include <string>
+
+#include "unsavedFiles.hxx"
 namespace LibClang {
   /** @addtogroup libclang
       @{
@@ -46,8 +48,51 @@ namespace LibClang {
      */
     TranslationUnit parse (const std::vector<std::string> & args) const;
 
+    /** @brief Create a translation unit from a command-line
+     *
+     * Same as parse(const std::vector<std::string>&), but allows passing
+     * libclang's @c CXTranslationUnit_Flags. For example, translation units
+     * which will be repeatedly reparsed and used for code completion should be
+     * parsed with @c clang_defaultEditingTranslationUnitOptions(), so that
+     * libclang keeps a precompiled preamble for them.
+     *
+     * @param args     A vector of command-line arguments
+     * @param options  A bitwise OR of @c CXTranslationUnit_Flags
+     *
+     * @return The corresponfing TranslationUnit object
+     */
+    TranslationUnit parse (const std::vector<std::string> & args,
+                           unsigned int options) const;
+
+    /** @brief Create a translation unit from a command-line
+     *
+     * Same as parse(const std::vector<std::string>&, unsigned int), but
+     * source files contents are read from in-memory buffers when available.
+     *
+     * @param args     A vector of command-line arguments
+     * @param unsaved  A set of unsaved contents for the source files
+     * @param options  A bitwise OR of @c CXTranslationUnit_Flags
+     *
+     * @return The corresponfing TranslationUnit object
+     */
+    TranslationUnit parse (const std::vector<std::string> & args,
+                           UnsavedFiles & unsaved,
+                           unsigned int options) const;
+
+    /** @brief Set global options for the index
+     *
+     * For example, @c CXGlobalOpt_ThreadBackgroundPriorityForAll makes all
+     * threads created by libclang for this index run with a background
+     * priority, so that they don't slow down interactive requests.
+     *
+     * @param options  A bitwise OR of @c CXGlobalOptFlags
+     */
+    void setGlobalOptions (unsigned int options);
+
   private:
     const CXIndex & raw() const;
+    friend class IndexAction;
+
     struct Index_ {
       CXIndex index_;
       Index_ (CXIndex index) : index_ (index) {}
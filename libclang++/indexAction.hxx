@@ -0,0 +1,138 @@
+#pragma once
+
+#include "index.hxx"
+#include "translationUnit.hxx"
+#include "cursor.hxx"
+
+#include <clang-c/Index.h>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace LibClang {
+  /** @addtogroup libclang
+      @{
+  */
+
+  /** @brief Indexing session
+   *
+   * This class is a proxy for libclang's @c CXIndexAction type. Source files
+   * are indexed with @c clang_indexSourceFile, which directly reports
+   * inclusions, declarations and references, without the need to traverse the
+   * whole Abstract Syntax Tree (AST).
+   *
+   * All source files indexed with the same IndexAction share a session: when
+   * the @c CXIndexOpt_SkipParsedBodiesInSession option is given, function
+   * bodies in headers which were already indexed during the session are
+   * skipped.
+   *
+   * Results are reported to an indexer object, which should provide the
+   * following methods:
+   *
+   * @code
+   * class MyIndexer {
+   * public:
+   *   // Called for each file included by the translation unit
+   *   void includedFile (CXFile file);
+   *
+   *   // Called for each declaration of an entity, identified by its USR
+   *   void declaration (LibClang::Cursor cursor, const char * usr);
+   *
+   *   // Called for each reference to an entity, identified by its USR
+   *   void reference (LibClang::Cursor cursor, const char * usr);
+   * };
+   * @endcode
+   */
+  class IndexAction {
+  public:
+    /** @brief Constructor
+     *
+     * @param index  index in which translation units will be created
+     */
+    IndexAction (const Index & index)
+      : index_ (index),
+        action_ (new IndexAction_ (clang_IndexAction_create (index.raw())))
+    { }
+
+    /** @brief Index a source file
+     *
+     * @param indexer    object to which results are reported
+     * @param args       A vector of command-line arguments
+     * @param options    A bitwise OR of @c CXIndexOptFlags
+     * @param tuOptions  A bitwise OR of @c CXTranslationUnit_Flags
+     *
+     * @return The translation unit, which can be used for example to
+     *         retrieve diagnostics
+     */
+    template <typename INDEXER>
+    TranslationUnit indexSourceFile (INDEXER & indexer,
+                                     const std::vector<std::string> & args,
+                                     unsigned int options,
+                                     unsigned int tuOptions) {
+      std::vector<const char*> args_c;
+      auto i   = args.begin();
+      auto end = args.end();
+      for ( ; i != end ; ++i) {
+        args_c.push_back (i->c_str());
+      }
+
+      IndexerCallbacks callbacks = {};
+      callbacks.ppIncludedFile       = &IndexAction::includedFile_<INDEXER>;
+      callbacks.indexDeclaration     = &IndexAction::declaration_<INDEXER>;
+      callbacks.indexEntityReference = &IndexAction::reference_<INDEXER>;
+
+      CXTranslationUnit tu = NULL;
+      const int ret = clang_indexSourceFile (action_->action_, &indexer,
+                                             &callbacks, sizeof (callbacks),
+                                             options, 0,
+                                             &(args_c[0]), args_c.size(),
+                                             0, 0, &tu, tuOptions);
+      if (ret != 0 || tu == NULL) {
+        if (tu != NULL) {
+          clang_disposeTranslationUnit (tu);
+        }
+        throw std::runtime_error ("could not index the translation unit");
+      }
+
+      return tu;
+    }
+
+  private:
+    template <typename INDEXER>
+    static CXIdxClientFile includedFile_ (CXClientData clientData,
+                                          const CXIdxIncludedFileInfo * info) {
+      ((INDEXER*)clientData)->includedFile (info->file);
+      return NULL;
+    }
+
+    template <typename INDEXER>
+    static void declaration_ (CXClientData clientData,
+                              const CXIdxDeclInfo * info) {
+      if (info->entityInfo != NULL && info->entityInfo->USR != NULL) {
+        ((INDEXER*)clientData)->declaration (Cursor (info->cursor),
+                                             info->entityInfo->USR);
+      }
+    }
+
+    template <typename INDEXER>
+    static void reference_ (CXClientData clientData,
+                            const CXIdxEntityRefInfo * info) {
+      if (info->referencedEntity != NULL && info->referencedEntity->USR != NULL) {
+        ((INDEXER*)clientData)->reference (Cursor (info->cursor),
+                                           info->referencedEntity->USR);
+      }
+    }
+
+    struct IndexAction_ {
+      CXIndexAction action_;
+      IndexAction_ (CXIndexAction action) : action_ (action) {}
+      ~IndexAction_ () { clang_IndexAction_dispose (action_); }
+    };
+
+    Index                         index_;  // must outlive the action
+    std::shared_ptr<IndexAction_> action_;
+  };
+
+  /** @} */
+}
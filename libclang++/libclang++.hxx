@@ -5,6 +5,7 @@
 #include "cursor.hxx"
 #include "sourceLocation.hxx"
 #include "visitor.hxx"
+#include "indexAction.hxx"
 
 /** @addtogroup libclang LibClang++
     @brief C++ wrapper around libclang's C API.
@@ -17,22 +17,46 @@ namespace LibClang {
   }
 
   const SourceLocation::Position SourceLocation::expansionLocation () const {
+    return expansionLocation ("");
+  }
+
+  const SourceLocation::Position SourceLocation::expansionLocation (const std::string & directory) const {
     Position res;
+    res.file = fileName (expansionFile (res), directory);
+    return res;
+  }
+
+  CXFile SourceLocation::expansionFile (Position & position) const {
     CXFile file;
 
 #ifdef HAVE_CLANG_GETEXPANSIONLOCATION
     // This is the newer libclang API
-    clang_getExpansionLocation (raw(), &file, &res.line, &res.column, &res.offset);
+    clang_getExpansionLocation (raw(), &file, &position.line, &position.column, &position.offset);
 #else
     // Has been deprecated
-    clang_getInstantiationLocation (raw(), &file, &res.line, &res.column, &res.offset);
+    clang_getInstantiationLocation (raw(), &file, &position.line, &position.column, &position.offset);
 #endif
 
+    return file;
+  }
+
+  std::string SourceLocation::fileName (CXFile file, const std::string & directory) {
+    std::string res;
+
     CXString fileName = clang_getFileName (file);
     if (clang_getCString (fileName)) {
-      char * canonicalPath = realpath (clang_getCString (fileName), NULL);
-      res.file = canonicalPath;
-      free(canonicalPath);
+      std::string path = clang_getCString (fileName);
+      if (directory != "" && path != "" && path[0] != '/') {
+        path = directory + "/" + path;
+      }
+
+      char * canonicalPath = realpath (path.c_str(), NULL);
+      if (canonicalPath) {
+        res = canonicalPath;
+        free(canonicalPath);
+      } else {
+        res = path;
+      }
     }
     clang_disposeString (fileName);
     return res;
@@ -52,6 +52,43 @@ namespace LibClang {
      */
     const Position expansionLocation () const;
 
+    /** @brief Get the associated physical position
+     *
+     * Same as expansionLocation(), except that relative file names are
+     * resolved against @em directory instead of the current working
+     * directory. This is needed when the translation unit was parsed with a
+     * @c -working-directory argument.
+     *
+     * @param directory  directory in which the translation unit was compiled
+     *
+     * @return a Position structure
+     */
+    const Position expansionLocation (const std::string & directory) const;
+
+    /** @brief Get the associated physical position, without its file name
+     *
+     * Same as expansionLocation(), except that the @c file field of
+     * @em position is left untouched: the file is returned as a raw handle
+     * instead. Comparing handles of files from the same translation unit is
+     * much cheaper than retrieving and comparing their names.
+     *
+     * @param position  Position structure where the line, column and offset
+     *                  are stored
+     *
+     * @return the file of the location (@c NULL if there is none)
+     */
+    CXFile expansionFile (Position & position) const;
+
+    /** @brief Get the canonical name of a file
+     *
+     * @param file       file handle, as returned by expansionFile()
+     * @param directory  directory against which relative file names are
+     *                   resolved (the current working directory if empty)
+     *
+     * @return the canonical file name (or an empty string for @c NULL files)
+     */
+    static std::string fileName (CXFile file, const std::string & directory);
+
   private:
     SourceLocation (CXSourceLocation raw);
     CXSourceLocation location_;
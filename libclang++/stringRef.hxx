@@ -0,0 +1,76 @@
+#pragma once
+#include <clang-c/Index.h>
+#include <cstring>
+#include <string>
+
+namespace LibClang {
+  /** @addtogroup libclang
+      @{
+  */
+
+  /** @brief String returned by libclang
+   *
+   * This class takes ownership of a @c CXString, and disposes of it when
+   * destroyed. Contrary to methods returning a std::string, no copy of the
+   * characters is made: this is meant for hot loops, where strings are only
+   * looked at (e.g. to check whether they were already seen) before being
+   * copied if needed.
+   *
+   * StringRef objects can be moved, but not copied.
+   */
+  class StringRef {
+  public:
+    /** @brief Constructor
+     *
+     * @param raw  libclang string, whose ownership is taken
+     */
+    explicit StringRef (CXString raw)
+      : raw_ (raw),
+        data_ (clang_getCString (raw)),
+        size_ (data_ ? std::strlen (data_) : 0),
+        owned_ (true)
+    {
+      if (data_ == NULL) {
+        data_ = "";
+      }
+    }
+
+    StringRef (StringRef && other)
+      : raw_ (other.raw_),
+        data_ (other.data_),
+        size_ (other.size_),
+        owned_ (other.owned_)
+    {
+      other.owned_ = false;
+    }
+
+    ~StringRef () {
+      if (owned_) {
+        clang_disposeString (raw_);
+      }
+    }
+
+    /** @brief Null-terminated characters, valid as long as this object */
+    const char * c_str () const { return data_; }
+
+    /** @brief Number of characters */
+    size_t size () const { return size_; }
+
+    /** @brief Whether the string is empty */
+    bool empty () const { return size_ == 0; }
+
+    /** @brief Copy of the characters */
+    std::string str () const { return std::string (data_, size_); }
+
+  private:
+    StringRef (const StringRef &);
+    StringRef & operator= (const StringRef &);
+
+    CXString     raw_;
+    const char * data_;
+    size_t       size_;
+    bool         owned_;
+  };
+
+  /** @} */
+}
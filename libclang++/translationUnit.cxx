@@ -45,6 +45,73 @@ namespace LibClang {
     return res;
   }
 
+  CXDiagnosticSeverity TranslationUnit::diagnosticSeverity (unsigned int i) {
+    CXDiagnostic diagnostic = clang_getDiagnostic (raw(), i);
+    CXDiagnosticSeverity res = clang_getDiagnosticSeverity (diagnostic);
+    clang_disposeDiagnostic (diagnostic);
+    return res;
+  }
+
+  // Return the contents of a libclang string, and dispose of it
+  static std::string takeString (CXString string) {
+    const char * chars = clang_getCString (string);
+    std::string res = chars ? chars : "";
+    clang_disposeString (string);
+    return res;
+  }
+
+  TranslationUnit::Diagnostic TranslationUnit::diagnosticDetails (unsigned int i) {
+    CXDiagnostic diagnostic = clang_getDiagnostic (raw(), i);
+    Diagnostic res = {clang_getDiagnosticSeverity (diagnostic),
+                      clang_getDiagnosticLocation (diagnostic),
+                      takeString (clang_getDiagnosticSpelling (diagnostic)),
+                      takeString (clang_getDiagnosticOption (diagnostic, NULL)),
+                      std::vector<FixIt>()};
+
+    for (unsigned int N = clang_getDiagnosticNumFixIts (diagnostic),
+           j = 0 ; j < N ; ++j) {
+      CXSourceRange range;
+      std::string replacement
+        = takeString (clang_getDiagnosticFixIt (diagnostic, j, &range));
+      FixIt fixIt = {clang_getRangeStart (range), clang_getRangeEnd (range),
+                     replacement};
+      res.fixIts.push_back (fixIt);
+    }
+
+    clang_disposeDiagnostic (diagnostic);
+    return res;
+  }
+
+  void addIncludedFile (CXFile file,
+                        CXSourceLocation * stack, unsigned int stackSize, // unused
+                        CXClientData clientData)
+  {
+    std::vector<std::string> & files = *((std::vector<std::string>*)clientData);
+
+    CXString fileName = clang_getFileName (file);
+    if (clang_getCString (fileName)) {
+      files.push_back (clang_getCString (fileName));
+    }
+    clang_disposeString (fileName);
+  }
+
+  std::vector<std::string> TranslationUnit::includedFiles () const {
+    std::vector<std::string> files;
+    clang_getInclusions (raw(), addIncludedFile, &files);
+    return files;
+  }
+
+  bool TranslationUnit::isIncludeGuarded (const std::string & fileName) const {
+    CXFile file = clang_getFile (raw(), fileName.c_str());
+    return file != NULL && clang_isFileMultipleIncludeGuarded (raw(), file) != 0;
+  }
+
+  bool TranslationUnit::save (const std::string & fileName) const {
+    return clang_saveTranslationUnit (raw(), fileName.c_str(),
+                                      clang_defaultSaveOptions (raw()))
+      == CXSaveError_None;
+  }
+
   unsigned long TranslationUnit::memoryUsage () const {
     CXTUResourceUsage usage = clang_getCXTUResourceUsage (raw());
     unsigned long total = 0;
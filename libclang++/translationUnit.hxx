@@ -2,8 +2,11 @@
 
 #include <clang-c/Index.h>
 #include <memory>
+#include <string>
+#include <vector>
 
 #include "unsavedFiles.hxx"
+#include "sourceLocation.hxx"
 
 namespace LibClang {
   /** @addtogroup libclang
@@ -12,7 +15,6 @@ namespace LibClang {
 
   // Forward declarations
   class Index;
-  class SourceLocation;
   class Cursor;
 
   /** @brief Translation unit
@@ -85,6 +87,76 @@ namespace LibClang {
      */
     std::string diagnostic (unsigned int i);
 
+    /** @brief Get the severity of the i-th diagnostic message
+     *
+     * @param i  index of the diagnostic message (must be less than numDiagnostics())
+     *
+     * @return The severity of the message, as a @c CXDiagnosticSeverity
+     */
+    CXDiagnosticSeverity diagnosticSeverity (unsigned int i);
+
+    /** @brief Hint to fix the code, suggested by a diagnostic
+     *
+     * The source code in [begin, end) should be replaced by @em replacement.
+     */
+    struct FixIt {
+      SourceLocation begin;        /**< @brief beginning of the replaced code */
+      SourceLocation end;          /**< @brief end of the replaced code */
+      std::string    replacement;  /**< @brief replacement code */
+    };
+
+    /** @brief Diagnostic message, along with its location and fix-it hints
+     */
+    struct Diagnostic {
+      CXDiagnosticSeverity severity;  /**< @brief severity of the message */
+      SourceLocation       location;  /**< @brief location of the message */
+      std::string          message;   /**< @brief text, without location nor severity */
+      std::string          option;    /**< @brief option controlling it (e.g. @c -Wunused) */
+      std::vector<FixIt>   fixIts;    /**< @brief suggested fixes */
+    };
+
+    /** @brief Get the i-th diagnostic of the translation unit, in details
+     *
+     * Contrary to diagnostic(), the message is not formatted: its location,
+     * severity and fix-it hints are returned separately.
+     *
+     * @param i  index of the diagnostic message (must be less than numDiagnostics())
+     *
+     * @return A Diagnostic structure
+     */
+    Diagnostic diagnosticDetails (unsigned int i);
+
+    /** @brief Get the list of files included by the translation unit
+     *
+     * The list contains the main source file, and all files it directly or
+     * indirectly includes. File names are reported as seen by the compiler,
+     * and might thus be relative to the compilation directory.
+     *
+     * @return A vector of file names
+     */
+    std::vector<std::string> includedFiles () const;
+
+    /** @brief Determine whether a file is protected against multiple inclusion
+     *
+     * @param fileName  name of a file included by the translation unit, as
+     *                  returned by includedFiles()
+     *
+     * @return true if the file has include guards (or @c \#pragma once), so
+     *         that including it again has no effect
+     */
+    bool isIncludeGuarded (const std::string & fileName) const;
+
+    /** @brief Save the translation unit to an AST file
+     *
+     * The resulting file can be used as a precompiled header, for example by
+     * passing it to the @c -include-pch compiler option.
+     *
+     * @param fileName  path of the file to write
+     *
+     * @return true if the translation unit was successfully saved
+     */
+    bool save (const std::string & fileName) const;
+
     /** @brief Get the memory usage of the translation unit.
      *
      * @return The memory usage (in bytes) of the translation unit.
@@ -106,6 +178,7 @@ namespace LibClang {
 
     // Friend declaration
     friend class Index;
+    friend class IndexAction;
     friend class Cursor;
   };
 
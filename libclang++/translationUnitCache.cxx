@@ -1,42 +1,129 @@
 #include "translationUnitCache.hxx"
 
+#include <algorithm>
+
 namespace LibClang {
   TranslationUnitCache::TranslationUnitCache (unsigned long memoryLimit)
-    : memoryLimit_(memoryLimit),
-      memoryUsage_(0)
+    : memoryMax_(memoryLimit),
+      memoryLimit_(memoryLimit),
+      memoryUsage_(0),
+      inflation_(0),
+      hits_(0),
+      misses_(0),
+      evictions_(0)
   {
   }
 
+  void TranslationUnitCache::setMemoryLimit (unsigned long memoryLimit) {
+    memoryLimit_ = std::min(memoryLimit, memoryMax_);
+  }
+
+  void TranslationUnitCache::shrink () {
+    evict_("");
+  }
+
+  unsigned long TranslationUnitCache::memoryUsage () const {
+    return memoryUsage_;
+  }
+
   bool TranslationUnitCache::contains (const std::string & fileName) const {
     return tunits_.find(fileName) != tunits_.end();
   }
 
   void TranslationUnitCache::insert (const std::string & fileName,
-      const TranslationUnit & tu) {
+      const TranslationUnit & tu, double cost) {
+    ++misses_;
 
-    memoryUsage_ += tu.memoryUsage();
-
-    // Clear out recently-used files until we have enough space for the new
-    // translation unit.
-    while (memoryUsage_ > memoryLimit_ && !lruFiles_.empty()) {
-      auto it = tunits_.find(lruFiles_.front());
-      memoryUsage_ -= it->second.first.memoryUsage();
+    auto it = tunits_.find(fileName);
+    if (it != tunits_.end()) {
+      memoryUsage_ -= it->second.memoryUsage;
       tunits_.erase(it);
-      lruFiles_.pop_front();
     }
 
-    // Add in our new translation unit. Even if the memory usage of this single
-    // translation unit exceeds the memory limit, we will always insert it.
-    auto it = lruFiles_.emplace(lruFiles_.end(), fileName);
-    tunits_.emplace(fileName, std::make_pair(tu, it));
+    Entry entry (tu);
+    entry.memoryUsage = tu.memoryUsage();
+    entry.cost        = cost;
+    entry.pinned      = false;
+    entry.value       = value_(entry);
+    tunits_.insert(std::make_pair(fileName, entry));
+    memoryUsage_ += entry.memoryUsage;
+
+    // Even if the memory usage of this single translation unit exceeds the
+    // memory limit, we will always insert it.
+    evict_(fileName);
+  }
+
+  TranslationUnit * TranslationUnitCache::find (const std::string & fileName) {
+    if (!contains(fileName)) {
+      return NULL;
+    }
+
+    ++hits_;
+    return &get(fileName);
   }
 
   TranslationUnit & TranslationUnitCache::get (const std::string & fileName) {
-    auto & entry = tunits_.find(fileName)->second;
+    Entry & entry = tunits_.find(fileName)->second;
+    entry.value = value_(entry);
+    return entry.tu;
+  }
 
-    // Move this file to the end of the least-recently-used list.
-    lruFiles_.splice(lruFiles_.end(), lruFiles_, entry.second);
+  void TranslationUnitCache::reparsed (const std::string & fileName, double cost) {
+    Entry & entry = tunits_.find(fileName)->second;
 
-    return entry.first;
+    memoryUsage_ -= entry.memoryUsage;
+    entry.memoryUsage = entry.tu.memoryUsage();
+    memoryUsage_ += entry.memoryUsage;
+
+    entry.cost  = std::max(entry.cost, cost);
+    entry.value = value_(entry);
+    evict_(fileName);
+  }
+
+  void TranslationUnitCache::pin (const std::string & fileName, bool pinned) {
+    auto it = tunits_.find(fileName);
+    if (it != tunits_.end()) {
+      it->second.pinned = pinned;
+    }
+  }
+
+  TranslationUnitCache::Stats TranslationUnitCache::stats () const {
+    Stats s;
+    s.hits        = hits_;
+    s.misses      = misses_;
+    s.evictions   = evictions_;
+    s.size        = tunits_.size();
+    s.memoryUsage = memoryUsage_;
+    return s;
+  }
+
+  double TranslationUnitCache::value_ (const Entry & entry) const {
+    // Cost per MB, so that values are not too small
+    const double size = std::max(entry.memoryUsage, 1UL) / (1024. * 1024.);
+    return inflation_ + entry.cost / size;
+  }
+
+  void TranslationUnitCache::evict_ (const std::string & keep) {
+    // Few translation units fit in memory: a linear search is cheap enough
+    while (memoryUsage_ > memoryLimit_) {
+      auto victim = tunits_.end();
+      for (auto it = tunits_.begin() ; it != tunits_.end() ; ++it) {
+        if (it->second.pinned || it->first == keep) {
+          continue;
+        }
+        if (victim == tunits_.end() || it->second.value < victim->second.value) {
+          victim = it;
+        }
+      }
+
+      if (victim == tunits_.end()) {
+        break;
+      }
+
+      inflation_ = victim->second.value;
+      memoryUsage_ -= victim->second.memoryUsage;
+      tunits_.erase(victim);
+      ++evictions_;
+    }
   }
 }
@@ -1,8 +1,9 @@
 #pragma once
 
 #include "translationUnit.hxx"
-#include <list>
+#include <atomic>
 #include <map>
+#include <string>
 
 namespace LibClang {
   /** @addtogroup libclang
@@ -12,17 +13,58 @@ namespace LibClang {
   /** @brief Provides caching of @c TranslationUnit instances.
    *
    * This class provides a memory-limited cache of translation units. When the
-   * memory limit is exceeded, the least recently-used translation units are
-   * disposed.
+   * memory limit is exceeded, translation units are disposed according to the
+   * GreedyDual-Size policy: each translation unit is given a value equal to
+   * the cost of parsing it divided by its size, plus an "inflation" value
+   * which is raised to the value of each evicted translation unit. Units which
+   * are expensive to parse thus survive longer than cheap ones of the same
+   * size, while units which have not been used for a long time eventually get
+   * evicted.
+   *
+   * Translation units can be pinned, in which case they are never evicted.
+   *
+   * The memory limit can be lowered from other threads (e.g. by a memory
+   * governor), in which case translation units are disposed by the next call
+   * to insert(), reparsed() or shrink() in the thread owning the cache.
    */
   class TranslationUnitCache {
   public:
+    /** @brief Cache statistics */
+    struct Stats {
+      unsigned long hits;        ///< number of successful calls to find()
+      unsigned long misses;      ///< number of insertions
+      unsigned long evictions;   ///< number of disposed translation units
+      unsigned long size;        ///< number of cached translation units
+      unsigned long memoryUsage; ///< memory used by cached units (in bytes)
+    };
+
     /** @brief Constructor
      *
      * @param memoryLimit The maximum memory usage (in bytes) of the cache.
      */
     TranslationUnitCache (unsigned long memoryLimit);
 
+    /** @brief Change the memory limit of the cache
+     *
+     * This method can be called from any thread. The limit is capped by the
+     * maximum given to the constructor.
+     *
+     * @param memoryLimit  new memory limit (in bytes)
+     */
+    void setMemoryLimit (unsigned long memoryLimit);
+
+    /** @brief Dispose translation units until the memory limit is satisfied
+     */
+    void shrink ();
+
+    /** @brief Get the memory used by cached translation units
+     *
+     * This method can be called from any thread.
+     *
+     * @return the memory usage (in bytes)
+     */
+    unsigned long memoryUsage () const;
+
     /** @brief Determine whether a cache entry exists.
      *
      * @return true if the cache contains a translation unit corresponding to
@@ -34,22 +76,81 @@ namespace LibClang {
      *
      * Inserts the translation unit into the cache, and possibly disposes older translation
      * units in order to satisfy the memory usage limit.
+     *
+     * @param fileName  source file name
+     * @param tu        translation unit
+     * @param cost      cost of parsing the translation unit (e.g. in seconds)
      */
-    void insert (const std::string & fileName, const TranslationUnit & tu);
+    void insert (const std::string & fileName, const TranslationUnit & tu,
+                 double cost = 1);
+
+    /** @brief Look up a translation unit in the cache.
+     *
+     * Successful lookups are counted as cache hits.
+     *
+     * @return the translation unit corresponding to the given filename, or
+     * NULL if there is none.
+     */
+    TranslationUnit * find (const std::string & fileName);
 
     /** @brief Retrieve a translation unit from the cache.
      *
      * Use @m contains() to first determine whether the cache entry exists.
+     * Contrary to find(), this does not count as a cache hit (e.g. right after
+     * an insertion).
      */
     TranslationUnit & get (const std::string & fileName);
 
+    /** @brief Update a cache entry after its translation unit was reparsed
+     *
+     * The memory usage of the translation unit is measured again, and other
+     * translation units may be disposed to satisfy the memory usage limit.
+     *
+     * @param fileName  source file name
+     * @param cost      cost of reparsing the translation unit
+     */
+    void reparsed (const std::string & fileName, double cost);
+
+    /** @brief Pin or unpin a translation unit
+     *
+     * Pinned translation units are never disposed to make room for others.
+     *
+     * @param fileName  source file name (must be in the cache)
+     * @param pinned    whether the translation unit should be pinned
+     */
+    void pin (const std::string & fileName, bool pinned = true);
+
+    /** @brief Get cache statistics */
+    Stats stats () const;
+
   private:
-    const unsigned long memoryLimit_;
-    unsigned long memoryUsage_;
+    struct Entry {
+      Entry (const TranslationUnit & tu) : tu (tu) {}
+
+      TranslationUnit tu;
+      unsigned long   memoryUsage;
+      double          cost;
+      double          value;      // GreedyDual-Size value
+      bool            pinned;
+    };
+    typedef std::map<std::string, Entry> EntryMap;
+
+    // Value of an entry which has just been used
+    double value_ (const Entry & entry) const;
+
+    // Dispose entries until the memory usage limit is satisfied (or nothing
+    // but the given entry and pinned entries remain)
+    void evict_ (const std::string & keep);
+
+    const unsigned long        memoryMax_;
+    std::atomic<unsigned long> memoryLimit_;
+    std::atomic<unsigned long> memoryUsage_;
+    double inflation_;
+    EntryMap tunits_;
 
-    typedef std::list<std::string> LRUFileList;
-    LRUFileList lruFiles_;
-    std::map<std::string, std::pair<TranslationUnit, LRUFileList::iterator>> tunits_;
+    unsigned long hits_;
+    unsigned long misses_;
+    unsigned long evictions_;
   };
 
   /** @} */
@@ -1,7 +1,9 @@
 #pragma once
 
+#include <clang-c/Index.h>
 #include <sstream>
 #include <fstream>
+#include <string>
 #include <vector>
 
 namespace LibClang {
@@ -35,14 +37,21 @@ namespace LibClang {
 
       delete[] buf;
 
-      sourcePath_.push_back (sourcePath);
-      contents_.push_back (contents.str());
-      unsavedFile_.resize (sourcePath_.size());
+      addContents (sourcePath, contents.str());
+    }
 
-      CXUnsavedFile & unsavedFile = unsavedFile_.back();
-      unsavedFile.Filename = sourcePath_.back().c_str();
-      unsavedFile.Contents = contents_.back().c_str();
-      unsavedFile.Length   = contents_.back().size();
+    /** @brief Store updated content for a source file
+     *
+     * Add an unsaved file to the list, associating it with updated contents
+     * held in memory (for example, sent by an editor over the network).
+     *
+     * @param sourcePath  path to the source file
+     * @param contents    up-to-date contents of the source file
+     */
+    void addContents (const std::string & sourcePath, const std::string & contents)
+    {
+      sourcePath_.push_back (sourcePath);
+      contents_.push_back (contents);
     }
 
     /** @brief Get the size of the unsaved files set
@@ -55,10 +64,22 @@ namespace LibClang {
 
     /** @brief Get a C-like array of unsaved files
      *
-     * @return C pointer to the first unsaved file
+     * The array remains valid until another file is added.
+     *
+     * @return C pointer to the first unsaved file (or @c NULL if the set is
+     *         empty)
      */
     CXUnsavedFile * begin () {
-      return &(unsavedFile_[0]);
+      // Strings may have moved when files were added: build the array now
+      unsavedFile_.resize (size());
+      for (unsigned int i = 0 ; i < size() ; ++i) {
+        CXUnsavedFile & unsavedFile = unsavedFile_[i];
+        unsavedFile.Filename = sourcePath_[i].c_str();
+        unsavedFile.Contents = contents_[i].c_str();
+        unsavedFile.Length   = contents_[i].size();
+      }
+
+      return unsavedFile_.empty() ? NULL : &(unsavedFile_[0]);
     }
 
   private:
@@ -1,8 +1,17 @@
 #include "application.hxx"
+#include "server.hxx"
+#include "sourceFile.hxx"
 #include "util/util.hxx"
+#include "util/metrics.hxx"
+#include "util/memoryGovernor.hxx"
+#include "util/fileWatcher.hxx"
 #include "request/request.hxx"
 #include "getopt++/getopt.hxx"
-#include <boost/asio.hpp>
+#include <unistd.h>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <thread>
 
 class CompilationDatabaseCommand : public Request::CommandParser {
 public:
@@ -45,11 +54,22 @@ public:
     using Request::key;
     add (key ("diagnostics", args_.diagnostics)
          ->metavar ("true|false")
-         ->description ("Print compilation diagnostics"));
+         ->description ("Print compilation diagnostics (they are stored anyway)"));
+    add (key ("jobs", args_.jobs)
+         ->metavar ("N")
+         ->description ("Number of translation units parsed in parallel"));
+    add (key ("files", args_.files)
+         ->metavar ("PATH")
+         ->description ("Only check these files for changes"));
   }
 
   void defaults () {
-    args_.diagnostics = true;
+    args_.diagnostics = false;
+    args_.jobs = 1;
+    args_.files.clear();
+    args_.pch = false;
+    args_.engine = "visitor";
+    args_.snapshot = false;
   }
 
   void run (std::ostream & cout) {
@@ -75,6 +95,15 @@ public:
     add (key ("exclude", args_.exclude)
          ->metavar ("PATH")
          ->description ("Exclude path"));
+    add (key ("pch", args_.pch)
+         ->metavar ("true|false")
+         ->description ("Precompile the #include prefix shared by source files"));
+    add (key ("engine", args_.engine)
+         ->metavar ("visitor|indexer")
+         ->description ("Traverse whole ASTs, or use libclang's indexing API"));
+    add (key ("snapshot", args_.snapshot)
+         ->metavar ("true|false")
+         ->description ("Write a memory-mapped snapshot of the index for queries"));
   }
 
   void defaults () {
@@ -113,14 +142,18 @@ public:
     add (key ("fromIndex", args_.fromIndex)
          ->metavar ("true|false")
          ->description ("Search in the index (faster but potentially out-of-date)"));
+    add (key ("contents", args_.contents)
+         ->metavar ("SOURCE")
+         ->description ("Up-to-date contents of the source file, if not saved"));
   }
 
   void defaults () {
     args_.fileName = "";
     args_.offset = 0;
     args_.mostSpecific = false;
-    args_.diagnostics = true;
+    args_.diagnostics = false;
     args_.fromIndex = true;
+    args_.contents = "";
   }
 
   void run (std::ostream & cout) {
@@ -146,10 +179,22 @@ public:
     add (key ("usr", args_.usr)
          ->metavar ("USR")
          ->description ("Unified Symbol Resolution for the symbol"));
+    add (key ("filePrefix", args_.filePrefix)
+         ->metavar ("PATH")
+         ->description ("Only output references in files starting with PATH"));
+    add (key ("offset", args_.offset)
+         ->metavar ("N")
+         ->description ("Skip the first N references"));
+    add (key ("limit", args_.limit)
+         ->metavar ("N")
+         ->description ("Output at most N references (0 for no limit)"));
   }
 
   void defaults () {
     args_.usr = "c:@F@main";
+    args_.filePrefix = "";
+    args_.offset = 0;
+    args_.limit = 0;
   }
 
   void run (std::ostream & cout) {
@@ -162,6 +207,43 @@ private:
 };
 
 
+class SearchCommand : public Request::CommandParser {
+public:
+  SearchCommand (const std::string & name, Application & application)
+    : Request::CommandParser (name, "Find declarations by name"),
+      application_ (application)
+  {
+    prompt_ = "search> ";
+    defaults();
+
+    using Request::key;
+    add (key ("pattern", args_.pattern)
+         ->metavar ("GLOB")
+         ->description ("Symbol name pattern (names containing it if it has no wildcard)"));
+    add (key ("kind", args_.kinds)
+         ->metavar ("KIND")
+         ->description ("Only output declarations of this kind (e.g. ClassDecl)"));
+    add (key ("limit", args_.limit)
+         ->metavar ("N")
+         ->description ("Output at most N declarations (0 for no limit)"));
+  }
+
+  void defaults () {
+    args_.pattern = "";
+    args_.kinds.clear();
+    args_.limit = 100;
+  }
+
+  void run (std::ostream & cout) {
+    application_.search (args_, cout);
+  }
+
+private:
+  Application & application_;
+  Application::SearchArgs args_;
+};
+
+
 class CompleteCommand : public Request::CommandParser {
 public:
   CompleteCommand (const std::string & name, Application & application)
@@ -181,12 +263,24 @@ public:
     add (key ("column", args_.column)
          ->metavar ("COLUMN_NO")
          ->description ("Column number (counting from 0)"));
+    add (key ("contents", args_.contents)
+         ->metavar ("SOURCE")
+         ->description ("Up-to-date contents of the source file, if not saved"));
+    add (key ("prefix", args_.prefix)
+         ->metavar ("PREFIX")
+         ->description ("Beginning of the token to complete, just before the column"));
+    add (key ("max", args_.max)
+         ->metavar ("N")
+         ->description ("Maximum number of results (0 for no limit)"));
   }
 
   void defaults () {
     args_.fileName = "";
     args_.line = 0;
     args_.column = 0;
+    args_.contents = "";
+    args_.prefix = "";
+    args_.max = 0;
   }
 
   void run (std::ostream & cout) {
@@ -198,20 +292,466 @@ private:
   Application::CompleteArgs args_;
 };
 
+
+class DiagnosticsCommand : public Request::CommandParser {
+public:
+  DiagnosticsCommand (const std::string & name, Application & application)
+    : Request::CommandParser (name, "Get compilation diagnostics"),
+      application_ (application)
+  {
+    prompt_ = "diagnostics> ";
+    defaults();
+
+    using Request::key;
+    add (key ("file", args_.fileName)
+         ->metavar ("FILENAME")
+         ->description ("Only output diagnostics located in this file"));
+    add (key ("severity", args_.severity)
+         ->metavar ("note|warning|error|fatal")
+         ->description ("Only output diagnostics at least this severe"));
+  }
+
+  void defaults () {
+    args_.fileName = "";
+    args_.severity = "warning";
+  }
+
+  void run (std::ostream & cout) {
+    application_.diagnostics (args_, cout);
+  }
+
+private:
+  Application & application_;
+  Application::DiagnosticsArgs args_;
+};
+
+
+class PinCommand : public Request::CommandParser {
+public:
+  PinCommand (const std::string & name, Application & application)
+    : Request::CommandParser (name, "Keep the translation unit of a source file in the cache"),
+      application_ (application)
+  {
+    prompt_ = "pin> ";
+    defaults();
+
+    using Request::key;
+    add (key ("file", args_.fileName)
+         ->metavar ("FILENAME")
+         ->description ("Source file name"));
+    add (key ("pinned", args_.pinned)
+         ->metavar ("true|false")
+         ->description ("Pin the translation unit (or unpin it if false)"));
+  }
+
+  void defaults () {
+    args_.fileName = "";
+    args_.pinned = true;
+  }
+
+  void run (std::ostream & cout) {
+    application_.pin (args_, cout);
+  }
+
+private:
+  Application & application_;
+  Application::PinArgs args_;
+};
+
 struct ExitCommand : public Request::CommandParser {
-  ExitCommand (const std::string & name)
-    : Request::CommandParser (name, "Shutdown server")
+  ExitCommand (const std::string & name, std::function<void ()> shutdown)
+    : Request::CommandParser (name, "Shutdown server"),
+      shutdown_ (shutdown)
   {
     prompt_ = "exit> ";
   }
 
   void run (std::ostream & cout) {
     cout << "Exiting..." << std::endl;
-    throw std::runtime_error ("shutdown requested");
+    shutdown_();
+  }
+
+private:
+  std::function<void ()> shutdown_;
+};
+
+
+class ConfigCommand : public Request::CommandParser {
+public:
+  ConfigCommand (const std::string & name, Application & application)
+    : Request::CommandParser (name, "Display or change SQLite tunables"),
+      application_ (application)
+  {
+    prompt_ = "config> ";
+    defaults();
+
+    using Request::key;
+    add (key ("name", args_.name)
+         ->metavar ("PRAGMA")
+         ->description ("Tunable name (all tunables are displayed if empty)"));
+    add (key ("value", args_.value)
+         ->metavar ("VALUE")
+         ->description ("New value, stored in the index database"));
+  }
+
+  void defaults () {
+    args_.name = "";
+    args_.value = "";
+  }
+
+  void run (std::ostream & cout) {
+    application_.config (args_, cout);
+  }
+
+private:
+  Application & application_;
+  Application::ConfigArgs args_;
+};
+
+
+class ShardCommand : public Request::CommandParser {
+public:
+  ShardCommand (const std::string & name, Application & application)
+    : Request::CommandParser (name, "List, attach or detach index shards"),
+      application_ (application)
+  {
+    prompt_ = "shard> ";
+    defaults();
+
+    using Request::key;
+    add (key ("action", args_.action)
+         ->metavar ("list|add|remove")
+         ->description ("Action to perform"));
+    add (key ("path", args_.path)
+         ->metavar ("PATH")
+         ->description ("Shard database, or directory containing it"));
+    add (key ("prebuilt", args_.prebuilt)
+         ->metavar ("true|false")
+         ->description ("Whether the shard never changes while it is attached"));
+  }
+
+  void defaults () {
+    args_.action = "list";
+    args_.path = "";
+    args_.prebuilt = false;
+  }
+
+  void run (std::ostream & cout) {
+    application_.shard (args_, cout);
+  }
+
+private:
+  Application & application_;
+  Application::ShardArgs args_;
+};
+
+
+class FilesCommand : public Request::CommandParser {
+public:
+  FilesCommand (const std::string & name, Application & application)
+    : Request::CommandParser (name, "Describe the files of the index (for remote clients)"),
+      application_ (application)
+  {
+    prompt_ = "files> ";
+    defaults();
+
+    using Request::key;
+    add (key ("hashes", args_.hashes)
+         ->metavar ("true|false")
+         ->description ("List indexed files along with their content hash"));
   }
+
+  void defaults () {
+    args_.hashes = true;
+  }
+
+  void run (std::ostream & cout) {
+    application_.files (args_, cout);
+  }
+
+private:
+  Application & application_;
+  Application::FilesArgs args_;
+};
+
+
+class StatsCommand : public Request::CommandParser {
+public:
+  StatsCommand (const std::string & name, Application & application)
+    : Request::CommandParser (name, "Display server metrics"),
+      application_ (application)
+  {
+    prompt_ = "stats> ";
+    defaults();
+
+    using Request::key;
+    add (key ("reset", args_.reset)
+         ->metavar ("true|false")
+         ->description ("Clear timing histograms after displaying them"));
+  }
+
+  void defaults () {
+    args_.reset = false;
+  }
+
+  void run (std::ostream & cout) {
+    application_.stats (args_, cout);
+  }
+
+private:
+  Application & application_;
+  Application::StatsArgs args_;
 };
 
 
+// Everything needed to handle requests in one of the server threads
+struct RequestHandler {
+  RequestHandler (Storage::Mode mode, const Storage::Pragmas & pragmas,
+                  unsigned long cacheLimit, RemoteIndex * remote,
+                  std::function<void ()> shutdown)
+    : storage (mode, pragmas),
+      app (storage, cacheLimit, remote),
+      parser ("Clang-tags server\n")
+  {
+    storage.useSnapshot();
+    parser
+      .add (new CompilationDatabaseCommand ("load", app))
+      .add (new IndexCommand ("index", app))
+      .add (new UpdateCommand ("update", app))
+      .add (new FindCommand ("find", app))
+      .add (new GrepCommand ("grep", app))
+      .add (new SearchCommand ("search", app))
+      .add (new CompleteCommand ("complete", app))
+      .add (new DiagnosticsCommand ("diagnostics", app))
+      .add (new PinCommand ("pin", app))
+      .add (new ConfigCommand ("config", app))
+      .add (new ShardCommand ("shard", app))
+      .add (new FilesCommand ("files", app))
+      .add (new StatsCommand ("stats", app))
+      .add (new ExitCommand ("exit", shutdown))
+      .prompt ("clang-dde> ");
+  }
+
+  Storage         storage;
+  Application     app;
+  Request::Parser parser;
+};
+
+
+// Periodically write metrics to the server log
+class StatsDumper {
+public:
+  StatsDumper (unsigned int interval)
+    : stop_ (false)
+  {
+    if (interval == 0) {
+      return;
+    }
+
+    thread_ = std::thread ([this, interval] () {
+        Json::FastWriter writer;
+        while (true) {
+          for (unsigned int i = 0 ; i < interval ; ++i) {
+            if (stop_) {
+              return;
+            }
+            sleep (1);
+          }
+          std::cerr << "stats: " << writer.write (Application::statsJson());
+        }
+      });
+  }
+
+  ~StatsDumper () {
+    stop_ = true;
+    if (thread_.joinable()) {
+      thread_.join();
+    }
+  }
+
+private:
+  std::atomic<bool> stop_;
+  std::thread       thread_;
+};
+
+
+// Periodically divide the memory budget among caches, according to the
+// resident set size of the server and the memory pressure of its cgroup.
+//
+// Under pressure, memory freed by the shrunk caches is given back to the
+// system.
+class MemoryMonitor {
+public:
+  MemoryMonitor (unsigned int interval)
+    : stop_ (false)
+  {
+    thread_ = std::thread ([this, interval] () {
+        MemoryGovernor & governor = MemoryGovernor::global();
+        while (true) {
+          for (unsigned int i = 0 ; i < interval ; ++i) {
+            if (stop_) {
+              return;
+            }
+            sleep (1);
+          }
+
+          // More than 10% of the time stalled waiting for memory
+          const bool pressure = MemoryGovernor::memoryPressure() > 10;
+          governor.rebalance (MemoryGovernor::residentSetSize(), pressure);
+          if (pressure) {
+            MemoryGovernor::releaseFreeMemory();
+            Metrics::global().count ("memory.pressure");
+          }
+        }
+      });
+  }
+
+  ~MemoryMonitor () {
+    stop_ = true;
+    if (thread_.joinable()) {
+      thread_.join();
+    }
+  }
+
+private:
+  std::atomic<bool> stop_;
+  std::thread       thread_;
+};
+
+
+// Watch the files of the index, and update it in the background when they
+// change.
+//
+// Changes are debounced, so that bursts (e.g. a version control checkout)
+// trigger a single update. Only one update is scheduled at a time; changes
+// happening in the meantime are accumulated for the next one. The update
+// request itself finds the translation units affected by the changed files
+// through the include graph.
+class IndexWatcher {
+public:
+  IndexWatcher (Server & server, const Storage::Pragmas & pragmas,
+                unsigned int jobs)
+    : server_ (server),
+      pragmas_ (pragmas),
+      jobs_ (jobs),
+      stop_ (false),
+      updating_ (new std::atomic<bool> (false))
+  {
+    thread_ = std::thread (&IndexWatcher::run_, this);
+  }
+
+  ~IndexWatcher () {
+    stop_ = true;
+    thread_.join();
+  }
+
+private:
+  void run_ () {
+    try {
+      Storage storage (Storage::ReadOnly, pragmas_);
+      FileWatcher watcher;
+      std::set<std::string> changed;
+      Timer sinceRefresh;
+      bool refresh = true;
+      bool posted = false;
+
+      while (!stop_) {
+        // New files get in the index as it is updated
+        if (posted && !*updating_) {
+          refresh = true;
+          posted = false;
+        }
+        if (refresh || sinceRefresh.get() > 30) {
+          watcher.watch (storage.fileNames());
+          sinceRefresh.reset();
+          refresh = false;
+        }
+
+        const std::set<std::string> files
+          = watcher.wait (1000, 1000, 10000);
+        if (!files.empty()) {
+          Metrics::global().count ("watcher.events", files.size());
+          changed.insert (files.begin(), files.end());
+        }
+
+        if (changed.empty() || *updating_) {
+          continue;
+        }
+
+        Json::Value request;
+        request["command"]     = "update";
+        request["diagnostics"] = false;
+        request["jobs"]        = jobs_;
+        for (auto file = changed.begin() ; file != changed.end() ; ++file) {
+          request["files"].append (*file);
+        }
+        changed.clear();
+
+        *updating_ = true;
+        posted = true;
+        Metrics::global().count ("watcher.updates");
+        std::shared_ptr<std::atomic<bool> > updating = updating_;
+        server_.post (request, [updating] () { *updating = false; });
+      }
+    } catch (std::exception & e) {
+      std::cerr << "File watcher stopped: " << e.what() << std::endl;
+    }
+  }
+
+  Server &                            server_;
+  const Storage::Pragmas              pragmas_;
+  const unsigned int                  jobs_;
+  std::atomic<bool>                   stop_;
+  std::shared_ptr<std::atomic<bool> > updating_;  // outlives this object
+  std::thread                         thread_;
+};
+
+
+// Requests modifying the index run in the background, one at a time. Requests
+// which need to parse source files are latency-sensitive and get their own
+// lane, which owns the translation unit cache (hence also serves diagnostics).
+// Other requests only read the index, and are served concurrently.
+Server::Lane schedule (const Json::Value & request) {
+  const std::string command = request["command"].asString();
+
+  if (command == "load" || command == "index" || command == "update"
+      || command == "config"
+      || (command == "shard" && request.get ("action", "list").asString() != "list")) {
+    return Server::Background;
+  }
+
+  if (command == "complete" || command == "pin" || command == "diagnostics"
+      || command == "exit"
+      || (command == "find" && !request.get ("fromIndex", true).asBool())) {
+    return Server::Interactive;
+  }
+
+  return Server::Query;
+}
+
+
+// Requests which TCP clients may send: those reading the index, but not the
+// source files of the server
+bool allowRemote (const Json::Value & request) {
+  const std::string command = request["command"].asString();
+  return command == "grep" || command == "search" || command == "files"
+    || command == "stats"
+    || (command == "find" && request.get ("fromIndex", true).asBool());
+}
+
+
+// Split a HOST:PORT address (the host defaults to all interfaces)
+bool splitAddress (const std::string & address, std::string & host, std::string & port) {
+  const size_t colon = address.rfind (':');
+  host = colon == std::string::npos ? "" : address.substr (0, colon);
+  port = colon == std::string::npos ? address : address.substr (colon + 1);
+  if (host == "") {
+    host = "0.0.0.0";
+  }
+  return port != "";
+}
+
+
 int main (int argc, char **argv) {
   Getopt options (argc, argv);
   options.add ("help", 'h', 0,
@@ -220,6 +760,24 @@ int main (int argc, char **argv) {
                "read a request from the standard input and exit");
   options.add ("cachesize", 'l', 1,
                "specify the maximum size of the translation unit cache (in MB)");
+  options.add ("memory", 'm', 1,
+               "specify the memory budget of the server, shared by all caches"
+               " (in MB)");
+  options.add ("threads", 't', 1,
+               "specify the number of threads serving index queries");
+  options.add ("symbols", 'y', 0,
+               "keep the symbol table in memory to speed up index queries");
+  options.add ("pragma", 'p', 1,
+               "set an SQLite tunable for the index database (NAME=VALUE)");
+  options.add ("stats-interval", 'i', 1,
+               "write metrics to the log every N seconds (0 to disable)");
+  options.add ("listen", 'n', 1,
+               "also serve the index to remote clients on a TCP port ([HOST:]PORT)");
+  options.add ("remote", 'r', 1,
+               "answer index queries from a remote server (HOST:PORT), and only"
+               " index locally modified files");
+  options.add ("watch", 'w', 0,
+               "watch indexed files, and update the index as soon as they change");
 
   try {
     options.get();
@@ -247,21 +805,83 @@ int main (int argc, char **argv) {
   // Convert to bytes from MB.
   cacheLimit *= 1024 * 1024;
 
-  Storage storage;
-  Application app (storage, cacheLimit);
-  Request::Parser p ("Clang-tags server\n");
-  p .add (new CompilationDatabaseCommand ("load", app))
-    .add (new IndexCommand ("index", app))
-    .add (new UpdateCommand ("update", app))
-    .add (new FindCommand ("find", app))
-    .add (new GrepCommand ("grep", app))
-    .add (new CompleteCommand ("complete", app))
-    .add (new ExitCommand ("exit"))
-    .prompt ("clang-dde> ");
+  // Default to 3/4 of the cgroup limit, or of the physical memory.
+  unsigned long memoryBudget = MemoryGovernor::cgroupLimit();
+  if (memoryBudget == 0) {
+    memoryBudget = sysconf (_SC_PHYS_PAGES) * sysconf (_SC_PAGESIZE);
+  }
+  memoryBudget = memoryBudget / 4 * 3;
+  if (options.getCount ("memory") > 0) {
+    try {
+      memoryBudget = std::stoul(options["memory"]) * 1024 * 1024;
+    } catch (...) {
+      std::cerr << "Invalid memory value: " << options["memory"] << std::endl;
+      return 1;
+    }
+  }
 
+  unsigned int threads = 4;
+  if (options.getCount ("threads") > 0) {
+    try {
+      threads = std::stoul(options["threads"]);
+    } catch (...) {
+      std::cerr << "Invalid threads value: " << options["threads"] << std::endl;
+      return 1;
+    }
+  }
+
+  unsigned int statsInterval = 0;
+  if (options.getCount ("stats-interval") > 0) {
+    try {
+      statsInterval = std::stoul(options["stats-interval"]);
+    } catch (...) {
+      std::cerr << "Invalid stats-interval value: " << options["stats-interval"] << std::endl;
+      return 1;
+    }
+  }
+
+  Storage::Pragmas pragmas;
+  if (options.getCount ("pragma") > 0) {
+    const Getopt::OptionValues & values = options.getAll ("pragma");
+    for (auto it = values.begin() ; it != values.end() ; ++it) {
+      const size_t equal = it->find ('=');
+      try {
+        if (equal == std::string::npos) {
+          throw std::runtime_error ("Expected NAME=VALUE");
+        }
+        const std::string name  = it->substr (0, equal);
+        const std::string value = it->substr (equal + 1);
+        Storage::checkPragma (name, value);
+        pragmas[name] = value;
+      } catch (std::exception & e) {
+        std::cerr << "Invalid pragma: " << *it << std::endl
+                  << "  " << e.what() << std::endl;
+        return 1;
+      }
+    }
+  }
+
+  std::string listenHost, listenPort;
+  if (options.getCount ("listen") > 0
+      && !splitAddress (options["listen"], listenHost, listenPort)) {
+    std::cerr << "Invalid listen address: " << options["listen"] << std::endl;
+    return 1;
+  }
+
+  std::unique_ptr<RemoteIndex> remote;
+  if (options.getCount ("remote") > 0) {
+    std::string host, port;
+    if (!splitAddress (options["remote"], host, port)) {
+      std::cerr << "Invalid remote address: " << options["remote"] << std::endl;
+      return 1;
+    }
+    remote.reset (new RemoteIndex (host, port));
+  }
 
   if (options.getCount ("stdin") > 0) {
-    p.parseJson (std::cin, std::cout);
+    RequestHandler handler (Storage::ReadWrite, pragmas, cacheLimit,
+                            remote.get(), [] () {});
+    handler.parser.parseJson (std::cin, std::cout);
   }
   else {
     const std::string pidPath (".ct.pid");
@@ -274,18 +894,68 @@ int main (int argc, char **argv) {
     const std::string socketPath (".ct.sock");
     try
       {
-        boost::asio::io_service io_service;
-        boost::asio::local::stream_protocol::endpoint endpoint (socketPath);
-        boost::asio::local::stream_protocol::acceptor acceptor (io_service, endpoint);
-        for (;;)
-          {
-            boost::asio::local::stream_protocol::iostream socket;
-            boost::system::error_code err;
-            acceptor.accept(*socket.rdbuf(), err);
-            if (!err) {
-              p.parseJson (socket, socket, /*verbose=*/true);
+        Server * server = NULL;
+        auto shutdown = [&server] () { server->stop(); };
+
+        // Translation unit caches register when their lane is created
+        MemoryGovernor & governor = MemoryGovernor::global();
+        governor.setBudget (memoryBudget);
+        governor.add ("sqlite", 0.2,
+                      [] () -> size_t { return Sqlite::Database::memoryUsed(); },
+                      // A limit of 0 would remove the limit altogether
+                      [] (size_t limit) {
+                        Sqlite::Database::setSoftHeapLimit (std::max<size_t> (limit, 1));
+                      });
+        governor.add ("sourceFiles", 0.1,
+                      [] () { return SourceFileCache::global().memoryUsage(); },
+                      [] (size_t limit) { SourceFileCache::global().setMemoryLimit (limit); });
+
+        const bool useSymbols = options.getCount ("symbols") > 0;
+        SymbolTable symbols;
+        if (useSymbols) {
+          // Only reported: the symbol table can not be shrunk
+          governor.add ("symbols", 0,
+                        [&symbols] () { return symbols.memoryUsage(); });
+        }
+
+        // Only the background lane writes to the database; it is created
+        // first so that read-only connections find an up-to-date schema.
+        auto factory = [&] (Server::Lane lane) -> Server::Handler {
+          std::shared_ptr<RequestHandler> handler
+            (new RequestHandler (lane == Server::Background
+                                 ? Storage::ReadWrite
+                                 : Storage::ReadOnly,
+                                 pragmas, cacheLimit, remote.get(), shutdown));
+          if (useSymbols) {
+            if (lane == Server::Background) {
+              std::cerr << "Loading symbol table..." << std::endl;
+              handler->storage.loadSymbols (symbols);
             }
+            handler->storage.useSymbolTable (symbols);
+          }
+          if (lane == Server::Interactive) {
+            handler->app.warmUp();
           }
+
+          return [handler] (const Json::Value & request, std::ostream & cout) {
+            Metrics::ScopedTimer timer ("request." + request["command"].asString());
+            handler->parser.parseJson (request, cout);
+          };
+        };
+
+        Server s (socketPath, factory, schedule, threads);
+        server = &s;
+        if (listenPort != "") {
+          s.listen (listenHost, listenPort, allowRemote);
+        }
+        StatsDumper dumper (statsInterval);
+        MemoryMonitor monitor (2);
+        std::unique_ptr<IndexWatcher> watcher;
+        if (options.getCount ("watch") > 0) {
+          watcher.reset (new IndexWatcher (s, pragmas,
+                                           std::max (1u, std::thread::hardware_concurrency())));
+        }
+        s.run();
       }
     catch (std::exception& e)
       {
@@ -0,0 +1,379 @@
+#pragma once
+
+#include "libclang++/libclang++.hxx"
+#include "json/json.h"
+
+#include <sys/stat.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fstream>
+#include <sstream>
+#include <mutex>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+/** @brief On-disk cache of precompiled headers
+ *
+ * Source files often begin with the same list of @c \#include directives (the
+ * "prefix" of the source file). This prefix is precompiled once for each set of
+ * compilation arguments, and reused by all translation units sharing it through
+ * the @c -include-pch compiler option.
+ *
+ * For each precompiled header, the cache directory contains:
+ * - @c HASH.h: the prefix, from which the PCH is built;
+ * - @c HASH.pch: the precompiled header itself;
+ * - @c HASH.json: the cache key and the modification times of all headers
+ *   included by the prefix. The PCH is rebuilt when one of them changes.
+ *
+ * Translation units using a precompiled header still contain the original
+ * @c \#include directives, which are then processed a second time. Prefixes
+ * including headers without include guards (e.g. X-macro files) are thus not
+ * precompiled: this is recorded in @c HASH.json, without any @c HASH.pch.
+ *
+ * This class can be used concurrently from several threads.
+ */
+class PchCache {
+public:
+  /** @brief Constructor
+   *
+   * @param directory  directory where precompiled headers are stored (relative
+   *                   paths are interpreted from the current directory)
+   */
+  PchCache (const std::string & directory)
+    : directory_ (canonical_ (currentDirectory_(), directory))
+  { }
+
+  /** @brief Parse a translation unit, using a precompiled header if possible
+   *
+   * The translation unit is parsed with a precompiled header for the prefix of
+   * the source file. If no valid precompiled header exists yet, it is built
+   * with the given index (when @em build is true). If this fails, another
+   * thread is already building it, or the compiler fails to use it, the
+   * translation unit is parsed normally.
+   *
+   * @param index      index used to parse the translation unit
+   * @param fileName   source file name
+   * @param directory  compilation directory
+   * @param args       compilation arguments for the source file
+   * @param options    a bitwise OR of @c CXTranslationUnit_Flags
+   * @param build      build the precompiled header if needed
+   *
+   * @return the translation unit
+   */
+  LibClang::TranslationUnit parse (const LibClang::Index & index,
+                                   const std::string & fileName,
+                                   const std::string & directory,
+                                   const std::vector<std::string> & args,
+                                   unsigned int options,
+                                   bool build)
+  {
+    std::string pch;
+    const std::vector<std::string> pchArgs
+      = arguments_ (index, fileName, directory, args, build, pch);
+
+    LibClang::TranslationUnit tu = index.parse (pchArgs, options);
+    if (pch != "" && !usable_ (tu)) {
+      discard_ (pch);
+      tu = index.parse (args, options);
+    }
+    return tu;
+  }
+
+private:
+  // Arguments to use in order to parse a source file with a precompiled
+  // header for its prefix (or the original arguments if none is available)
+  std::vector<std::string> arguments_ (const LibClang::Index & index,
+                                      const std::string & fileName,
+                                      const std::string & directory,
+                                      const std::vector<std::string> & args,
+                                      bool build,
+                                      std::string & pch)
+  {
+    pch = "";
+
+    const std::string prefix = prefix_ (fileName);
+    if (prefix == "") {
+      return args;
+    }
+
+    // Compilation arguments for the prefix
+    std::vector<std::string> prefixArgs;
+    std::string language = endsWith_ (fileName, ".c") ? "c-header" : "c++-header";
+    {
+      auto it  = args.begin();
+      auto end = args.end();
+      for ( ; it != end ; ++it) {
+        if (*it == "-x" && it+1 != end) {
+          language = *(it+1) + "-header";
+          ++it;
+          continue;
+        }
+        if (canonical_ (directory, *it) == fileName) {
+          continue;
+        }
+        prefixArgs.push_back (*it);
+      }
+    }
+
+    // Quoted includes are searched for relative to the source file
+    if (prefix.find ('"') != std::string::npos) {
+      prefixArgs.push_back ("-iquote");
+      prefixArgs.push_back (fileName.substr (0, fileName.rfind ('/')));
+    }
+
+    Json::Value key;
+    key["directory"] = directory;
+    key["language"]  = language;
+    key["prefix"]    = prefix;
+    for (auto it = prefixArgs.begin() ; it != prefixArgs.end() ; ++it) {
+      key["args"].append (*it);
+    }
+    const std::string keyStr = Json::FastWriter().write (key);
+
+    std::ostringstream base;
+    base << directory_ << "/" << std::hex << std::hash<std::string>() (keyStr);
+    const std::string pchPath = base.str() + ".pch";
+
+    // Only precompile prefixes shared by several translation units
+    {
+      std::lock_guard<std::mutex> lock (mutex_);
+      if (++requests_[base.str()] < 2) {
+        build = false;
+      }
+    }
+
+    bool guarded = true;
+    if (!valid_ (base.str(), keyStr, guarded)) {
+      if (!build || !build_ (index, base.str(), keyStr, directory,
+                             language, prefix, prefixArgs, guarded)) {
+        return args;
+      }
+    }
+    if (!guarded) {
+      return args;
+    }
+
+    std::vector<std::string> res (args);
+    if (prefix.find ('"') != std::string::npos) {
+      res.push_back ("-iquote");
+      res.push_back (fileName.substr (0, fileName.rfind ('/')));
+    }
+    res.push_back ("-include-pch");
+    res.push_back (pchPath);
+    pch = pchPath;
+    return res;
+  }
+
+  // A precompiled header which can not be used (for example because it was
+  // built by another version of the compiler) produces fatal errors
+  static bool usable_ (LibClang::TranslationUnit & tu) {
+    if (tu.raw() == NULL) {
+      return false;
+    }
+
+    for (unsigned int N = tu.numDiagnostics(), i = 0 ; i < N ; ++i) {
+      if (tu.diagnosticSeverity (i) == CXDiagnostic_Fatal) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Remove a precompiled header, so that it gets rebuilt next time
+  void discard_ (const std::string & pch) {
+    std::lock_guard<std::mutex> lock (mutex_);
+    const std::string base = pch.substr (0, pch.size() - 4);
+    unlink ((base + ".json").c_str());
+    unlink (pch.c_str());
+  }
+
+  // Leading block of #include directives in a source file (ignoring blank
+  // lines and comments)
+  static std::string prefix_ (const std::string & fileName) {
+    std::ifstream file (fileName);
+    std::string prefix;
+    bool comment = false;
+
+    std::string line;
+    while (std::getline (file, line)) {
+      std::string code;
+      for (size_t i = 0 ; i < line.size() ; ++i) {
+        if (comment) {
+          if (line.compare (i, 2, "*/") == 0) {
+            comment = false;
+            ++i;
+          }
+          continue;
+        }
+        if (line.compare (i, 2, "/*") == 0) {
+          comment = true;
+          ++i;
+          continue;
+        }
+        if (line.compare (i, 2, "//") == 0) {
+          break;
+        }
+        code += line[i];
+      }
+
+      std::istringstream tokens (code);
+      std::string directive;
+      tokens >> directive;
+      if (directive == "") {
+        continue;
+      }
+      if (directive == "#") {
+        std::string word;
+        tokens >> word;
+        directive += word;
+      }
+      if (directive.compare (0, 8, "#include") != 0) {
+        break;
+      }
+
+      prefix += code + "\n";
+    }
+
+    return prefix;
+  }
+
+  // Is there a precompiled header for this key, built after all the headers
+  // it depends on have last been modified? guarded tells whether the prefix
+  // could be precompiled at all.
+  bool valid_ (const std::string & base, const std::string & key, bool & guarded) {
+    std::lock_guard<std::mutex> lock (mutex_);
+
+    Json::Value deps;
+    Json::Reader reader;
+    std::ifstream depsFile (base + ".json");
+    if (!depsFile || !reader.parse (depsFile, deps)) {
+      return false;
+    }
+
+    if (deps["key"].asString() != key || !deps.isMember ("guarded")) {
+      return false;
+    }
+    guarded = deps["guarded"].asBool();
+
+    const Json::Value & files = deps["files"];
+    for (auto it = files.begin() ; it != files.end() ; ++it) {
+      struct stat fileStat;
+      if (stat (it.key().asString().c_str(), &fileStat) != 0
+          || fileStat.st_mtime != (time_t)(*it).asInt()) {
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+  bool build_ (const LibClang::Index & index,
+               const std::string & base,
+               const std::string & key,
+               const std::string & directory,
+               const std::string & language,
+               const std::string & prefix,
+               const std::vector<std::string> & prefixArgs,
+               bool & guarded)
+  {
+    {
+      std::lock_guard<std::mutex> lock (mutex_);
+      if (building_.count (base) > 0) {
+        return false;
+      }
+      building_.insert (base);
+      mkdir (directory_.c_str(), 0777);
+    }
+
+    bool ok = false;
+    try {
+      {
+        std::ofstream header (base + ".h");
+        header << prefix;
+      }
+
+      std::vector<std::string> args (prefixArgs);
+      args.push_back ("-working-directory");
+      args.push_back (directory);
+      args.push_back ("-x");
+      args.push_back (language);
+      args.push_back (base + ".h");
+
+      LibClang::TranslationUnit tu
+        = index.parse (args, CXTranslationUnit_Incomplete
+                       |     CXTranslationUnit_ForSerialization);
+      const std::vector<std::string> files
+        = tu.raw() != NULL ? tu.includedFiles() : std::vector<std::string>();
+      guarded = true;
+      for (auto it = files.begin() ; it != files.end() ; ++it) {
+        if (canonical_ (directory, *it) != canonical_ (directory, base + ".h")
+            && !tu.isIncludeGuarded (*it)) {
+          guarded = false;
+        }
+      }
+
+      if (!guarded) {
+        unlink ((base + ".pch").c_str());
+      }
+      if (tu.raw() != NULL && (!guarded || tu.save (base + ".pch"))) {
+        Json::Value deps;
+        deps["key"] = key;
+        deps["guarded"] = guarded;
+        deps["files"] = Json::Value (Json::objectValue);
+
+        for (auto it = files.begin() ; it != files.end() ; ++it) {
+          const std::string file = canonical_ (directory, *it);
+          struct stat fileStat;
+          if (stat (file.c_str(), &fileStat) == 0) {
+            deps["files"][file] = (Json::Int) fileStat.st_mtime;
+          }
+        }
+
+        std::lock_guard<std::mutex> lock (mutex_);
+        std::ofstream depsFile (base + ".json");
+        depsFile << deps;
+        ok = true;
+      }
+    } catch (...) {
+      ok = false;
+    }
+
+    std::lock_guard<std::mutex> lock (mutex_);
+    building_.erase (base);
+    return ok;
+  }
+
+  static std::string canonical_ (const std::string & directory,
+                                 const std::string & fileName) {
+    std::string path = fileName;
+    if (path != "" && path[0] != '/') {
+      path = directory + "/" + path;
+    }
+
+    char * canonicalPath = realpath (path.c_str(), NULL);
+    if (canonicalPath) {
+      path = canonicalPath;
+      free (canonicalPath);
+    }
+    return path;
+  }
+
+  static std::string currentDirectory_ () {
+    char * cwd = getcwd (NULL, 0);
+    std::string res = cwd ? cwd : ".";
+    free (cwd);
+    return res;
+  }
+
+  static bool endsWith_ (const std::string & s, const std::string & suffix) {
+    return s.size() >= suffix.size()
+      && s.compare (s.size() - suffix.size(), suffix.size(), suffix) == 0;
+  }
+
+  const std::string          directory_;
+  std::mutex                 mutex_;
+  std::set<std::string>      building_;
+  std::map<std::string, int> requests_;
+};
@@ -0,0 +1,141 @@
+#include "application.hxx"
+#include "json/json.h"
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+#include <fstream>
+
+// Files most recently pinned by editors, from the most recent to the oldest.
+// Their translation units are parsed in advance when the server starts.
+static const char * const recentPath = ".ct.recent";
+static const unsigned int recentMax  = 16;
+
+static std::vector<std::string> readRecent () {
+  std::vector<std::string> files;
+
+  Json::Value root;
+  Json::Reader reader;
+  std::ifstream json (recentPath);
+  if (!json || !reader.parse (json, root) || !root.isArray()) {
+    return files;
+  }
+
+  for (unsigned int i = 0 ; i < root.size() ; ++i) {
+    files.push_back (root[i].asString());
+  }
+  return files;
+}
+
+static void writeRecent (const std::vector<std::string> & files) {
+  Json::Value root (Json::arrayValue);
+  for (auto it = files.begin() ; it != files.end() ; ++it) {
+    root.append (*it);
+  }
+
+  std::ofstream json (recentPath);
+  json << root;
+}
+
+
+void Application::pin (PinArgs & args, std::ostream & cout) {
+  if (args.pinned) {
+    LibClang::UnsavedFiles unsaved;
+    translationUnit_ (args.fileName, "", unsaved);
+    tu_.pin (args.fileName, true);
+
+    std::vector<std::string> recent = readRecent();
+    recent.erase (std::remove (recent.begin(), recent.end(), args.fileName),
+                  recent.end());
+    recent.insert (recent.begin(), args.fileName);
+    if (recent.size() > recentMax) {
+      recent.resize (recentMax);
+    }
+    writeRecent (recent);
+
+    cout << "Pinned " << args.fileName << std::endl;
+  } else {
+    tu_.pin (args.fileName, false);
+    cout << "Unpinned " << args.fileName << std::endl;
+  }
+
+  const LibClang::TranslationUnitCache::Stats stats = tu_.stats();
+  std::cerr << "Translation units cache: "
+            << stats.size << " units (" << stats.memoryUsage / (1024*1024) << " MB), "
+            << stats.hits << " hits, "
+            << stats.misses << " misses, "
+            << stats.evictions << " evictions." << std::endl;
+}
+
+
+void Application::warmUp () {
+  if (warmUpThread_.joinable()) {
+    return;
+  }
+
+  // The database is only accessed from this thread
+  struct Job {
+    std::string              fileName;
+    std::string              directory;
+    std::vector<std::string> clArgs;
+  };
+  std::vector<Job> jobs;
+
+  const std::vector<std::string> recent = readRecent();
+  for (auto it = recent.begin() ; it != recent.end() ; ++it) {
+    Job job;
+    job.fileName = *it;
+    try {
+      storage_.getCompileCommand (job.fileName, job.directory, job.clArgs);
+    } catch (...) {
+      continue;
+    }
+    addWorkingDirectory (job.clArgs, job.directory);
+    jobs.push_back (job);
+  }
+
+  if (jobs.empty()) {
+    return;
+  }
+
+  std::cerr << "Warming up " << jobs.size() << " translation units..." << std::endl;
+  warmUpThread_ = std::thread ([this, jobs] () {
+      // Lower the priority of this thread (and of the threads libclang starts
+      // from it, which inherit it), not that of the index: translation units
+      // are later reparsed and completed from the interactive lane, with the
+      // priority of the index they were created with.
+      setpriority (PRIO_PROCESS, syscall (SYS_gettid), 10);
+
+      const size_t contentsHash = std::hash<std::string>() ("");
+      for (auto job = jobs.begin() ; job != jobs.end() && !warmUpStop_ ; ++job) {
+        Timer timer;
+        LibClang::UnsavedFiles unsaved;
+        LibClang::TranslationUnit tu
+          = pch_.parse (warmUpIndex_, job->fileName, job->directory, job->clArgs,
+                        cachedParseOptions_(), /*build=*/false);
+        tu.reparse (unsaved);
+        Metrics::global().time ("warmUp.parse", timer.get());
+
+        std::shared_ptr<WarmedUp> warmedUp (new WarmedUp {
+            job->fileName, tu,
+            currentParseState_ (tu, job->directory, contentsHash),
+            timer.get()});
+        warmedUp_.push (warmedUp);
+      }
+    });
+}
+
+
+void Application::adoptWarmedUp_ () {
+  std::shared_ptr<WarmedUp> warmedUp;
+  while (warmedUp_.tryPop (warmedUp)) {
+    // The file may have been requested before the warm-up thread got to it
+    if (tu_.contains (warmedUp->fileName)) {
+      continue;
+    }
+
+    parseState_[warmedUp->fileName] = warmedUp->state;
+    tu_.insert (warmedUp->fileName, warmedUp->tu, warmedUp->cost);
+    publishCacheStats_();
+  }
+}
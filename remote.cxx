@@ -0,0 +1,334 @@
+#include "application.hxx"
+#include "util/metrics.hxx"
+
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cstdlib>
+#include <set>
+#include <sstream>
+#include <tuple>
+
+static std::string currentDirectory () {
+  char * cwd = getcwd (NULL, 0);
+  std::string res = cwd ? cwd : ".";
+  free (cwd);
+  return res;
+}
+
+// Both checkouts can be located in different directories: paths below the
+// root of one of them are translated to the other. Other paths (e.g. system
+// headers) are left as is.
+static std::string translate (const std::string & path,
+                              const std::string & from,
+                              const std::string & to) {
+  if (from == to || path.compare (0, from.size(), from) != 0
+      || (path.size() > from.size() && path[from.size()] != '/')) {
+    return path;
+  }
+  return to + path.substr (from.size());
+}
+
+// Responses of find and grep requests are made of one JSON object per line;
+// anything else is an error message
+static std::vector<Json::Value> parseLines (const std::string & response,
+                                            const RemoteIndex & remote) {
+  std::vector<Json::Value> res;
+  std::istringstream lines (response);
+  std::string line;
+  while (std::getline (lines, line)) {
+    if (line == "") {
+      continue;
+    }
+
+    Json::Value json;
+    Json::Reader reader;
+    if (!reader.parse (line, json) || !json.isObject()) {
+      throw std::runtime_error ("Remote index " + remote.address() + ": " + line);
+    }
+    res.push_back (json);
+  }
+  return res;
+}
+
+static Json::Value parseObject (const std::string & response,
+                                const RemoteIndex & remote) {
+  const std::vector<Json::Value> lines = parseLines (response, remote);
+  if (lines.size() != 1) {
+    throw std::runtime_error ("Unexpected response from remote index "
+                              + remote.address());
+  }
+  return lines[0];
+}
+
+static Storage::Reference referenceFromJson (const Json::Value & json,
+                                             const std::string & remoteRoot,
+                                             const std::string & localRoot) {
+  Storage::Reference ref;
+  ref.file     = translate (json["file"].asString(), remoteRoot, localRoot);
+  ref.line1    = json["line1"].asInt();
+  ref.line2    = json["line2"].asInt();
+  ref.col1     = json["col1"].asInt();
+  ref.col2     = json["col2"].asInt();
+  ref.offset1  = json["offset1"].asInt();
+  ref.offset2  = json["offset2"].asInt();
+  ref.kind     = json["kind"].asString();
+  ref.spelling = json["spelling"].asString();
+  return ref;
+}
+
+static Storage::Definition definitionFromJson (const Json::Value & json,
+                                               const std::string & remoteRoot,
+                                               const std::string & localRoot) {
+  Storage::Definition def;
+  def.usr      = json["usr"].asString();
+  def.file     = translate (json["file"].asString(), remoteRoot, localRoot);
+  def.line1    = json["line1"].asInt();
+  def.line2    = json["line2"].asInt();
+  def.col1     = json["col1"].asInt();
+  def.col2     = json["col2"].asInt();
+  def.kind     = json["kind"].asString();
+  def.spelling = json["spelling"].asString();
+  return def;
+}
+
+// Whether files are indexed locally, memoized for the duration of a request
+class OverlayFiles {
+public:
+  OverlayFiles (Storage & storage)
+    : storage_ (storage)
+  { }
+
+  bool contains (const std::string & fileName) {
+    auto it = known_.find (fileName);
+    if (it == known_.end()) {
+      it = known_.insert (std::make_pair (fileName, storage_.isIndexed (fileName))).first;
+    }
+    return it->second;
+  }
+
+private:
+  Storage &                   storage_;
+  std::map<std::string, bool> known_;
+};
+
+
+void Application::files (FilesArgs & args, std::ostream & cout) {
+  Json::Value json;
+  json["root"] = currentDirectory();
+
+  if (args.hashes) {
+    Json::Value & files = json["files"];
+    files = Json::Value (Json::arrayValue);
+
+    const std::vector<Storage::IndexedFile> indexed = storage_.indexedFiles();
+    for (auto file = indexed.begin() ; file != indexed.end() ; ++file) {
+      Json::Value entry;
+      entry["name"]   = file->name;
+      entry["hash"]   = file->hash;
+      entry["source"] = file->source;
+      files.append (entry);
+    }
+  }
+
+  Json::FastWriter writer;
+  cout << writer.write (json);
+}
+
+
+std::vector<Storage::RefDef>
+Application::findDefinitionRemote_ (const std::string & fileName, int offset) {
+  OverlayFiles overlay (storage_);
+  if (overlay.contains (fileName)) {
+    return shards_.findDefinition (fileName, offset);
+  }
+
+  const std::string localRoot = currentDirectory();
+  std::string remoteRoot;
+  std::vector<Json::Value> lines;
+  try {
+    Metrics::ScopedTimer timer ("query.remote.find");
+    remoteRoot = remote_->root();
+
+    Json::Value request;
+    request["command"]      = "find";
+    request["file"]         = translate (fileName, localRoot, remoteRoot);
+    request["offset"]       = offset;
+    request["fromIndex"]    = true;
+    request["mostSpecific"] = false;
+    request["diagnostics"]  = false;
+    lines = parseLines (remote_->send (request).get(), *remote_);
+  } catch (std::runtime_error & e) {
+    Metrics::global().count ("remote.failures");
+    std::cerr << "Using the local index only: " << e.what() << std::endl;
+    return shards_.findDefinition (fileName, offset);
+  }
+
+  std::vector<Storage::RefDef> res;
+  std::set<std::tuple<int, int, std::string> > replaced;
+  for (auto line = lines.begin() ; line != lines.end() ; ++line) {
+    Storage::RefDef refDef;
+    refDef.ref = referenceFromJson ((*line)["ref"], remoteRoot, localRoot);
+    refDef.def = definitionFromJson ((*line)["def"], remoteRoot, localRoot);
+    refDef.ref.file = fileName;
+
+    if (!overlay.contains (refDef.def.file)) {
+      res.push_back (refDef);
+      continue;
+    }
+
+    // The definition is in a file modified locally: its up-to-date location is
+    // in the local index
+    const Storage::Reference & ref = refDef.ref;
+    if (!replaced.insert (std::make_tuple (ref.offset1, ref.offset2,
+                                           refDef.def.usr)).second) {
+      continue;
+    }
+    const std::vector<Storage::Definition> defs
+      = storage_.findDeclarations (refDef.def.usr);
+    for (auto def = defs.begin() ; def != defs.end() ; ++def) {
+      refDef.def = *def;
+      res.push_back (refDef);
+    }
+  }
+  return res;
+}
+
+
+void Application::grepRemote_ (const GrepArgs & args,
+                               const std::function<void (const Storage::Reference &)> & f) {
+  const std::string localRoot = currentDirectory();
+  const unsigned int wanted = args.limit > 0 ? args.offset + args.limit : 0;
+
+  // The remote request is sent first, so that the local index is queried
+  // while it is being handled
+  std::string remoteRoot;
+  std::future<std::string> response;
+  auto sendGrep = [&] (unsigned int offset) {
+    Json::Value request;
+    request["command"]    = "grep";
+    request["usr"]        = args.usr;
+    request["filePrefix"] = translate (args.filePrefix, localRoot, remoteRoot);
+    request["offset"]     = offset;
+    request["limit"]      = wanted;
+    return remote_->send (request);
+  };
+  try {
+    remoteRoot = remote_->root();
+    response = sendGrep (0);
+  } catch (std::runtime_error & e) {
+    Metrics::global().count ("remote.failures");
+    std::cerr << "Using the local index only: " << e.what() << std::endl;
+  }
+
+  std::vector<Storage::Reference> refs;
+  shards_.grep (args.usr, args.filePrefix, 0, wanted,
+                [&refs] (const Storage::Reference & ref) {
+                  refs.push_back (ref);
+                });
+
+  if (response.valid()) {
+    try {
+      Metrics::ScopedTimer timer ("query.remote.grep");
+
+      // References in files modified locally come from the local index. They
+      // are discarded after paging on the remote side: ask for more pages
+      // until enough references are left (or the remote has no more).
+      OverlayFiles overlay (storage_);
+      unsigned int fetched = 0;
+      unsigned int kept    = 0;
+      while (true) {
+        const std::vector<Json::Value> lines = parseLines (response.get(), *remote_);
+        for (auto line = lines.begin() ; line != lines.end() ; ++line) {
+          Storage::Reference ref = referenceFromJson (*line, remoteRoot, localRoot);
+          if (!overlay.contains (ref.file)) {
+            refs.push_back (ref);
+            ++kept;
+          }
+        }
+        fetched += lines.size();
+
+        if (wanted == 0 || kept >= wanted || lines.size() < wanted) {
+          break;
+        }
+        Metrics::global().count ("remote.grep.pages");
+        response = sendGrep (fetched);
+      }
+    } catch (std::runtime_error & e) {
+      Metrics::global().count ("remote.failures");
+      std::cerr << "Using the local index only: " << e.what() << std::endl;
+    }
+  }
+
+  std::set<std::tuple<std::string, int, int> > seen;
+  unsigned int skipped = 0;
+  unsigned int count = 0;
+  for (auto ref = refs.begin() ; ref != refs.end() ; ++ref) {
+    if (!seen.insert (std::make_tuple (ref->file, ref->offset1, ref->offset2)).second) {
+      continue;
+    }
+    if (skipped < args.offset) {
+      ++skipped;
+      continue;
+    }
+    if (args.limit > 0 && count >= args.limit) {
+      return;
+    }
+    ++count;
+    f (*ref);
+  }
+}
+
+
+std::vector<std::string>
+Application::overlaySources_ (const std::vector<std::string> & stale,
+                              std::ostream & cout) {
+  const std::string localRoot = currentDirectory();
+
+  Json::Value request;
+  request["command"] = "files";
+  request["hashes"]  = true;
+  const Json::Value json = parseObject (remote_->send (request).get(), *remote_);
+  const std::string remoteRoot = json["root"].asString();
+
+  // Files indexed remotely, and the sources to parse for those which differ
+  // in this checkout
+  std::set<std::string> remoteFiles;
+  std::set<std::string> modifiedSources;
+  unsigned int modified = 0;
+  const Json::Value & files = json["files"];
+  for (unsigned int i = 0 ; i < files.size() ; ++i) {
+    const std::string name   = translate (files[i]["name"].asString(), remoteRoot, localRoot);
+    const std::string source = translate (files[i]["source"].asString(), remoteRoot, localRoot);
+    remoteFiles.insert (name);
+
+    struct stat fileStat;
+    if (stat (name.c_str(), &fileStat) != 0) {
+      continue;
+    }
+
+    if (Storage::hashFile (name) != files[i]["hash"].asString()) {
+      ++modified;
+      modifiedSources.insert (source != "" ? source : name);
+    } else if (storage_.isIndexed (name)) {
+      // Back to the remote version: the remote index is up to date again
+      storage_.clearFile (name);
+    }
+  }
+
+  // Sources already in the overlay are kept up to date, as well as sources
+  // which are not known to the remote index
+  std::vector<std::string> res;
+  for (auto source = stale.begin() ; source != stale.end() ; ++source) {
+    if (modifiedSources.count (*source) > 0
+        || remoteFiles.count (*source) == 0
+        || storage_.isIndexed (*source)) {
+      res.push_back (*source);
+    }
+  }
+
+  cout << "Remote index " << remote_->address() << ": "
+       << modified << " files modified locally, "
+       << res.size() << " of " << stale.size()
+       << " stale translation units to index" << std::endl;
+  return res;
+}
@@ -0,0 +1,191 @@
+#include "remoteIndex.hxx"
+#include "server.hxx"
+
+#include <iostream>
+
+RemoteIndex::RemoteIndex (const std::string & host, const std::string & port)
+  : host_ (host),
+    port_ (port),
+    nextId_ (0)
+{ }
+
+RemoteIndex::~RemoteIndex () {
+  {
+    std::lock_guard<std::mutex> lock (mutex_);
+    if (socket_) {
+      // Wake the reader thread up
+      boost::system::error_code ignored;
+      socket_->shutdown (boost::asio::ip::tcp::socket::shutdown_both, ignored);
+    }
+  }
+
+  if (reader_.joinable()) {
+    reader_.join();
+  }
+}
+
+std::future<std::string> RemoteIndex::send (const Json::Value & request) {
+  Json::FastWriter writer;
+  const std::string payload = writer.write (request);
+
+  std::lock_guard<std::mutex> lock (mutex_);
+  connect_();
+
+  const uint32_t id = nextId_++;
+  std::shared_ptr<Pending> pending (new Pending);
+  pending_[id] = pending;
+
+  unsigned char header[Server::frameHeaderSize];
+  Server::encodeFrameHeader (payload.size(), id, header);
+  std::vector<boost::asio::const_buffer> buffers;
+  buffers.push_back (boost::asio::buffer (header));
+  buffers.push_back (boost::asio::buffer (payload));
+
+  boost::system::error_code err;
+  boost::asio::write (*socket_, buffers, err);
+  if (err) {
+    // The reader thread fails all pending requests
+    boost::system::error_code ignored;
+    socket_->shutdown (boost::asio::ip::tcp::socket::shutdown_both, ignored);
+  }
+  return pending->promise.get_future();
+}
+
+std::vector<std::string> RemoteIndex::batch (const std::vector<Json::Value> & requests) {
+  std::vector<std::future<std::string> > futures;
+  for (auto request = requests.begin() ; request != requests.end() ; ++request) {
+    futures.push_back (send (*request));
+  }
+
+  std::vector<std::string> res;
+  for (auto future = futures.begin() ; future != futures.end() ; ++future) {
+    res.push_back (future->get());
+  }
+  return res;
+}
+
+std::string RemoteIndex::root () {
+  {
+    std::lock_guard<std::mutex> lock (mutex_);
+    if (root_ != "") {
+      return root_;
+    }
+  }
+
+  Json::Value request;
+  request["command"] = "files";
+  request["hashes"]  = false;
+  const std::string response = send (request).get();
+
+  Json::Value json;
+  Json::Reader reader;
+  if (!reader.parse (response, json) || !json.isObject()) {
+    throw std::runtime_error ("Unexpected response from remote index "
+                              + address() + ": " + response);
+  }
+
+  std::lock_guard<std::mutex> lock (mutex_);
+  root_ = json["root"].asString();
+  return root_;
+}
+
+// Called with the mutex held
+void RemoteIndex::connect_ () {
+  if (socket_) {
+    return;
+  }
+
+  // The reader of the previous connection has nothing left to do
+  if (reader_.joinable()) {
+    reader_.join();
+  }
+
+  boost::asio::ip::tcp::resolver resolver (ioService_);
+  boost::asio::ip::tcp::resolver::query query (host_, port_);
+  std::shared_ptr<boost::asio::ip::tcp::socket> socket
+    (new boost::asio::ip::tcp::socket (ioService_));
+
+  boost::system::error_code err;
+  boost::asio::connect (*socket, resolver.resolve (query, err), err);
+  if (err) {
+    throw std::runtime_error ("Could not connect to remote index "
+                              + address() + ": " + err.message());
+  }
+  socket->set_option (boost::asio::ip::tcp::no_delay (true), err);
+
+  const std::string magic = std::string (Server::framedDeflateMagic) + "\n";
+  boost::asio::write (*socket, boost::asio::buffer (magic), err);
+  if (err) {
+    throw std::runtime_error ("Could not connect to remote index "
+                              + address() + ": " + err.message());
+  }
+
+  socket_ = socket;
+  root_.clear();
+  reader_ = std::thread (&RemoteIndex::read_, this, socket);
+}
+
+void RemoteIndex::read_ (std::shared_ptr<boost::asio::ip::tcp::socket> socket) {
+  std::string payload;
+  while (true) {
+    unsigned char header[Server::frameHeaderSize];
+    uint32_t size, id;
+
+    boost::system::error_code err;
+    boost::asio::read (*socket, boost::asio::buffer (header), err);
+    if (!err) {
+      Server::decodeFrameHeader (header, size, id);
+      payload.resize (size);
+      if (size > 0) {
+        boost::asio::read (*socket, boost::asio::buffer (&payload[0], size), err);
+      }
+    }
+    if (err) {
+      fail_ ("Connection to remote index " + address() + " lost: " + err.message());
+      return;
+    }
+
+    std::shared_ptr<Pending> pending;
+    {
+      std::lock_guard<std::mutex> lock (mutex_);
+      auto it = pending_.find (id);
+      if (it == pending_.end()) {
+        continue;
+      }
+      pending = it->second;
+
+      // An empty frame ends the response
+      if (size == 0) {
+        pending_.erase (it);
+      }
+    }
+
+    try {
+      if (size > 0) {
+        pending->output += pending->inflater.decompress (payload);
+      } else {
+        pending->promise.set_value (pending->output);
+      }
+    } catch (std::runtime_error & e) {
+      fail_ ("Invalid response from remote index " + address() + ": " + e.what());
+      return;
+    }
+  }
+}
+
+void RemoteIndex::fail_ (const std::string & message) {
+  std::cerr << message << std::endl;
+
+  std::lock_guard<std::mutex> lock (mutex_);
+  if (socket_) {
+    boost::system::error_code ignored;
+    socket_->shutdown (boost::asio::ip::tcp::socket::shutdown_both, ignored);
+    socket_.reset();
+  }
+
+  for (auto it = pending_.begin() ; it != pending_.end() ; ++it) {
+    it->second->promise.set_exception
+      (std::make_exception_ptr (std::runtime_error (message)));
+  }
+  pending_.clear();
+}
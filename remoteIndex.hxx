@@ -0,0 +1,95 @@
+#pragma once
+
+#include "util/deflate.hxx"
+#include "json/json.h"
+
+#include <boost/asio.hpp>
+#include <cstdint>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/** @brief Client of a clang-tags server listening on a TCP port
+ *
+ * Requests are sent over a single connection, using compressed framed
+ * messages (see Server). They can be sent from any thread without waiting for
+ * earlier responses: requests are pipelined on the connection, and responses
+ * are dispatched to their senders by a reader thread as they complete.
+ *
+ * The connection is opened when the first request is sent, and opened again
+ * after a failure.
+ */
+class RemoteIndex {
+public:
+  /** @brief Constructor
+   *
+   * @param host  host name or address of the remote server
+   * @param port  TCP port of the remote server
+   */
+  RemoteIndex (const std::string & host, const std::string & port);
+
+  /** @brief Destructor
+   *
+   * Pending requests fail.
+   */
+  ~RemoteIndex ();
+
+  /** @brief Send a request
+   *
+   * @param request  JSON request
+   *
+   * @return the future response (the whole output of the request)
+   *
+   * @throw std::runtime_error if the server can not be reached; a failure of
+   *        the connection while waiting is reported through the future
+   */
+  std::future<std::string> send (const Json::Value & request);
+
+  /** @brief Send several requests at once, and wait for all responses
+   *
+   * @param requests  JSON requests
+   *
+   * @return the responses, in the same order as requests
+   */
+  std::vector<std::string> batch (const std::vector<Json::Value> & requests);
+
+  /** @brief Root directory of the remote checkout
+   *
+   * @return the working directory of the remote server
+   */
+  std::string root ();
+
+  /** @brief Address of the remote server
+   *
+   * @return the "host:port" string of the server
+   */
+  std::string address () const {
+    return host_ + ":" + port_;
+  }
+
+private:
+  struct Pending {
+    std::promise<std::string> promise;
+    Inflater                  inflater;
+    std::string               output;
+  };
+
+  void connect_ ();
+  void read_ (std::shared_ptr<boost::asio::ip::tcp::socket> socket);
+  void fail_ (const std::string & message);
+
+  const std::string host_;
+  const std::string port_;
+
+  boost::asio::io_service                        ioService_;
+  std::shared_ptr<boost::asio::ip::tcp::socket>  socket_;
+  std::thread                                    reader_;
+  std::mutex                                     mutex_;
+  std::map<uint32_t, std::shared_ptr<Pending> >  pending_;
+  uint32_t                                       nextId_;
+  std::string                                    root_;
+};
@@ -707,6 +707,22 @@ namespace Request {
 
       if (verbose)
         std::cerr << "Processing request... ";
+
+      parseJson (json, cout);
+
+      if (verbose)
+        std::cerr << "done." << std::endl << std::endl;
+    }
+
+    /** @brief Run the command associated to an already parsed JSON request
+     *
+     * This is useful when requests are read asynchronously, and handled by
+     * another thread than the one which received them.
+     *
+     * @param json  JSON request
+     * @param cout  output stream where results are printed
+     */
+    void parseJson (const Json::Value & json, std::ostream & cout) {
       cout << "Server response:" << std::endl << std::flush;
 
       std::string command = json["command"].asString();
@@ -716,9 +732,6 @@ namespace Request {
       } else {
         cout << "Unknown command: `" << command << "'" << std::endl;
       }
-
-      if (verbose)
-        std::cerr << "done." << std::endl << std::endl;
     }
 
   private:
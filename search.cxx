@@ -0,0 +1,17 @@
+#include "application.hxx"
+#include "util/util.hxx"
+
+void Application::search (const SearchArgs & args, std::ostream & cout) {
+  Timer timer;
+  const std::vector<Storage::Definition> defs
+    = shards_.search (args.pattern, args.kinds, args.limit);
+
+  Json::FastWriter writer;
+  for (auto def = defs.begin() ; def != defs.end() ; ++def) {
+    cout << writer.write (def->json());
+  }
+
+  Metrics::global().time ("query.search", timer.get());
+  std::cerr << "search: " << defs.size() << " results in " << timer.get() << "s."
+            << std::endl;
+}
@@ -0,0 +1,510 @@
+#include "server.hxx"
+#include "util/deflate.hxx"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <streambuf>
+
+const char * const Server::framedMagic        = "clang-tags framed 1";
+const char * const Server::framedDeflateMagic = "clang-tags framed 1 deflate";
+
+// Frames larger than this are considered as protocol errors
+static const uint32_t maxFrameSize = 1 << 28;
+
+// Output queued for a client which does not read it: lane threads wait for
+// it to be written for this many seconds, after which the connection is
+// closed
+static const size_t       maxBacklog     = 16 << 20;
+static const unsigned int backlogTimeout = 30;
+
+// Whether the current thread runs the io_service (which must never wait for
+// output to be written, since it is the one writing it)
+static thread_local bool ioThread = false;
+
+static void encode (uint32_t x, unsigned char * p) {
+  p[0] = x >> 24;
+  p[1] = x >> 16;
+  p[2] = x >> 8;
+  p[3] = x;
+}
+
+static uint32_t decode (const unsigned char * p) {
+  return (uint32_t (p[0]) << 24) | (uint32_t (p[1]) << 16)
+    |    (uint32_t (p[2]) << 8)  |  uint32_t (p[3]);
+}
+
+void Server::encodeFrameHeader (uint32_t size, uint32_t id, unsigned char * header) {
+  encode (size, header);
+  encode (id, header + 4);
+}
+
+void Server::decodeFrameHeader (const unsigned char * header,
+                                uint32_t & size, uint32_t & id) {
+  size = decode (header);
+  id   = decode (header + 4);
+}
+
+// Call f() once the input buffer holds at least size bytes
+template <typename F>
+static void readAtLeast (boost::asio::io_service & ioService,
+                         boost::asio::generic::stream_protocol::socket & socket,
+                         boost::asio::streambuf & input,
+                         size_t size, F f) {
+  if (input.size() >= size) {
+    // Don't recurse through all frames which were received at once
+    ioService.post (f);
+    return;
+  }
+
+  boost::asio::async_read (socket, input,
+                           boost::asio::transfer_at_least (size - input.size()),
+                           [f] (const boost::system::error_code & err, size_t) {
+                             if (!err) {
+                               f();
+                             }
+                           });
+}
+
+// Connection to a client.
+//
+// Requests are read asynchronously by the main thread, after which they are
+// handed to lane threads. Output produced by lane threads is queued, and
+// written asynchronously by the main thread (through a strand, so that writes
+// never overlap), as soon as it is flushed. Lane threads wait while too much
+// output is queued; if the client does not read it in time, or disconnects,
+// the connection is closed and the rest of the output is silently discarded
+// so that requests can complete.
+//
+// Pending writes keep the connection alive: the socket is closed once the
+// whole output has been written.
+//
+// For one-request connections, the connection itself is the output stream
+// buffer of the response (which must be flushed before being released).
+// Framed connections are written to through FramedResponse objects.
+class Server::Connection : public std::streambuf,
+                           public std::enable_shared_from_this<Connection> {
+public:
+  Connection (boost::asio::io_service & ioService, bool remote)
+    : socket (ioService),
+      remote (remote),
+      compressed (false),
+      strand_ (ioService),
+      queued_ (0),
+      writing_ (false),
+      failed_ (false)
+  { }
+
+  boost::asio::generic::stream_protocol::socket socket;
+  boost::asio::streambuf                        input;
+  const bool                                    remote;      // TCP client
+  bool                                          compressed;  // deflated frames
+
+  // Send a frame; this can be called from any thread
+  void writeFrame (uint32_t id, const std::string & payload) {
+    unsigned char header[frameHeaderSize];
+    encodeFrameHeader (payload.size(), id, header);
+
+    std::string frame (reinterpret_cast<const char *> (header), frameHeaderSize);
+    frame += payload;
+    send_ (std::move (frame));
+  }
+
+protected:
+  int overflow (int c) {
+    if (c != traits_type::eof()) {
+      output_.push_back (traits_type::to_char_type (c));
+      if (output_.size() >= 4096) {
+        sync();
+      }
+    }
+    return traits_type::not_eof (c);
+  }
+
+  int sync () {
+    if (!output_.empty()) {
+      send_ (std::move (output_));
+    }
+    output_.clear();
+    return 0;
+  }
+
+private:
+  // Queue data to be written by the main thread
+  void send_ (std::string data) {
+    std::unique_lock<std::mutex> lock (mutex_);
+    const bool drained = ioThread || drained_.wait_for
+      (lock, std::chrono::seconds (backlogTimeout),
+       [this] () { return failed_ || queued_ < maxBacklog; });
+    if (!drained) {
+      std::cerr << "Client does not read its output: closing the connection"
+                << std::endl;
+      failed_ = true;
+      ConnectionPtr self = shared_from_this();
+      strand_.post ([self] () {
+          boost::system::error_code ignored;
+          self->socket.close (ignored);
+        });
+    }
+    if (failed_) {
+      return;
+    }
+
+    queued_ += data.size();
+    queue_.push_back (std::move (data));
+    if (!writing_) {
+      writing_ = true;
+      ConnectionPtr self = shared_from_this();
+      strand_.post ([self] () { self->write_(); });
+    }
+  }
+
+  // Write the first queued buffer (in the strand)
+  void write_ () {
+    const std::string * front;
+    {
+      std::lock_guard<std::mutex> lock (mutex_);
+      front = &queue_.front();
+    }
+
+    // References to elements of a deque survive insertions at its end
+    ConnectionPtr self = shared_from_this();
+    boost::asio::async_write
+      (socket, boost::asio::buffer (*front),
+       strand_.wrap ([self] (const boost::system::error_code & err, size_t) {
+           self->written_ (err);
+         }));
+  }
+
+  void written_ (const boost::system::error_code & err) {
+    {
+      std::lock_guard<std::mutex> lock (mutex_);
+      queued_ -= queue_.front().size();
+      queue_.pop_front();
+      if (err) {
+        failed_ = true;
+        queue_.clear();
+        queued_ = 0;
+      }
+      drained_.notify_all();
+
+      if (queue_.empty()) {
+        writing_ = false;
+        return;
+      }
+    }
+    write_();
+  }
+
+  std::string                        output_;   // not flushed yet
+  boost::asio::io_service::strand    strand_;
+  std::deque<std::string>            queue_;    // flushed, not written yet
+  size_t                             queued_;   // bytes in queue_
+  bool                               writing_;
+  bool                               failed_;
+  std::mutex                         mutex_;
+  std::condition_variable            drained_;
+};
+
+
+// Output of a request received on a framed connection
+class Server::FramedResponse : public std::streambuf {
+public:
+  FramedResponse (ConnectionPtr connection, uint32_t id)
+    : connection_ (connection),
+      id_ (id),
+      deflater_ (connection->compressed ? new Deflater : NULL)
+  { }
+
+  // Send the rest of the output, then the empty frame ending the response
+  ~FramedResponse () {
+    if (deflater_) {
+      connection_->writeFrame (id_, deflater_->compress (output_, Z_FINISH));
+      output_.clear();
+    }
+    sync();
+    connection_->writeFrame (id_, "");
+  }
+
+protected:
+  int overflow (int c) {
+    if (c != traits_type::eof()) {
+      output_.push_back (traits_type::to_char_type (c));
+      if (output_.size() >= 4096) {
+        sync();
+      }
+    }
+    return traits_type::not_eof (c);
+  }
+
+  int sync () {
+    if (!output_.empty()) {
+      connection_->writeFrame (id_, deflater_
+                               ? deflater_->compress (output_, Z_SYNC_FLUSH)
+                               : output_);
+    }
+    output_.clear();
+    return 0;
+  }
+
+private:
+  ConnectionPtr             connection_;
+  uint32_t                  id_;
+  std::string               output_;
+  std::unique_ptr<Deflater> deflater_;
+};
+
+
+// Output of a request issued by the server itself, written line by line to
+// the server log
+class Server::LogResponse : public std::streambuf {
+public:
+  LogResponse (std::function<void ()> done)
+    : done_ (done)
+  { }
+
+  ~LogResponse () {
+    sync();
+    if (done_) {
+      done_();
+    }
+  }
+
+protected:
+  int overflow (int c) {
+    if (c != traits_type::eof()) {
+      output_.push_back (traits_type::to_char_type (c));
+      if (c == '\n') {
+        sync();
+      }
+    }
+    return traits_type::not_eof (c);
+  }
+
+  int sync () {
+    if (!output_.empty()) {
+      std::cerr << output_ << std::flush;
+    }
+    output_.clear();
+    return 0;
+  }
+
+private:
+  std::function<void ()> done_;
+  std::string            output_;
+};
+
+
+Server::Server (const std::string & socketPath,
+                HandlerFactory factory,
+                Scheduler scheduler,
+                unsigned int queryThreads)
+  : acceptor_ (ioService_,
+               Acceptor::endpoint_type
+               (boost::asio::local::stream_protocol::endpoint (socketPath))),
+    scheduler_ (scheduler)
+{
+  // Handlers are created in this order, so that the background lane (which
+  // may need to write to the database) gets created first
+  std::vector<Lane> lanes = {Background, Interactive};
+  for (unsigned int i = 0 ; i < std::max (queryThreads, 1u) ; ++i) {
+    lanes.push_back (Query);
+  }
+
+  auto lane = lanes.begin();
+  auto end  = lanes.end();
+  for ( ; lane != end ; ++lane) {
+    threads_.push_back (std::thread (&Server::lane_, this,
+                                     std::ref (queues_[*lane]),
+                                     factory (*lane)));
+  }
+
+  accept_ (acceptor_, false);
+}
+
+Server::~Server () {
+  for (unsigned int i = 0 ; i < 3 ; ++i) {
+    queues_[i].close();
+  }
+
+  auto thread = threads_.begin();
+  auto end    = threads_.end();
+  for ( ; thread != end ; ++thread) {
+    thread->join();
+  }
+}
+
+void Server::run () {
+  ioThread = true;
+  ioService_.run();
+}
+
+void Server::stop () {
+  ioService_.stop();
+}
+
+void Server::listen (const std::string & host, const std::string & port,
+                     Filter filter) {
+  remoteFilter_ = filter;
+
+  boost::asio::ip::tcp::resolver resolver (ioService_);
+  boost::asio::ip::tcp::resolver::query query
+    (host, port, boost::asio::ip::tcp::resolver::query::passive);
+  const boost::asio::ip::tcp::endpoint endpoint = *resolver.resolve (query);
+
+  remoteAcceptors_.push_back (std::unique_ptr<Acceptor>
+                              (new Acceptor (ioService_,
+                                             Acceptor::endpoint_type (endpoint))));
+  accept_ (*remoteAcceptors_.back(), true);
+  std::cerr << "Listening on " << endpoint << std::endl;
+}
+
+void Server::post (const Json::Value & request, std::function<void ()> done) {
+  std::cerr << "Scheduling server request:" << std::endl
+            << request.toStyledString() << std::endl;
+
+  Task task;
+  task.request = request;
+  task.output.reset (new LogResponse (done));
+  queues_[scheduler_ (task.request)].push (std::move (task));
+}
+
+void Server::accept_ (Acceptor & acceptor, bool remote) {
+  ConnectionPtr connection (new Connection (ioService_, remote));
+  acceptor.async_accept (
+    connection->socket,
+    [this, &acceptor, remote, connection] (const boost::system::error_code & err) {
+      if (!err) {
+        if (remote) {
+          // Frames are sent as soon as they are flushed
+          boost::system::error_code ignored;
+          connection->socket.set_option (boost::asio::ip::tcp::no_delay (true),
+                                         ignored);
+        }
+        read_ (connection);
+      }
+      accept_ (acceptor, remote);
+    });
+}
+
+void Server::read_ (ConnectionPtr connection) {
+  // The first line tells framed connections apart
+  boost::asio::async_read_until (
+    connection->socket, connection->input, "\n",
+    [this, connection] (const boost::system::error_code & err, size_t size) {
+      if (err) {
+        return;
+      }
+
+      const char * data
+        = boost::asio::buffer_cast<const char *> (connection->input.data());
+      const std::string line (data, size);
+      if (line == std::string (framedMagic) + "\n"
+          || line == std::string (framedDeflateMagic) + "\n") {
+        connection->compressed = line == std::string (framedDeflateMagic) + "\n";
+        connection->input.consume (size);
+        readFrame_ (connection);
+        return;
+      }
+
+      // JSON requests are terminated by a blank line
+      boost::asio::async_read_until (
+        connection->socket, connection->input, "\n\n",
+        [this, connection] (const boost::system::error_code & err, size_t) {
+          if (err) {
+            return;
+          }
+
+          std::istream input (&connection->input);
+          Task task;
+          task.output = connection;
+
+          Json::Reader reader;
+          if (!reader.parse (input, task.request)) {
+            std::ostream cout (connection.get());
+            cout << "Invalid request:" << std::endl
+                 << reader.getFormattedErrorMessages() << std::endl;
+            return;
+          }
+
+          schedule_ (task, *connection);
+        });
+    });
+}
+
+void Server::readFrame_ (ConnectionPtr connection) {
+  readAtLeast (ioService_, connection->socket, connection->input, frameHeaderSize,
+               [this, connection] () {
+    const unsigned char * header
+      = boost::asio::buffer_cast<const unsigned char *> (connection->input.data());
+    uint32_t size, id;
+    decodeFrameHeader (header, size, id);
+    if (size > maxFrameSize) {
+      std::cerr << "Invalid frame size: " << size << std::endl;
+      return;
+    }
+
+    readAtLeast (ioService_, connection->socket, connection->input,
+                 frameHeaderSize + size,
+                 [this, connection, size, id] () {
+      const char * payload
+        = boost::asio::buffer_cast<const char *> (connection->input.data())
+        + frameHeaderSize;
+
+      Task task;
+      task.output.reset (new FramedResponse (connection, id));
+
+      Json::Reader reader;
+      if (reader.parse (payload, payload + size, task.request)) {
+        schedule_ (task, *connection);
+      } else {
+        std::ostream cout (task.output.get());
+        cout << "Invalid request:" << std::endl
+             << reader.getFormattedErrorMessages() << std::endl;
+      }
+
+      // Requests are read (and handled) while previous ones are being handled
+      connection->input.consume (frameHeaderSize + size);
+      readFrame_ (connection);
+    });
+  });
+}
+
+void Server::schedule_ (Task & task, const Connection & connection) {
+  std::cerr << "Receiving " << (connection.remote ? "remote " : "")
+            << "client request:" << std::endl
+            << task.request.toStyledString() << std::endl;
+
+  if (connection.remote && !(remoteFilter_ && remoteFilter_ (task.request))) {
+    std::ostream cout (task.output.get());
+    cout << "Error: request not allowed over TCP: `"
+         << task.request["command"].asString() << "'" << std::endl;
+    return;
+  }
+
+  queues_[scheduler_ (task.request)].push (std::move (task));
+}
+
+void Server::lane_ (Queue<Task> & queue, Handler handler) {
+  Task task;
+  while (queue.pop (task)) {
+    {
+      std::ostream cout (task.output.get());
+      try {
+        handler (task.request, cout);
+      } catch (std::exception & e) {
+        // Report the failure to the client, but keep serving requests
+        cout << "Error: " << e.what() << std::endl;
+        std::cerr << "Error while handling request: " << e.what() << std::endl;
+      }
+      cout << std::flush;
+    }
+
+    // Close the connection (or send the final frame) to signal the end of the
+    // response
+    task.output.reset();
+  }
+}
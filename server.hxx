@@ -0,0 +1,183 @@
+#pragma once
+
+#include "util/queue.hxx"
+#include "json/json.h"
+
+#include <boost/asio.hpp>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+/** @brief Asynchronous clang-tags server
+ *
+ * Connections are accepted and requests are read asynchronously by the main
+ * thread. Each request is then scheduled in one of three lanes, each of which
+ * has its own set of threads:
+ *
+ * - @c Interactive: a dedicated thread for latency-sensitive requests
+ *   (e.g. code completion), which never wait behind other requests;
+ * - @c Query: a pool of threads serving read-only requests concurrently;
+ * - @c Background: a single thread running long jobs (e.g. indexing) one after
+ *   the other.
+ *
+ * Each thread owns a request handler, created by the main thread when the
+ * server is constructed (in lane order: background first). Results are sent
+ * back to the client as they are produced.
+ *
+ * Clients can talk to the server in two ways:
+ *
+ * - one request per connection: the client sends a JSON request terminated by
+ *   a blank line, and the connection is closed once the request has been
+ *   handled;
+ *
+ * - framed: the client first sends the #framedMagic line, after which the
+ *   connection stays open and carries any number of requests, in frames made
+ *   of a 4-byte payload length, a 4-byte request ID (both big-endian) and the
+ *   payload. Request payloads are compact JSON requests. Responses are sent
+ *   back in frames bearing the ID of the request, and end with an empty
+ *   frame. Requests are handled concurrently, so that frames belonging to
+ *   different responses may be interleaved.
+ *
+ * Clients sending the #framedDeflateMagic line instead get framed responses
+ * whose payloads are compressed: the payloads of all frames of a response
+ * form a single zlib stream, flushed at the end of each frame.
+ *
+ * Besides the UNIX domain socket, the server can listen on a TCP port (see
+ * listen()), so that an index can be served to other machines. Only requests
+ * accepted by a filter are handled for TCP clients.
+ */
+class Server {
+public:
+  enum Lane {
+    Interactive,
+    Query,
+    Background
+  };
+
+  /** @brief First line sent by clients using framed connections */
+  static const char * const framedMagic;
+
+  /** @brief First line sent by clients using compressed framed connections */
+  static const char * const framedDeflateMagic;
+
+  /** @brief Size of frame headers */
+  static const size_t frameHeaderSize = 8;
+
+  /** @brief Write a frame header
+   *
+   * @param size    payload size
+   * @param id      request ID
+   * @param header  buffer of #frameHeaderSize bytes
+   */
+  static void encodeFrameHeader (uint32_t size, uint32_t id, unsigned char * header);
+
+  /** @brief Read a frame header
+   *
+   * @param header  buffer of #frameHeaderSize bytes
+   * @param size    payload size
+   * @param id      request ID
+   */
+  static void decodeFrameHeader (const unsigned char * header,
+                                 uint32_t & size, uint32_t & id);
+
+  /** @brief Function handling a request
+   *
+   * A handler is only ever called from the thread it was created for.
+   */
+  typedef std::function<void (const Json::Value & request,
+                              std::ostream & cout)>        Handler;
+
+  /** @brief Function creating the request handler of a lane thread */
+  typedef std::function<Handler (Lane lane)>               HandlerFactory;
+
+  /** @brief Function choosing the lane where a request will be handled */
+  typedef std::function<Lane (const Json::Value & request)> Scheduler;
+
+  /** @brief Function telling whether a request is accepted */
+  typedef std::function<bool (const Json::Value & request)> Filter;
+
+  /** @brief Constructor
+   *
+   * Start listening on the socket and create the lane threads.
+   *
+   * @param socketPath    path to the UNIX domain socket
+   * @param factory       request handler factory
+   * @param scheduler     request scheduler
+   * @param queryThreads  number of threads in the @c Query lane
+   */
+  Server (const std::string & socketPath,
+          HandlerFactory factory,
+          Scheduler scheduler,
+          unsigned int queryThreads);
+
+  /** @brief Destructor
+   *
+   * Requests already scheduled are handled before all threads are joined.
+   */
+  ~Server ();
+
+  /** @brief Also accept connections on a TCP port
+   *
+   * This method should be called before run().
+   *
+   * @param host    address of the interface to listen on
+   * @param port    TCP port
+   * @param filter  requests accepted from TCP clients (other requests are
+   *                answered with an error)
+   */
+  void listen (const std::string & host, const std::string & port, Filter filter);
+
+  /** @brief Schedule a request issued by the server itself
+   *
+   * The request is handled like client requests; its output goes to the
+   * server log.
+   *
+   * This method can be called from any thread.
+   *
+   * @param request  JSON request
+   * @param done     called (from the lane thread) once the request has been
+   *                 handled
+   */
+  void post (const Json::Value & request, std::function<void ()> done);
+
+  /** @brief Serve requests until stop() is called */
+  void run ();
+
+  /** @brief Stop accepting requests
+   *
+   * This method can be called from any thread.
+   */
+  void stop ();
+
+private:
+  class Connection;
+  class FramedResponse;
+  class LogResponse;
+  typedef std::shared_ptr<Connection> ConnectionPtr;
+
+  struct Task {
+    Json::Value                     request;
+    std::shared_ptr<std::streambuf> output;  // closed after the response
+  };
+
+  typedef boost::asio::basic_socket_acceptor<boost::asio::generic::stream_protocol>
+                                                Acceptor;
+
+  void accept_ (Acceptor & acceptor, bool remote);
+  void read_ (ConnectionPtr connection);
+  void readFrame_ (ConnectionPtr connection);
+  void schedule_ (Task & task, const Connection & connection);
+  void lane_ (Queue<Task> & queue, Handler handler);
+
+  boost::asio::io_service                       ioService_;
+  Acceptor                                      acceptor_;
+  std::vector<std::unique_ptr<Acceptor> >       remoteAcceptors_;
+  Filter                                        remoteFilter_;
+  Scheduler                                     scheduler_;
+  Queue<Task>                                   queues_[3];
+  std::vector<std::thread>                      threads_;
+};
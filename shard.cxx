@@ -0,0 +1,59 @@
+#include "application.hxx"
+#include <algorithm>
+
+void Application::shard (ShardArgs & args, std::ostream & cout) {
+  std::vector<Shards::Shard> shards = Shards::list (storage_);
+
+  if (args.action == "add" || args.action == "remove") {
+    Shards::Shard shard;
+    shard.prebuilt = args.prebuilt;
+    try {
+      shard.path = Shards::databasePath (args.path);
+    } catch (std::runtime_error &) {
+      // Shards which do not exist anymore can still be detached
+      if (args.action == "add") {
+        throw;
+      }
+      shard.path = args.path;
+    }
+    auto found = std::find (shards.begin(), shards.end(), shard);
+
+    if (args.action == "add") {
+      if (shard.path == Shards::databasePath (storage_.path())) {
+        throw std::runtime_error ("Can not attach the index to itself");
+      }
+      // Fail early, rather than skipping the shard in all later queries
+      Shards::open (shard);
+
+      if (found != shards.end()) {
+        *found = shard;
+      } else {
+        shards.push_back (shard);
+      }
+      cout << "Attached shard: " << shard.path << std::endl;
+    } else {
+      if (found == shards.end()) {
+        throw std::runtime_error ("Not an attached shard: `" + shard.path + "'");
+      }
+      shards.erase (found);
+      cout << "Detached shard: " << shard.path << std::endl;
+    }
+
+    Shards::store (storage_, shards);
+    return;
+  }
+
+  if (args.action != "list") {
+    throw std::runtime_error ("Unknown shard action: `" + args.action + "'");
+  }
+
+  for (auto shard = shards.begin() ; shard != shards.end() ; ++shard) {
+    cout << shard->path << (shard->prebuilt ? " (prebuilt)" : "");
+    try {
+      Shards::open (*shard);
+    } catch (std::runtime_error & e) {
+      cout << ": unavailable (" << e.what() << ")";
+    }
+    cout << std::endl;
+  }
+}
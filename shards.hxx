@@ -0,0 +1,353 @@
+#pragma once
+
+#include "storage.hxx"
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <algorithm>
+#include <future>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <tuple>
+#include <vector>
+
+/** @brief Federated queries over the index and the shards attached to it
+ *
+ * A shard is another index database, e.g. the index of a subtree maintained
+ * by its own server, or a prebuilt index of a vendored library or of system
+ * headers which is shared across machines. Shards are attached to the main
+ * index (the list is stored in its @c shards option), and only ever read.
+ *
+ * findDefinition(), grep() and search() queries are run in parallel against the main
+ * index and all shards, and their results are merged. Symbols referenced in
+ * one database are looked up in all of them, so that definitions are found
+ * even when they were indexed in another shard.
+ *
+ * The list of shards is read again before each query, so that shards attached
+ * through another connection are used as soon as they are stored.
+ */
+class Shards {
+public:
+  /** @brief Attached shard
+   */
+  struct Shard {
+    std::string path;      ///< absolute path of the database file
+    bool        prebuilt;  ///< whether the database never changes
+
+    bool operator== (const Shard & other) const {
+      return path == other.path;
+    }
+  };
+
+  /** @brief Constructor
+   *
+   * @param storage  main index database
+   */
+  Shards (Storage & storage)
+    : storage_ (storage)
+  { }
+
+  /** @brief Get the shards attached to an index
+   *
+   * @param storage  main index database
+   *
+   * @return the attached shards, in the order in which they are queried
+   */
+  static std::vector<Shard> list (Storage & storage) {
+    std::vector<std::string> entries;
+    try {
+      entries = storage.getOption ("shards", Storage::Vector());
+    } catch (std::runtime_error &) {
+      // No shard was ever attached
+    }
+
+    std::vector<Shard> res;
+    for (auto entry = entries.begin() ; entry != entries.end() ; ++entry) {
+      const size_t colon = entry->find (':');
+      if (colon == std::string::npos) {
+        continue;
+      }
+      Shard shard;
+      shard.prebuilt = entry->substr (0, colon) == "prebuilt";
+      shard.path     = entry->substr (colon + 1);
+      res.push_back (shard);
+    }
+    return res;
+  }
+
+  /** @brief Store the list of shards attached to an index
+   *
+   * @param storage  main index database (opened in read-write mode)
+   * @param shards   attached shards
+   */
+  static void store (Storage & storage, const std::vector<Shard> & shards) {
+    std::vector<std::string> entries;
+    for (auto shard = shards.begin() ; shard != shards.end() ; ++shard) {
+      entries.push_back ((shard->prebuilt ? "prebuilt:" : "live:") + shard->path);
+    }
+    storage.setOption ("shards", entries);
+  }
+
+  /** @brief Absolute path of a shard database
+   *
+   * @param path  database file, or directory containing a @c .ct.sqlite file
+   *
+   * @return the absolute path of the database file
+   */
+  static std::string databasePath (const std::string & path) {
+    char * real = realpath (path.c_str(), NULL);
+    if (real == NULL) {
+      throw std::runtime_error ("No such shard: `" + path + "'");
+    }
+    std::string res (real);
+    free (real);
+
+    struct stat fileStat;
+    if (stat (res.c_str(), &fileStat) == 0 && S_ISDIR (fileStat.st_mode)) {
+      res += "/.ct.sqlite";
+    }
+    return res;
+  }
+
+  /** @brief Open a shard database
+   *
+   * @param shard  attached shard
+   *
+   * @return a read-only connection to the shard database
+   *
+   * @throw std::runtime_error if the database can not be opened, or uses
+   *        another schema version
+   */
+  static std::unique_ptr<Storage> open (const Shard & shard) {
+    std::unique_ptr<Storage> storage
+      (new Storage (shard.prebuilt ? Storage::Prebuilt : Storage::ReadOnly,
+                    Storage::Pragmas(), shard.path));
+    storage->checkSchema();
+    return storage;
+  }
+
+  /** @brief Find the definitions of the symbols referenced at a location
+   *
+   * @param fileName  source file name
+   * @param offset    offset in the source file
+   *
+   * @return references and their definitions, most specific first
+   */
+  std::vector<Storage::RefDef> findDefinition (const std::string & fileName,
+                                               int offset) {
+    refresh_();
+    if (shards_.empty()) {
+      return storage_.findDefinition (fileName, offset);
+    }
+
+    // References at this location, from the database(s) which indexed the file
+    std::vector<Storage::RefDef> refs;
+    {
+      auto results = fanOut_ ([&] (Storage & storage) {
+          return storage.findReferences (fileName, offset);
+        });
+      std::set<std::tuple<int, int, std::string> > seen;
+      for (auto result = results.begin() ; result != results.end() ; ++result) {
+        for (auto ref = result->begin() ; ref != result->end() ; ++ref) {
+          if (seen.insert (std::make_tuple (ref->ref.offset1, ref->ref.offset2,
+                                            ref->def.usr)).second) {
+            refs.push_back (*ref);
+          }
+        }
+      }
+      std::stable_sort (refs.begin(), refs.end(),
+                        [] (const Storage::RefDef & a, const Storage::RefDef & b) {
+          return a.ref.offset2 - a.ref.offset1 < b.ref.offset2 - b.ref.offset1;
+        });
+    }
+
+    // Declarations of the referenced symbols, from all databases
+    std::set<std::string> usrs;
+    for (auto ref = refs.begin() ; ref != refs.end() ; ++ref) {
+      usrs.insert (ref->def.usr);
+    }
+    typedef std::map<std::string, std::vector<Storage::Definition> > Declarations;
+    auto results = fanOut_ ([&] (Storage & storage) {
+        Declarations res;
+        for (auto usr = usrs.begin() ; usr != usrs.end() ; ++usr) {
+          res[*usr] = storage.findDeclarations (*usr);
+        }
+        return res;
+      });
+
+    std::vector<Storage::RefDef> ret;
+    for (auto ref = refs.begin() ; ref != refs.end() ; ++ref) {
+      std::set<std::tuple<std::string, int, int> > seen;
+      for (auto result = results.begin() ; result != results.end() ; ++result) {
+        const std::vector<Storage::Definition> & defs = (*result)[ref->def.usr];
+        for (auto def = defs.begin() ; def != defs.end() ; ++def) {
+          if (seen.insert (std::make_tuple (def->file, def->line1, def->col1)).second) {
+            Storage::RefDef refDef;
+            refDef.ref = ref->ref;
+            refDef.def = *def;
+            ret.push_back (refDef);
+          }
+        }
+      }
+    }
+    return ret;
+  }
+
+  /** @brief Find all references to a symbol
+   *
+   * References are deduplicated across databases (when shards overlap), then
+   * paged. Without shards, they are streamed from the main index.
+   *
+   * @param usr         USR of the symbol
+   * @param filePrefix  only consider references in files starting with this
+   * @param offset      number of references to skip
+   * @param limit       maximum number of references (0 for no limit)
+   * @param f           called as @c f(const Storage::Reference&) for each
+   *                    reference
+   */
+  template <typename F>
+  void grep (const std::string & usr,
+             const std::string & filePrefix,
+             unsigned int offset,
+             unsigned int limit,
+             F f) {
+    refresh_();
+    if (shards_.empty()) {
+      storage_.grep (usr, filePrefix, offset, limit, f);
+      return;
+    }
+
+    // Each database returns at most enough references to fill the page
+    const unsigned int wanted = limit > 0 ? offset + limit : 0;
+    auto results = fanOut_ ([&] (Storage & storage) {
+        std::vector<Storage::Reference> refs;
+        storage.grep (usr, filePrefix, 0, wanted, [&refs] (const Storage::Reference & ref) {
+            refs.push_back (ref);
+          });
+        return refs;
+      });
+
+    std::set<std::tuple<std::string, int, int> > seen;
+    unsigned int skipped = 0;
+    unsigned int count = 0;
+    for (auto result = results.begin() ; result != results.end() ; ++result) {
+      for (auto ref = result->begin() ; ref != result->end() ; ++ref) {
+        if (!seen.insert (std::make_tuple (ref->file, ref->offset1, ref->offset2)).second) {
+          continue;
+        }
+        if (skipped < offset) {
+          ++skipped;
+          continue;
+        }
+        if (limit > 0 && count >= limit) {
+          return;
+        }
+        ++count;
+        f (*ref);
+      }
+    }
+  }
+
+  /** @brief Find declarations by name
+   *
+   * Results of all databases are merged, then ranked again (see
+   * Storage::search()).
+   *
+   * @param pattern  glob pattern matched against symbol names
+   * @param kinds    kinds of declarations (all if empty)
+   * @param limit    maximum number of declarations (0 for no limit)
+   *
+   * @return matching declarations, best matches first
+   */
+  std::vector<Storage::Definition> search (const std::string & pattern,
+                                           const std::vector<std::string> & kinds,
+                                           unsigned int limit) {
+    refresh_();
+    if (shards_.empty()) {
+      return storage_.search (pattern, kinds, limit);
+    }
+
+    auto results = fanOut_ ([&] (Storage & storage) {
+        return storage.search (pattern, kinds, limit);
+      });
+
+    std::vector<Storage::Definition> ret;
+    std::set<std::tuple<std::string, int, int> > seen;
+    for (auto result = results.begin() ; result != results.end() ; ++result) {
+      for (auto def = result->begin() ; def != result->end() ; ++def) {
+        if (seen.insert (std::make_tuple (def->file, def->line1, def->col1)).second) {
+          ret.push_back (*def);
+        }
+      }
+    }
+
+    const Storage::NamePattern name (pattern);
+    std::sort (ret.begin(), ret.end(),
+               [&name] (const Storage::Definition & a, const Storage::Definition & b) {
+                 return std::make_tuple (name.rank (a.spelling), a.file, a.line1)
+                   < std::make_tuple (name.rank (b.spelling), b.file, b.line1);
+               });
+
+    if (limit > 0 && ret.size() > limit) {
+      ret.resize (limit);
+    }
+    return ret;
+  }
+
+private:
+  // Open shards attached since the last query, and close detached ones.
+  // Shards which can not be opened are skipped, so that they do not prevent
+  // querying the others.
+  void refresh_ () {
+    std::string config;
+    try {
+      config = storage_.getOption ("shards");
+    } catch (std::runtime_error &) {
+      // No shard was ever attached
+    }
+    if (config == config_) {
+      return;
+    }
+    config_ = config;
+    shards_.clear();
+
+    const std::vector<Shard> shards = list (storage_);
+    for (auto shard = shards.begin() ; shard != shards.end() ; ++shard) {
+      try {
+        shards_.push_back (std::shared_ptr<Storage> (open (*shard)));
+      } catch (std::runtime_error & e) {
+        std::cerr << "Skipping shard `" << shard->path << "': " << e.what()
+                  << std::endl;
+      }
+    }
+  }
+
+  // Run a query against the main index (in this thread) and each shard (in its
+  // own thread). Results are returned in the same order as databases.
+  template <typename Query>
+  auto fanOut_ (Query query) -> std::vector<decltype (query (*(Storage*)0))> {
+    typedef decltype (query (*(Storage*)0)) Result;
+
+    std::vector<std::future<Result> > futures;
+    for (auto shard = shards_.begin() ; shard != shards_.end() ; ++shard) {
+      Storage & storage = **shard;
+      futures.push_back (std::async (std::launch::async, [&query, &storage] {
+            return query (storage);
+          }));
+    }
+
+    std::vector<Result> res;
+    res.push_back (query (storage_));
+    for (auto future = futures.begin() ; future != futures.end() ; ++future) {
+      res.push_back (future->get());
+    }
+    return res;
+  }
+
+  Storage &                              storage_;
+  std::string                            config_;
+  std::vector<std::shared_ptr<Storage> > shards_;
+};
@@ -0,0 +1,730 @@
+#pragma once
+
+#include "symbolTable.hxx"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/** @brief Read-optimized, immutable copy of the tags index
+ *
+ * A snapshot is a binary file, written after indexing runs next to the
+ * database, and memory-mapped by servers to answer queries without any
+ * parsing: opening one only takes a few system calls, and the pages it
+ * needs are brought in (and shared by all readers) by the operating system.
+ *
+ * The file is made of fixed-size records, which are used in place:
+ * - the tags of each file, sorted by starting offset and delta-encoded as
+ *   variable-length integers, with a checkpoint every #blockSize tags from
+ *   which decoding can start;
+ * - the files, and their order by name (for lookups by name);
+ * - the symbols (USR and spelling), and their order by USR;
+ * - for each symbol, the postings of its references and of its declarations
+ *   (file, index of the tag in the file);
+ * - the kinds, and a blob of null-terminated strings.
+ *
+ * Queries return the same results as SymbolTable.
+ *
+ * The database remains the reference: each snapshot bears an ID, which is
+ * also stored in the database when the snapshot is written; readers only use
+ * snapshots whose ID matches (see Storage).
+ */
+class Snapshot {
+public:
+  typedef SymbolTable::Tag      Tag;
+  typedef SymbolTable::Location Location;
+
+  /** @brief Number of tags in consecutive runs sharing a checkpoint */
+  static const uint32_t blockSize = 32;
+
+private:
+  // On-disk records. Integers are stored in the byte order of the machine
+  // which wrote the snapshot; snapshots whose byte order marker does not read
+  // back as byteOrder_ come from another machine, and are not used. Strings
+  // are offsets in the strings blob.
+  struct Header {
+    char     magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    char     id[48];
+    uint64_t size;      // of the whole file
+    uint64_t data;      // section offsets, and record counts
+    uint64_t checkpoints;
+    uint64_t checkpointCount;
+    uint64_t files;
+    uint64_t fileCount;
+    uint64_t fileOrder;
+    uint64_t symbols;
+    uint64_t symbolCount;
+    uint64_t symbolOrder;
+    uint64_t refs;
+    uint64_t refCount;
+    uint64_t defs;
+    uint64_t defCount;
+    uint64_t kinds;
+    uint64_t kindCount;
+    uint64_t strings;
+    uint64_t stringsSize;
+  };
+
+  struct FileRecord {
+    uint32_t name;
+    uint32_t entryCount;
+    uint32_t maxSpan;          // maximum value of (offset2 - offset1)
+    uint32_t checkpointBegin;  // index of the first checkpoint of the file
+    uint32_t reserved;
+    uint32_t dataSize;         // size of the encoded tags
+    uint64_t dataOffset;       // in the data section
+  };
+
+  // Decoder state before the first tag of a block
+  struct Checkpoint {
+    uint32_t dataOffset;  // relative to the tags of the file
+    uint32_t offset1;     // of the previous tag
+    uint32_t line1;       // of the previous tag
+  };
+
+  struct SymbolRecord {
+    uint32_t usr;
+    uint32_t spelling;
+    uint32_t refBegin;
+    uint32_t refCount;
+    uint32_t defBegin;
+    uint32_t defCount;
+  };
+
+  struct Posting {
+    uint32_t file;
+    uint32_t entry;  // index of the tag in the file
+  };
+
+public:
+  /** @brief Writer of a new snapshot
+   *
+   * The snapshot is written to a temporary file, which replaces the snapshot
+   * (atomically) when commit() is called.
+   */
+  class Writer {
+  public:
+    /** @brief Constructor
+     *
+     * @param path  snapshot file
+     * @param id    ID of the new snapshot
+     *
+     * @throw std::runtime_error if the temporary file can not be created
+     */
+    Writer (const std::string & path, const std::string & id)
+      : path_ (path),
+        tmpPath_ (path + ".tmp"),
+        file_ (fopen (tmpPath_.c_str(), "wb")),
+        position_ (0)
+    {
+      if (file_ == NULL) {
+        throw std::runtime_error ("Could not write snapshot `" + tmpPath_ + "': "
+                                  + strerror (errno));
+      }
+
+      std::memset (&header_, 0, sizeof (header_));
+      std::memcpy (header_.magic, magic_(), sizeof (header_.magic));
+      header_.version = version_;
+      header_.byteOrder = byteOrder_;
+      std::strncpy (header_.id, id.c_str(), sizeof (header_.id) - 1);
+
+      // The header is written again once all sections are known
+      write_ (&header_, sizeof (header_));
+      header_.data = sizeof (header_);
+    }
+
+    ~Writer () {
+      if (file_) {
+        fclose (file_);
+        unlink (tmpPath_.c_str());
+      }
+    }
+
+    /** @brief Add the tags of a file
+     *
+     * @param fileName  name of the file
+     * @param tags      tags located in the file
+     */
+    void addFile (const std::string & fileName, std::vector<Tag> tags) {
+      std::sort (tags.begin(), tags.end(), [] (const Tag & a, const Tag & b) {
+          return std::make_pair (a.offset1, a.offset2)
+            <    std::make_pair (b.offset1, b.offset2);
+        });
+
+      FileRecord file;
+      file.name            = string_ (fileName);
+      file.entryCount      = tags.size();
+      file.maxSpan         = 0;
+      file.checkpointBegin = checkpoints_.size();
+      file.reserved        = 0;
+      file.dataOffset      = position_ - header_.data;
+
+      const uint32_t fileIdx = files_.size();
+      std::string data;
+      Checkpoint state = {0, 0, 0};
+      for (uint32_t i = 0 ; i < tags.size() ; ++i) {
+        const Tag & tag = tags[i];
+        if (i % blockSize == 0) {
+          state.dataOffset = data.size();
+          checkpoints_.push_back (state);
+        }
+
+        const uint32_t symbol = symbol_ (tag.usr, tag.spelling);
+        const uint32_t kind   = kind_ (tag.kind);
+        putVarint_ (data, tag.offset1 - state.offset1);
+        putVarint_ (data, tag.offset2 - tag.offset1);
+        putVarint_ (data, symbol);
+        putVarint_ (data, (kind << 1) | (tag.isDeclaration ? 1 : 0));
+        putVarint_ (data, zigzag_ (tag.line1 - int (state.line1)));
+        putVarint_ (data, tag.col1);
+        putVarint_ (data, tag.line2 - tag.line1);
+        putVarint_ (data, tag.col2);
+        state.offset1 = tag.offset1;
+        state.line1   = tag.line1;
+
+        file.maxSpan = std::max (file.maxSpan, uint32_t (tag.offset2 - tag.offset1));
+        postings_.push_back (PendingPosting {symbol, fileIdx, i, tag.isDeclaration});
+      }
+
+      file.dataSize = data.size();
+      write_ (data.data(), data.size());
+      files_.push_back (file);
+    }
+
+    /** @brief Write the remaining sections, and replace the snapshot
+     *
+     * @throw std::runtime_error if the snapshot can not be written
+     */
+    void commit () {
+      header_.checkpoints = section_ (checkpoints_);
+      header_.checkpointCount = checkpoints_.size();
+
+      // Lookups by name
+      header_.files = section_ (files_);
+      header_.fileCount = files_.size();
+      header_.fileOrder = section_ (order_ (files_, [] (const FileRecord & f) {
+            return f.name;
+          }));
+
+      // Postings, grouped by symbol
+      std::sort (postings_.begin(), postings_.end(),
+                 [] (const PendingPosting & a, const PendingPosting & b) {
+                   return std::make_tuple (a.symbol, a.file, a.entry)
+                     <    std::make_tuple (b.symbol, b.file, b.entry);
+                 });
+      std::vector<Posting> refs;
+      std::vector<Posting> defs;
+      for (auto it = postings_.begin() ; it != postings_.end() ; ++it) {
+        SymbolRecord & symbol = symbols_[it->symbol];
+        if (symbol.refCount++ == 0) {
+          symbol.refBegin = refs.size();
+        }
+        refs.push_back (Posting {it->file, it->entry});
+        if (it->isDecl) {
+          if (symbol.defCount++ == 0) {
+            symbol.defBegin = defs.size();
+          }
+          defs.push_back (Posting {it->file, it->entry});
+        }
+      }
+      std::vector<PendingPosting>().swap (postings_);
+      header_.refs = section_ (refs);
+      header_.refCount = refs.size();
+      header_.defs = section_ (defs);
+      header_.defCount = defs.size();
+
+      header_.symbols = section_ (symbols_);
+      header_.symbolCount = symbols_.size();
+      header_.symbolOrder = section_ (order_ (symbols_, [] (const SymbolRecord & s) {
+            return s.usr;
+          }));
+
+      header_.kinds = section_ (kinds_);
+      header_.kindCount = kinds_.size();
+      header_.strings = position_;
+      header_.stringsSize = strings_.size();
+      write_ (strings_.data(), strings_.size());
+      header_.size = position_;
+
+      if (fseek (file_, 0, SEEK_SET) != 0) {
+        fail_();
+      }
+      write_ (&header_, sizeof (header_));
+      if (fflush (file_) != 0 || fsync (fileno (file_)) != 0) {
+        fail_();
+      }
+      fclose (file_);
+      file_ = NULL;
+
+      if (rename (tmpPath_.c_str(), path_.c_str()) != 0) {
+        unlink (tmpPath_.c_str());
+        throw std::runtime_error ("Could not write snapshot `" + path_ + "': "
+                                  + strerror (errno));
+      }
+    }
+
+  private:
+    Writer (const Writer &);
+    Writer & operator= (const Writer &);
+
+    struct PendingPosting {
+      uint32_t symbol;
+      uint32_t file;
+      uint32_t entry;
+      bool     isDecl;
+    };
+
+    void write_ (const void * data, size_t size) {
+      if (size > 0 && fwrite (data, 1, size, file_) != size) {
+        fail_();
+      }
+      position_ += size;
+    }
+
+    void fail_ () {
+      throw std::runtime_error ("Could not write snapshot `" + tmpPath_ + "': "
+                                + strerror (errno));
+    }
+
+    // Write an array of records, aligned for in-place use
+    template <typename Record>
+    uint64_t section_ (const std::vector<Record> & records) {
+      static const char padding[8] = {0};
+      write_ (padding, (8 - position_ % 8) % 8);
+      const uint64_t offset = position_;
+      write_ (records.data(), records.size() * sizeof (Record));
+      return offset;
+    }
+
+    // Indices of the records, sorted by the string they are keyed by
+    template <typename Record, typename Key>
+    std::vector<uint32_t> order_ (const std::vector<Record> & records, Key key) const {
+      std::vector<uint32_t> res (records.size());
+      for (uint32_t i = 0 ; i < res.size() ; ++i) {
+        res[i] = i;
+      }
+      std::sort (res.begin(), res.end(), [&] (uint32_t a, uint32_t b) {
+          return std::strcmp (&strings_[key (records[a])],
+                              &strings_[key (records[b])]) < 0;
+        });
+      return res;
+    }
+
+    uint32_t string_ (const std::string & s) {
+      auto it = stringIds_.find (s);
+      if (it != stringIds_.end()) {
+        return it->second;
+      }
+
+      if (strings_.size() + s.size() + 1 > UINT32_MAX) {
+        throw std::runtime_error ("Index too large for a snapshot");
+      }
+      const uint32_t offset = strings_.size();
+      strings_.append (s.c_str(), s.size() + 1);
+      stringIds_[s] = offset;
+      return offset;
+    }
+
+    uint32_t symbol_ (const std::string & usr, const std::string & spelling) {
+      std::string key = usr;
+      key += '\0';
+      key += spelling;
+
+      auto it = symbolIds_.find (key);
+      if (it != symbolIds_.end()) {
+        return it->second;
+      }
+
+      SymbolRecord symbol;
+      std::memset (&symbol, 0, sizeof (symbol));
+      symbol.usr      = string_ (usr);
+      symbol.spelling = string_ (spelling);
+      symbols_.push_back (symbol);
+      return symbolIds_[key] = symbols_.size() - 1;
+    }
+
+    uint32_t kind_ (const std::string & kind) {
+      auto it = kindIds_.find (kind);
+      if (it != kindIds_.end()) {
+        return it->second;
+      }
+      kinds_.push_back (string_ (kind));
+      return kindIds_[kind] = kinds_.size() - 1;
+    }
+
+    static uint32_t zigzag_ (int32_t x) {
+      return (uint32_t (x) << 1) ^ uint32_t (x >> 31);
+    }
+
+    static void putVarint_ (std::string & data, uint32_t x) {
+      while (x >= 0x80) {
+        data += char (x | 0x80);
+        x >>= 7;
+      }
+      data += char (x);
+    }
+
+    const std::string                         path_;
+    const std::string                         tmpPath_;
+    FILE *                                    file_;
+    uint64_t                                  position_;
+    Header                                    header_;
+    std::vector<FileRecord>                   files_;
+    std::vector<Checkpoint>                   checkpoints_;
+    std::vector<SymbolRecord>                 symbols_;
+    std::vector<uint32_t>                     kinds_;
+    std::vector<PendingPosting>               postings_;
+    std::string                               strings_;
+    std::unordered_map<std::string, uint32_t> stringIds_;
+    std::unordered_map<std::string, uint32_t> symbolIds_;
+    std::unordered_map<std::string, uint32_t> kindIds_;
+  };
+
+
+  /** @brief Open a snapshot
+   *
+   * @param path  snapshot file
+   *
+   * @throw std::runtime_error if the file can not be mapped, or is not a
+   *        valid snapshot
+   */
+  explicit Snapshot (const std::string & path)
+    : data_ (NULL),
+      size_ (0)
+  {
+    const int fd = open (path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+      throw std::runtime_error ("Could not open snapshot `" + path + "': "
+                                + strerror (errno));
+    }
+
+    struct stat fileStat;
+    if (fstat (fd, &fileStat) == 0 && size_t (fileStat.st_size) >= sizeof (Header)) {
+      size_ = fileStat.st_size;
+      void * data = mmap (NULL, size_, PROT_READ, MAP_SHARED, fd, 0);
+      data_ = data == MAP_FAILED ? NULL : (const char *) data;
+    }
+    close (fd);
+
+    if (data_ == NULL || !valid_()) {
+      if (data_) {
+        munmap ((void *) data_, size_);
+      }
+      throw std::runtime_error ("Invalid snapshot `" + path + "'");
+    }
+  }
+
+  ~Snapshot () {
+    munmap ((void *) data_, size_);
+  }
+
+  /** @brief ID of the snapshot
+   */
+  std::string id () const {
+    return header_().id;
+  }
+
+  /** @brief Find the definitions of the symbols referenced at a location
+   *
+   * @param fileName  name of the file
+   * @param offset    offset in the file
+   *
+   * @return (reference, definition) pairs, from the most specific reference
+   *         to the least specific one
+   */
+  std::vector<std::pair<Location, Location> > findDefinition (const std::string & fileName,
+                                                              int offset) const {
+    std::vector<std::pair<Location, Location> > res;
+    const int fileIdx = findFile_ (fileName);
+    if (fileIdx < 0) {
+      return res;
+    }
+
+    // Tags starting more than maxSpan bytes before the offset can not contain
+    // it: decoding starts at the last checkpoint before them
+    const FileRecord & file = files_()[fileIdx];
+    const int64_t first = int64_t (offset) - file.maxSpan;
+    const Checkpoint * checkpoints = checkpoints_() + file.checkpointBegin;
+    const uint32_t blocks = (file.entryCount + blockSize - 1) / blockSize;
+    uint32_t block = 0;
+    while (block + 1 < blocks && checkpoints[block + 1].offset1 < first) {
+      ++block;
+    }
+
+    std::vector<Entry> refs;
+    Decoder decoder (*this, file, block);
+    Entry entry;
+    while (decoder.next (entry) && int64_t (entry.offset1) <= offset) {
+      if (entry.offset1 >= first && int64_t (entry.offset2) >= offset) {
+        refs.push_back (entry);
+      }
+    }
+
+    std::stable_sort (refs.begin(), refs.end(), [] (const Entry & a, const Entry & b) {
+        return a.offset2 - a.offset1 < b.offset2 - b.offset1;
+      });
+
+    for (auto ref = refs.begin() ; ref != refs.end() ; ++ref) {
+      const char * usr = string_ (symbols_()[ref->symbol].usr);
+      const Location refLocation = location_ (fileIdx, *ref);
+
+      // Declarations of all symbols sharing the USR (with other spellings)
+      const std::pair<const uint32_t *, const uint32_t *> range = findUsr_ (usr);
+      for (const uint32_t * symbol = range.first ; symbol != range.second ; ++symbol) {
+        const SymbolRecord & record = symbols_()[*symbol];
+        const Posting * def = defs_() + record.defBegin;
+        for (uint32_t i = 0 ; i < record.defCount ; ++i, ++def) {
+          res.push_back (std::make_pair (refLocation, location_ (def->file, entry_ (*def))));
+        }
+      }
+    }
+    return res;
+  }
+
+  /** @brief Find all references to a symbol
+   *
+   * @param usr         Unified Symbol Resolution of the symbol
+   * @param filePrefix  only consider files whose name starts with this prefix
+   * @param offset      number of matching references to skip
+   * @param limit       maximum number of references to return (0 for no limit)
+   *
+   * @return tags referencing the symbol, sorted by file name and offset
+   */
+  std::vector<Location> grep (const std::string & usr,
+                              const std::string & filePrefix = "",
+                              unsigned int offset = 0,
+                              unsigned int limit = 0) const {
+    // File tags are sorted by offset, so that sorting by entry index sorts by
+    // offset
+    std::vector<std::pair<const char *, Posting> > matches;
+    const std::pair<const uint32_t *, const uint32_t *> range = findUsr_ (usr.c_str());
+    for (const uint32_t * symbol = range.first ; symbol != range.second ; ++symbol) {
+      const SymbolRecord & record = symbols_()[*symbol];
+      const Posting * ref = refs_() + record.refBegin;
+      for (uint32_t i = 0 ; i < record.refCount ; ++i, ++ref) {
+        const char * fileName = string_ (files_()[ref->file].name);
+        if (std::strncmp (fileName, filePrefix.c_str(), filePrefix.size()) == 0) {
+          matches.push_back (std::make_pair (fileName, *ref));
+        }
+      }
+    }
+    std::sort (matches.begin(), matches.end(),
+               [] (const std::pair<const char *, Posting> & a,
+                   const std::pair<const char *, Posting> & b) {
+                 const int cmp = std::strcmp (a.first, b.first);
+                 return cmp < 0 || (cmp == 0 && a.second.entry < b.second.entry);
+               });
+
+    std::vector<Location> res;
+    for (size_t i = offset ; i < matches.size() ; ++i) {
+      if (limit > 0 && res.size() >= limit) {
+        break;
+      }
+      res.push_back (location_ (matches[i].second.file, entry_ (matches[i].second)));
+    }
+    return res;
+  }
+
+private:
+  Snapshot (const Snapshot &);
+  Snapshot & operator= (const Snapshot &);
+
+  // Decoded tag
+  struct Entry {
+    uint32_t offset1;
+    uint32_t offset2;
+    uint32_t symbol;
+    uint32_t kind;
+    bool     isDecl;
+    uint32_t line1;
+    uint32_t col1;
+    uint32_t line2;
+    uint32_t col2;
+  };
+
+  // Sequential decoder of the tags of a file, starting at a checkpoint
+  class Decoder {
+  public:
+    Decoder (const Snapshot & snapshot, const FileRecord & file, uint32_t block)
+      : state_ (block * blockSize < file.entryCount
+                ? snapshot.checkpoints_()[file.checkpointBegin + block]
+                : Checkpoint {0, 0, 0}),
+        p_   (snapshot.data_ + snapshot.header_().data + file.dataOffset
+              + state_.dataOffset),
+        end_ (snapshot.data_ + snapshot.header_().data + file.dataOffset
+              + file.dataSize)
+    { }
+
+    bool next (Entry & entry) {
+      if (p_ >= end_) {
+        return false;
+      }
+
+      entry.offset1  = state_.offset1 + varint_();
+      entry.offset2  = entry.offset1 + varint_();
+      entry.symbol   = varint_();
+      const uint32_t kind = varint_();
+      entry.kind     = kind >> 1;
+      entry.isDecl   = kind & 1;
+      const uint32_t line = varint_();
+      entry.line1    = state_.line1 + int32_t ((line >> 1) ^ -(line & 1));
+      entry.col1     = varint_();
+      entry.line2    = entry.line1 + varint_();
+      entry.col2     = varint_();
+
+      state_.offset1 = entry.offset1;
+      state_.line1   = entry.line1;
+      return true;
+    }
+
+  private:
+    uint32_t varint_ () {
+      uint32_t x = 0;
+      for (int shift = 0 ; p_ < end_ && shift < 35 ; shift += 7) {
+        const unsigned char byte = *p_++;
+        x |= uint32_t (byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) {
+          break;
+        }
+      }
+      return x;
+    }
+
+    Checkpoint   state_;
+    const char * p_;
+    const char * end_;
+  };
+
+  const Header & header_ () const {
+    return *(const Header *) data_;
+  }
+
+  template <typename Record>
+  const Record * section_ (uint64_t offset) const {
+    return (const Record *) (data_ + offset);
+  }
+
+  const FileRecord *   files_ ()       const { return section_<FileRecord> (header_().files); }
+  const uint32_t *     fileOrder_ ()   const { return section_<uint32_t> (header_().fileOrder); }
+  const Checkpoint *   checkpoints_ () const { return section_<Checkpoint> (header_().checkpoints); }
+  const SymbolRecord * symbols_ ()     const { return section_<SymbolRecord> (header_().symbols); }
+  const uint32_t *     symbolOrder_ () const { return section_<uint32_t> (header_().symbolOrder); }
+  const Posting *      refs_ ()        const { return section_<Posting> (header_().refs); }
+  const Posting *      defs_ ()        const { return section_<Posting> (header_().defs); }
+  const uint32_t *     kinds_ ()       const { return section_<uint32_t> (header_().kinds); }
+
+  const char * string_ (uint32_t offset) const {
+    return data_ + header_().strings + offset;
+  }
+
+  // Check that all sections lie within the file
+  bool valid_ () const {
+    const Header & h = header_();
+    if (std::memcmp (h.magic, magic_(), sizeof (h.magic)) != 0
+        || h.byteOrder != byteOrder_ || h.version != version_ || h.size != size_
+        || h.id[sizeof (h.id) - 1] != '\0') {
+      return false;
+    }
+
+    const std::pair<uint64_t, uint64_t> sections[] = {
+      std::make_pair (h.checkpoints, h.checkpointCount * sizeof (Checkpoint)),
+      std::make_pair (h.files,       h.fileCount * sizeof (FileRecord)),
+      std::make_pair (h.fileOrder,   h.fileCount * sizeof (uint32_t)),
+      std::make_pair (h.symbols,     h.symbolCount * sizeof (SymbolRecord)),
+      std::make_pair (h.symbolOrder, h.symbolCount * sizeof (uint32_t)),
+      std::make_pair (h.refs,        h.refCount * sizeof (Posting)),
+      std::make_pair (h.defs,        h.defCount * sizeof (Posting)),
+      std::make_pair (h.kinds,       h.kindCount * sizeof (uint32_t)),
+      std::make_pair (h.strings,     h.stringsSize),
+    };
+    for (auto s = std::begin (sections) ; s != std::end (sections) ; ++s) {
+      if (s->first > size_ || s->second > size_ - s->first) {
+        return false;
+      }
+    }
+    return h.stringsSize == 0 || data_[h.strings + h.stringsSize - 1] == '\0';
+  }
+
+  int findFile_ (const std::string & fileName) const {
+    const uint32_t * begin = fileOrder_();
+    const uint32_t * end   = begin + header_().fileCount;
+    const uint32_t * it = std::lower_bound (begin, end, fileName.c_str(),
+                                            [this] (uint32_t file, const char * name) {
+        return std::strcmp (string_ (files_()[file].name), name) < 0;
+      });
+    if (it == end || fileName != string_ (files_()[*it].name)) {
+      return -1;
+    }
+    return *it;
+  }
+
+  // Symbols having this USR
+  std::pair<const uint32_t *, const uint32_t *> findUsr_ (const char * usr) const {
+    const uint32_t * begin = symbolOrder_();
+    const uint32_t * end   = begin + header_().symbolCount;
+    const auto byUsr = [this] (uint32_t symbol) {
+      return string_ (symbols_()[symbol].usr);
+    };
+    const uint32_t * first = std::lower_bound (begin, end, usr,
+                                               [&] (uint32_t symbol, const char * usr) {
+        return std::strcmp (byUsr (symbol), usr) < 0;
+      });
+    const uint32_t * last = first;
+    while (last != end && std::strcmp (byUsr (*last), usr) == 0) {
+      ++last;
+    }
+    return std::make_pair (first, last);
+  }
+
+  // Decode the tag referenced by a posting
+  Entry entry_ (const Posting & posting) const {
+    const FileRecord & file = files_()[posting.file];
+    Decoder decoder (*this, file, posting.entry / blockSize);
+    Entry entry;
+    for (uint32_t i = 0 ; i <= posting.entry % blockSize ; ++i) {
+      decoder.next (entry);
+    }
+    return entry;
+  }
+
+  Location location_ (uint32_t fileIdx, const Entry & entry) const {
+    const SymbolRecord & symbol = symbols_()[entry.symbol];
+    Location location;
+    location.file              = string_ (files_()[fileIdx].name);
+    location.tag.usr           = string_ (symbol.usr);
+    location.tag.kind          = string_ (kinds_()[entry.kind]);
+    location.tag.spelling      = string_ (symbol.spelling);
+    location.tag.line1         = entry.line1;
+    location.tag.col1          = entry.col1;
+    location.tag.offset1       = entry.offset1;
+    location.tag.line2         = entry.line2;
+    location.tag.col2          = entry.col2;
+    location.tag.offset2       = entry.offset2;
+    location.tag.isDeclaration = entry.isDecl;
+    return location;
+  }
+
+  // First bytes of snapshot files, version of their layout, and byte order
+  // marker, whose bytes are reversed when read on a machine of the other
+  // endianness
+  static const char * magic_ () { return "ctsnap\0\1"; }
+  static const uint32_t version_   = 2;
+  static const uint32_t byteOrder_ = 0x01020304;
+
+  const char * data_;
+  size_t       size_;
+};
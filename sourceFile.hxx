@@ -1,48 +1,116 @@
 #pragma once
 
-#include <fstream>
-#include <sstream>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <limits>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
-class SourceFile : public std::ifstream {
+// Read-only, in-memory copy of a source file.
+//
+// The offsets of line beginnings are computed once when the file is read, so
+// that extracting a line or a substring does not need to read the file again.
+// Files which can not be read are seen as empty.
+//
+// The contents are copied rather than mapped: files may be truncated in place
+// (e.g. by editors or formatters) while they are cached, and accessing a
+// truncated mapping would crash the server.
+class SourceFile {
 public:
   SourceFile (const std::string & fileName)
-    : std::ifstream (fileName.c_str())
-  { }
+    : data_ (NULL),
+      size_ (0)
+  {
+    int fd = open (fileName.c_str(), O_RDONLY);
+    if (fd != -1) {
+      struct stat fileStat;
+      if (fstat (fd, &fileStat) == 0 && fileStat.st_size > 0) {
+        buffer_.resize (fileStat.st_size);
+        while (size_ < buffer_.size()) {
+          const ssize_t n = pread (fd, &buffer_[size_], buffer_.size() - size_, size_);
+          if (n <= 0) {
+            break;  // error, or truncated since fstat()
+          }
+          size_ += n;
+        }
+        buffer_.resize (size_);
+      }
+      close (fd);
+    }
+    data_ = buffer_.data();
 
-  std::string substring (const unsigned int offset1, const unsigned int offset2) {
-    unsigned int len = offset2 - offset1;
-    char * buffer = new char [len+1];
+    lines_.push_back (0);
+    const char * end = data_ + size_;
+    for (const char * p = data_ ; p < end ; ++p) {
+      p = static_cast<const char *> (memchr (p, '\n', end - p));
+      if (p == NULL) {
+        break;
+      }
+      lines_.push_back (p + 1 - data_);
+    }
+  }
 
-    seekg (offset1);
-    read (buffer, len);
-    buffer[len] = 0;
+  std::string substring (const unsigned int offset1, const unsigned int offset2) const {
+    const size_t begin = std::min<size_t> (offset1, size_);
+    const size_t end   = std::min<size_t> (std::max (offset1, offset2), size_);
+    return shorten_ (data_ + begin, data_ + end, 42);
+  }
 
-    std::string res (buffer);
-    delete[] buffer;
+  // Line number lineno, counting from 1 (without the end-of-line character)
+  std::string line (const unsigned int lineno) const {
+    if (lineno == 0 || lineno > lines_.size()) {
+      return "";
+    }
 
-    return shorten_ (res, 42);
+    const size_t begin = lines_[lineno-1];
+    size_t end = lineno < lines_.size()
+      ? lines_[lineno] - 1
+      : size_;
+    if (begin > end) {
+      end = begin;
+    }
+    return std::string (data_ + begin, data_ + end);
   }
 
-  std::string line (const unsigned int lineno) {
-    seekg (0);
-    std::string line;
-    for (unsigned int i=0 ; i<lineno ; ++i) {
-      std::getline (*this, line);
-    }
+  size_t size () const {
+    return size_;
+  }
 
-    return line;
+  // Memory used by the contents and the line index (in bytes)
+  size_t memoryUsage () const {
+    return buffer_.capacity() + lines_.capacity() * sizeof (unsigned int);
   }
 
 private:
-  static std::string shorten_ (const std::string & s, const unsigned int sizeMax) {
-    std::istringstream iss (s);
+  SourceFile (const SourceFile &);
+  SourceFile & operator= (const SourceFile &);
 
-    std::string word;
-    iss >> word;
-    std::string res = word;
-    while (! iss.eof()) {
-      iss >> word;
-      res += " " + word;
+  // Collapse runs of white space into single spaces, and truncate the result
+  // to sizeMax characters
+  static std::string shorten_ (const char * begin, const char * end,
+                               const unsigned int sizeMax) {
+    std::string res;
+    bool space = false;
+    for (const char * p = begin ; p < end ; ++p) {
+      if (isspace ((unsigned char) *p)) {
+        space = true;
+        continue;
+      }
+
+      if (space && !res.empty()) {
+        res += ' ';
+      }
+      space = false;
+      res += *p;
 
       if (res.size() > sizeMax) {
         res = res.substr(0, sizeMax-3);
@@ -54,4 +122,118 @@ private:
     return res;
   }
 
+  std::string               buffer_;
+  const char *              data_;   // contents of the file (in buffer_)
+  size_t                    size_;
+  std::vector<unsigned int> lines_; // offsets of line beginnings
+};
+
+
+// Cache of source files, shared by all threads.
+//
+// Least recently used files are dropped when the cache holds too many of
+// them, or when they use more memory than allowed. A cached file is read
+// again when its modification time, inode or size change.
+class SourceFileCache {
+public:
+  typedef std::shared_ptr<const SourceFile> Ptr;
+
+  SourceFileCache (unsigned int maxFiles)
+    : maxFiles_ (maxFiles),
+      memoryLimit_ (std::numeric_limits<size_t>::max()),
+      memoryUsage_ (0)
+  { }
+
+  // Cache used by the server
+  static SourceFileCache & global () {
+    static SourceFileCache cache (256);
+    return cache;
+  }
+
+  Ptr get (const std::string & fileName) {
+    Stamp stamp;
+    struct stat fileStat;
+    if (stat (fileName.c_str(), &fileStat) == 0) {
+      stamp.mtime = fileStat.st_mtime;
+      stamp.inode = fileStat.st_ino;
+      stamp.size  = fileStat.st_size;
+    }
+
+    std::lock_guard<std::mutex> lock (mutex_);
+    auto it = index_.find (fileName);
+    if (it != index_.end()) {
+      if (it->second->stamp == stamp) {
+        lru_.splice (lru_.begin(), lru_, it->second);
+        return it->second->file;
+      }
+
+      memoryUsage_ -= it->second->file->memoryUsage();
+      lru_.erase (it->second);
+      index_.erase (it);
+    }
+
+    Entry entry;
+    entry.fileName = fileName;
+    entry.stamp    = stamp;
+    entry.file     = Ptr (new SourceFile (fileName));
+    lru_.push_front (entry);
+    index_[fileName] = lru_.begin();
+    memoryUsage_ += entry.file->memoryUsage();
+
+    evict_();
+    return entry.file;
+  }
+
+  // Change the memory limit (in bytes)
+  void setMemoryLimit (size_t memoryLimit) {
+    std::lock_guard<std::mutex> lock (mutex_);
+    memoryLimit_ = memoryLimit;
+    evict_();
+  }
+
+  // Memory used by cached files (in bytes)
+  size_t memoryUsage () const {
+    std::lock_guard<std::mutex> lock (mutex_);
+    return memoryUsage_;
+  }
+
+private:
+  struct Stamp {
+    Stamp () : mtime (0), inode (0), size (0) {}
+
+    bool operator== (const Stamp & other) const {
+      return mtime == other.mtime
+        &&   inode == other.inode
+        &&   size  == other.size;
+    }
+
+    time_t mtime;
+    ino_t  inode;
+    off_t  size;
+  };
+
+  struct Entry {
+    std::string fileName;
+    Stamp       stamp;
+    Ptr         file;
+  };
+
+  typedef std::list<Entry> List;
+
+  // Drop least recently used files, always keeping the most recent one
+  void evict_ () {
+    while (lru_.size() > maxFiles_
+           || (lru_.size() > 1 && memoryUsage_ > memoryLimit_)) {
+      memoryUsage_ -= lru_.back().file->memoryUsage();
+      index_.erase (lru_.back().fileName);
+      lru_.pop_back();
+    }
+  }
+
+  const unsigned int                              maxFiles_;
+  size_t                                          memoryLimit_;
+  size_t                                          memoryUsage_;
+  List                                            lru_;
+  std::unordered_map<std::string, List::iterator> index_;
+  mutable std::mutex                              mutex_;
 };
@@ -10,4 +10,35 @@ namespace Sqlite {
   Statement Database::prepare (char const *const sql) {
     return Statement (*this, sql);
   }
+
+  std::string Database::pragma (const std::string & name) {
+    Statement stmt = prepare (("PRAGMA " + name).c_str());
+
+    std::string value;
+    if (stmt.step() == SQLITE_ROW) {
+      stmt >> value;
+    }
+    return value;
+  }
+
+  std::string Database::pragma (const std::string & name,
+                                const std::string & value) {
+    Statement stmt = prepare (("PRAGMA " + name + " = " + value).c_str());
+    stmt.step();
+
+    // Not all pragmas report their new value
+    return pragma (name);
+  }
+
+  Statement & Database::cached (char const *const sql) {
+    auto it = cache_.find (sql);
+    if (it == cache_.end()) {
+      ++cacheMisses_;
+      std::shared_ptr<Statement> stmt (new Statement (*this, sql));
+      return *(cache_[sql] = stmt);
+    }
+
+    ++cacheHits_;
+    return it->second->reset();
+  }
 }
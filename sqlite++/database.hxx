@@ -2,6 +2,7 @@
 
 #include <string>
 #include <memory>
+#include <unordered_map>
 #include <sqlite3.h>
 #include <stdexcept>
 
@@ -34,11 +35,17 @@ namespace Sqlite {
      * Create a connection to the SQLite database stored in a given file.
      *
      * @param fileName  path to the SQLite database file
+     * @param flags     SQLite open flags, e.g. @c SQLITE_OPEN_READONLY for a
+     *                  read-only connection to an existing database
      * @throw Error
      */
-    Database (const std::string & fileName) {
+    Database (const std::string & fileName,
+              int flags = SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE)
+      : cacheHits_ (0),
+        cacheMisses_ (0)
+    {
       sqlite3 *db;
-      int ret = sqlite3_open (fileName.c_str(), &db);
+      int ret = sqlite3_open_v2 (fileName.c_str(), &db, flags, NULL);
       db_.reset (new Sqlite3_ (db));
 
       if (ret != SQLITE_OK) {
@@ -66,6 +73,61 @@ namespace Sqlite {
      */
     Statement prepare (char const *const sql);
 
+    /** @brief Get a cached prepared statement
+     *
+     * Statements are compiled the first time their SQL code is requested, and
+     * kept for the lifetime of the database connection. Subsequent calls with
+     * the same SQL code return the same statement, reset and with all values
+     * unbound.
+     *
+     * A cached statement should not be requested again while its results are
+     * still being processed.
+     *
+     * @param sql  C-style string containing SQL statements
+     *
+     * @return a reference to the prepared Statement object for the SQL code
+     * @throw Error
+     */
+    Statement & cached (char const *const sql);
+
+    /** @brief Get the value of a pragma
+     *
+     * @param name  pragma name, e.g. @c "synchronous"
+     *
+     * @return the current value of the pragma, as a string
+     * @throw Error
+     */
+    std::string pragma (const std::string & name);
+
+    /** @brief Set the value of a pragma
+     *
+     * Pragma values can not be bound to placeholders: @c value is inserted as
+     * is in the SQL code, and should be validated by the caller.
+     *
+     * @param name   pragma name, e.g. @c "synchronous"
+     * @param value  new value, e.g. @c "NORMAL"
+     *
+     * @return the value of the pragma after the change
+     * @throw Error
+     */
+    std::string pragma (const std::string & name, const std::string & value);
+
+    /** @brief Get the number of cached() calls which reused a statement
+     *
+     * @return the number of statement cache hits
+     */
+    unsigned long cacheHits () const {
+      return cacheHits_;
+    }
+
+    /** @brief Get the number of cached() calls which compiled a statement
+     *
+     * @return the number of statement cache misses
+     */
+    unsigned long cacheMisses () const {
+      return cacheMisses_;
+    }
+
     /** @brief Retrieve the last SQLite error message
      *
      * @return a C-style string containing the error message
@@ -82,6 +144,28 @@ namespace Sqlite {
       return sqlite3_last_insert_rowid (raw());
     }
 
+    /** @brief Get the memory used by SQLite in the whole process
+     *
+     * This includes the page caches and prepared statements of all
+     * connections.
+     *
+     * @return the memory currently allocated by SQLite (in bytes)
+     */
+    static size_t memoryUsed () {
+      return sqlite3_memory_used();
+    }
+
+    /** @brief Limit the memory used by SQLite in the whole process
+     *
+     * The limit is advisory: when it is exceeded, SQLite frees cached pages
+     * before allocating more memory, but allocations still succeed.
+     *
+     * @param bytes  soft heap limit (in bytes); 0 removes the limit
+     */
+    static void setSoftHeapLimit (size_t bytes) {
+      sqlite3_soft_heap_limit64 (bytes);
+    }
+
   private:
     sqlite3 * raw () { return db_->db_; }
 
@@ -92,6 +176,12 @@ namespace Sqlite {
     };
     std::shared_ptr<Sqlite3_> db_;
 
+    // Declared after db_, so that statements are finalized before the
+    // connection is closed
+    std::unordered_map<std::string, std::shared_ptr<Statement> > cache_;
+    unsigned long cacheHits_;
+    unsigned long cacheMisses_;
+
     friend class Statement;
   };
 
@@ -122,6 +122,24 @@ namespace Sqlite {
       return ret;
     }
 
+    /** @brief Reset the statement for a new execution
+     *
+     * Reset the statement to its initial state, and clear all bound
+     * values. This allows executing the same prepared statement several times
+     * with different values, without paying for the SQL compilation more than
+     * once. This method returns the Statement object itself, allowing chains
+     * of calls.
+     *
+     * @return the Statement object itself
+     */
+    Statement & reset () {
+      sqlite3_reset (raw());
+      sqlite3_clear_bindings (raw());
+      bindI_ = 1;
+      colI_ = 0;
+      return *this;
+    }
+
   private:
     Statement & bind_ (int ret) {
       if (ret != SQLITE_OK) {
@@ -30,6 +30,11 @@ int main () {
     database.prepare ("INSERT INTO foo VALUES (NULL, ?)")
       .bind ("bar")  // bind it to a value, ...
       .step ();      // execute it
+
+    // Prepared statements can be reset and executed again
+    Statement insert = database.prepare ("INSERT INTO foo VALUES (NULL, ?)");
+    insert.bind ("baz").step();
+    insert.reset().bind ("qux").step();
   }
 
   // Prepare an SQL statement
@@ -45,6 +50,23 @@ int main () {
     // and display them
     std::cerr << id << ": " << name << std::endl;
   }
+
+  // Frequently used statements can be cached: they are compiled only once
+  for (int i = 0 ; i < 3 ; ++i) {
+    Statement & count = database.cached ("SELECT count(*) FROM foo");
+    count.step();
+
+    int n;
+    count >> n;
+    std::cerr << n << " rows" << std::endl;
+  }
+  std::cerr << "Statement cache: "
+            << database.cacheHits()   << " hits, "
+            << database.cacheMisses() << " misses" << std::endl;
+
+  // Pragmas tune the behaviour of the connection
+  database.pragma ("cache_size", "-8192");
+  std::cerr << "Page cache: " << database.pragma ("cache_size") << std::endl;
   //![main]
 
   return 0;
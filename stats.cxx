@@ -0,0 +1,61 @@
+#include "application.hxx"
+#include "util/metrics.hxx"
+#include "util/memoryGovernor.hxx"
+#include "json/json.h"
+
+Json::Value Application::statsJson () {
+  Metrics & metrics = Metrics::global();
+  Json::Value json;
+
+  Json::Value & counters = json["counters"];
+  counters = Json::Value (Json::objectValue);
+  const auto values = metrics.counters();
+  for (auto it = values.begin() ; it != values.end() ; ++it) {
+    counters[it->first] = (Json::Int64) it->second;
+  }
+
+  Json::Value & histograms = json["histograms"];
+  histograms = Json::Value (Json::objectValue);
+  const auto summaries = metrics.histograms();
+  for (auto it = summaries.begin() ; it != summaries.end() ; ++it) {
+    const Histogram::Summary & summary = it->second;
+    Json::Value & histogram = histograms[it->first];
+    histogram["count"] = (Json::UInt64) summary.count;
+    histogram["sum"]   = summary.sum;
+    histogram["min"]   = summary.min;
+    histogram["max"]   = summary.max;
+    histogram["p50"]   = summary.p50;
+    histogram["p90"]   = summary.p90;
+    histogram["p99"]   = summary.p99;
+  }
+
+  const MemoryGovernor & governor = MemoryGovernor::global();
+  Json::Value & memory = json["memory"];
+  memory["rss"]    = (Json::UInt64) governor.rss();
+  memory["budget"] = (Json::UInt64) governor.budget();
+  memory["scale"]  = governor.scale();
+  Json::Value & caches = memory["caches"];
+  caches = Json::Value (Json::objectValue);
+  const auto reports = governor.report();
+  for (auto it = reports.begin() ; it != reports.end() ; ++it) {
+    caches[it->first]["usage"] = (Json::UInt64) it->second.usage;
+    caches[it->first]["limit"] = (Json::UInt64) it->second.limit;
+  }
+
+  return json;
+}
+
+void Application::stats (StatsArgs & args, std::ostream & cout) {
+  Json::Value json = statsJson();
+
+  // Statement cache of the connection serving this request
+  json["sqlite"]["statementCacheHits"]   = (Json::UInt64) storage_.statementCacheHits();
+  json["sqlite"]["statementCacheMisses"] = (Json::UInt64) storage_.statementCacheMisses();
+
+  Json::StyledWriter writer;
+  cout << writer.write (json);
+
+  if (args.reset) {
+    Metrics::global().reset();
+  }
+}
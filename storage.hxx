@@ -1,19 +1,71 @@
 #pragma once
 
 #include "sqlite++/sqlite.hxx"
+#include "symbolTable.hxx"
+#include "snapshot.hxx"
+#include "util/metrics.hxx"
 #include "json/json.h"
 
 #include <sys/stat.h>
+#include <sys/time.h>
+#include <fnmatch.h>
 #include <unistd.h>
+#include <stdint.h>
+#include <algorithm>
 #include <vector>
+#include <set>
+#include <map>
+#include <functional>
+#include <memory>
+#include <unordered_map>
+#include <fstream>
 #include <sstream>
 #include <iostream>
+#include <tuple>
 
 class Storage {
 public:
-  Storage ()
-    : db_ (".ct.sqlite")
+  enum Mode {
+    ReadWrite,
+    ReadOnly,   // Additional connection to an existing database
+    Prebuilt    // Read-only database, which never changes while it is in use
+                // (e.g. a shard shared across machines)
+  };
+
+  // SQLite tunables, by pragma name. Values given here take precedence over
+  // those stored in the options table (see setPragma()).
+  typedef std::map<std::string, std::string> Pragmas;
+
+  Storage (Mode mode = ReadWrite, const Pragmas & pragmas = Pragmas(),
+           const std::string & path = ".ct.sqlite")
+    : db_ (mode == Prebuilt ? immutableUri_ (path) : path,
+           mode == ReadWrite
+           ? SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE
+           : SQLITE_OPEN_READONLY | SQLITE_OPEN_URI),
+      path_ (path),
+      symbols_ (NULL),
+      pragmas_ (pragmas),
+      useSnapshot_ (false),
+      snapshotCurrent_ (true)
   {
+    for (auto it = pragmas.begin() ; it != pragmas.end() ; ++it) {
+      checkPragma (it->first, it->second);
+    }
+
+    if (mode != ReadWrite) {
+      configure_ (mode);
+      return;
+    }
+
+    // The page size can only be changed before the database is created
+    if (pragmas.count ("page_size") > 0) {
+      db_.pragma ("page_size", pragmas.at ("page_size"));
+    }
+
+    // Allow read-only connections to query the database while it is being
+    // written to
+    db_.execute ("PRAGMA journal_mode=WAL");
+
     db_.execute ("CREATE TABLE IF NOT EXISTS files ("
                  "  id      INTEGER PRIMARY KEY,"
                  "  name    TEXT,"
@@ -45,6 +97,9 @@ public:
                  "  name   TEXT, "
                  "  value  TEXT "
                  ")");
+    migrate_ ();
+    repairIndexes_ ();
+    configure_ (mode);
   }
 
   int setCompileCommand (const std::string & fileName,
@@ -53,12 +108,12 @@ public:
     int fileId = addFile_ (fileName);
     addInclude (fileId, fileId);
 
-    db_.prepare ("DELETE FROM commands "
+    db_.cached ("DELETE FROM commands "
                  "WHERE fileId=?")
       .bind (fileId)
       .step();
 
-    db_.prepare ("INSERT INTO commands VALUES (?,?,?)")
+    db_.cached ("INSERT INTO commands VALUES (?,?,?)")
       .bind (fileId)
       .bind (directory)
       .bind (serialize_ (args))
@@ -71,8 +126,8 @@ public:
                           std::string & directory,
                           std::vector<std::string> & args) {
     int fileId = fileId_ (fileName);
-    Sqlite::Statement stmt
-      = db_.prepare ("SELECT commands.directory, commands.args "
+    Sqlite::Statement & stmt
+      = db_.cached ("SELECT commands.directory, commands.args "
                      "FROM includes "
                      "INNER JOIN commands ON includes.sourceId = commands.fileId "
                      "WHERE includes.includedId = ?")
@@ -86,92 +141,517 @@ public:
     default:
       std::string serializedArgs;
       stmt >> directory >> serializedArgs;
+      stmt.reset();
       deserialize_ (serializedArgs, args);
     }
   }
 
-  std::string nextFile () {
-    Sqlite::Statement stmt
-      = db_.prepare ("SELECT included.name, included.indexed, source.name, "
-                     "       count(source.name) AS sourceCount "
-                     "FROM includes "
-                     "INNER JOIN files AS source ON source.id = includes.sourceId "
-                     "INNER JOIN files AS included ON included.id = includes.includedId "
-                     "GROUP BY included.id "
-                     "ORDER BY sourceCount ");
+  struct CompileCommand {
+    std::string              directory;
+    std::vector<std::string> args;
+  };
+
+  // Compilation commands of all source files, by file name
+  std::unordered_map<std::string, CompileCommand> compileCommands () {
+    std::unordered_map<std::string, CompileCommand> res;
+
+    Sqlite::Statement & stmt
+      = db_.cached ("SELECT files.name, commands.directory, commands.args "
+                    "FROM commands "
+                    "INNER JOIN files ON files.id = commands.fileId");
     while (stmt.step() == SQLITE_ROW) {
-      std::string includedName;
-      int indexed;
-      std::string sourceName;
-      stmt >> includedName >> indexed >> sourceName;
+      std::string fileName, serializedArgs;
+      CompileCommand command;
+      stmt >> fileName >> command.directory >> serializedArgs;
+      deserialize_ (serializedArgs, command.args);
+      res[fileName] = command;
+    }
+
+    return res;
+  }
+
+  // Preprocessor configuration of a compilation command: its directory and
+  // arguments, except for the source file and output options
+  static size_t configuration (const std::string & directory,
+                               const std::vector<std::string> & args) {
+    static const std::vector<std::string> extensions
+      = {".c", ".cc", ".cpp", ".cxx", ".c++", ".C", ".m", ".mm"};
+
+    std::string key = directory;
+    for (size_t i = 0 ; i < args.size() ; ++i) {
+      const std::string & arg = args[i];
+      if (arg == "-o" || arg == "-MF" || arg == "-MT" || arg == "-MQ") {
+        ++i;
+        continue;
+      }
+
+      if (arg == "-c") {
+        continue;
+      }
+
+      if (arg.compare (0, 1, "-") != 0) {
+        bool source = false;
+        for (auto ext = extensions.begin() ; ext != extensions.end() ; ++ext) {
+          source = source || (arg.size() >= ext->size()
+                              && arg.compare (arg.size() - ext->size(),
+                                              ext->size(), *ext) == 0);
+        }
+        if (source) {
+          continue;
+        }
+      }
+
+      key += '\0';
+      key += arg;
+    }
+
+    return std::hash<std::string>() (key);
+  }
+
+  // Source files which need to be parsed again to bring the index up to date.
+  //
+  // The include graph is loaded in memory and each file is stat()ed only once.
+  // Files which were touched without their contents changing are marked as up
+  // to date without being re-indexed. Tags in a header depend on the
+  // preprocessor configuration (see configuration()) of the translation unit
+  // in which it is parsed, but not on the translation unit itself: one source
+  // file is selected for each modified header and each configuration in which
+  // it is included.
+  //
+  // If candidates is not empty, only these files are checked for changes (e.g.
+  // those reported by a file watcher).
+  std::vector<std::string> staleSources (const std::set<std::string> & candidates
+                                         = std::set<std::string>()) {
+    struct File {
+      std::string name;
+      int         indexed;
+      std::string hash;
+    };
+
+    std::unordered_map<int, File> files;
+    {
+      Sqlite::Statement & stmt
+        = db_.cached ("SELECT id, name, indexed, IFNULL(hash, '') FROM files");
+      while (stmt.step() == SQLITE_ROW) {
+        int id;
+        File file;
+        stmt >> id >> file.name >> file.indexed >> file.hash;
+        files[id] = file;
+      }
+    }
+
+    std::unordered_map<int, std::vector<int> > includedFiles; // by source
+    std::unordered_map<int, std::vector<int> > sourceFiles;   // by included
+    {
+      Sqlite::Statement & stmt
+        = db_.cached ("SELECT sourceId, includedId FROM includes");
+      while (stmt.step() == SQLITE_ROW) {
+        int sourceId, includedId;
+        stmt >> sourceId >> includedId;
+        includedFiles[sourceId].push_back (includedId);
+        sourceFiles[includedId].push_back (sourceId);
+      }
+    }
+
+    // Modified files
+    std::vector<int> modified;
+    std::set<int>    removed;
+    for (auto it = files.begin() ; it != files.end() ; ++it) {
+      const File & file = it->second;
+      if (!candidates.empty() && candidates.count (file.name) == 0) {
+        continue;
+      }
 
       struct stat fileStat;
-      if (stat (includedName.c_str(), &fileStat) != 0) {
-        std::cerr << "Warning: could not stat() file `" << includedName << "'" << std::endl
+      if (stat (file.name.c_str(), &fileStat) != 0) {
+        std::cerr << "Warning: could not stat() file `" << file.name << "'" << std::endl
                   << "  removing it from the index" << std::endl;
-        removeFile (includedName);
+        removeFile (file.name);
+        removed.insert (it->first);
         continue;
       }
-      int modified = fileStat.st_mtime;
 
-      if (modified > indexed) {
-        return sourceName;
+      const int mtime = fileStat.st_mtime;
+      if (mtime <= file.indexed) {
+        continue;
+      }
+
+      if (file.hash != "" && hashFile_ (file.name) == file.hash) {
+        db_.cached ("UPDATE files SET indexed=? WHERE id=?")
+          .bind (mtime)
+          .bind (it->first)
+          .step();
+        continue;
+      }
+
+      modified.push_back (it->first);
+    }
+
+    // Headers included by fewer source files come last, so that they have a
+    // chance to be covered by another source file first
+    std::sort (modified.begin(), modified.end(),
+               [&sourceFiles] (int a, int b) {
+                 return sourceFiles[a].size() > sourceFiles[b].size();
+               });
+
+    // Configuration of each source file (sources without a compilation
+    // command will fail to be parsed anyway)
+    std::unordered_map<int, size_t> configurations;
+    if (!modified.empty()) {
+      const auto commands = compileCommands();
+      for (auto it = includedFiles.begin() ; it != includedFiles.end() ; ++it) {
+        auto command = commands.find (files[it->first].name);
+        configurations[it->first] = command == commands.end()
+          ? 0
+          : configuration (command->second.directory, command->second.args);
       }
     }
 
-    return "";
+    std::vector<std::string> res;
+    std::set<std::pair<size_t, int> > covered; // (configuration, file)
+    auto select = [&] (int sourceId) {
+      res.push_back (files[sourceId].name);
+      const size_t config = configurations[sourceId];
+      const std::vector<int> & included = includedFiles[sourceId];
+      for (auto it = included.begin() ; it != included.end() ; ++it) {
+        covered.insert (std::make_pair (config, *it));
+      }
+    };
+
+    // Modified source files
+    for (auto it = modified.begin() ; it != modified.end() ; ++it) {
+      const std::vector<int> & sources = sourceFiles[*it];
+      if (std::find (sources.begin(), sources.end(), *it) != sources.end()) {
+        select (*it);
+      }
+    }
+
+    // One source file for each remaining modified header and configuration
+    for (auto it = modified.begin() ; it != modified.end() ; ++it) {
+      const std::vector<int> & sources = sourceFiles[*it];
+      for (auto source = sources.begin() ; source != sources.end() ; ++source) {
+        if (removed.count (*source) == 0
+            && covered.count (std::make_pair (configurations[*source], *it)) == 0) {
+          select (*source);
+        }
+      }
+    }
+
+    return res;
+  }
+
+  // Keep a resident symbol table in sync with the tags stored in the
+  // database, and use it to answer findDefinition() and grep() requests.
+  // The symbol table should have been populated using loadSymbols().
+  void useSymbolTable (SymbolTable & symbols) {
+    symbols_ = &symbols;
+  }
+
+  void loadSymbols (SymbolTable & symbols) {
+    symbols.clear();
+    forEachFileTags_ ([&symbols] (const std::string & fileName,
+                                  const std::vector<Tag> & tags) {
+        symbols.addTags (fileName, tags);
+      });
+  }
+
+  // Path of the snapshot of this database
+  std::string snapshotPath () const {
+    const std::string extension = ".sqlite";
+    if (path_.size() > extension.size()
+        && path_.compare (path_.size() - extension.size(), extension.size(),
+                          extension) == 0) {
+      return path_.substr (0, path_.size() - extension.size()) + ".snapshot";
+    }
+    return path_ + ".snapshot";
+  }
+
+  // Answer findDefinition() and grep() from the snapshot of the database, as
+  // long as it is up to date. Snapshots written later (possibly through
+  // another connection) are mapped as they appear.
+  void useSnapshot () {
+    useSnapshot_ = true;
+  }
+
+  // Write a snapshot of the whole index, which replaces the previous one
+  void writeSnapshot () {
+    struct timeval now;
+    gettimeofday (&now, NULL);
+    std::ostringstream id;
+    id << now.tv_sec << "." << now.tv_usec << "." << getpid();
+
+    Snapshot::Writer writer (snapshotPath(), id.str());
+    forEachFileTags_ ([&writer] (const std::string & fileName,
+                                 const std::vector<Tag> & tags) {
+        writer.addFile (fileName, tags);
+      });
+    writer.commit();
+
+    setOption ("snapshotId", id.str());
+    snapshotCurrent_ = true;
+  }
+
+  // Stop using snapshots, and remove the snapshot file
+  void removeSnapshot () {
+    setOption ("snapshotId", "");
+    snapshotCurrent_ = false;
+    unlink (snapshotPath().c_str());
+  }
+
+private:
+  // Call f(fileName, tags) for each file of the index
+  template <typename F>
+  void forEachFileTags_ (F f) {
+    Sqlite::Statement & stmt
+      = db_.cached ("SELECT files.name, symbols.usr, kinds.name, symbols.spelling, "
+                    "       tags.line1, tags.col1, tags.offset1, "
+                    "       tags.line2, tags.col2, tags.offset2, tags.isDecl "
+                    "FROM tags "
+                    "INNER JOIN files   ON files.id   = tags.fileId "
+                    "INNER JOIN symbols ON symbols.id = tags.symbolId "
+                    "INNER JOIN kinds   ON kinds.id   = tags.kindId "
+                    "ORDER BY tags.fileId");
+
+    std::string fileName;
+    std::vector<Tag> tags;
+    while (stmt.step() == SQLITE_ROW) {
+      std::string tagFile;
+      Tag tag;
+      int isDecl;
+      stmt >> tagFile >> tag.usr >> tag.kind >> tag.spelling
+           >> tag.line1 >> tag.col1 >> tag.offset1
+           >> tag.line2 >> tag.col2 >> tag.offset2 >> isDecl;
+      tag.isDeclaration = isDecl;
+
+      if (tagFile != fileName) {
+        if (!tags.empty()) {
+          f (fileName, tags);
+        }
+        tags.clear();
+        fileName = tagFile;
+      }
+      tags.push_back (tag);
+    }
+    if (!tags.empty()) {
+      f (fileName, tags);
+    }
+  }
+
+  // The current snapshot (NULL if there is none, or if it is outdated)
+  const Snapshot * snapshot_ () {
+    if (!useSnapshot_) {
+      return NULL;
+    }
+
+    std::string id;
+    try {
+      id = getOption ("snapshotId");
+    } catch (std::runtime_error &) {
+      // No snapshot was ever written
+    }
+
+    struct stat fileStat;
+    if (id == "" || stat (snapshotPath().c_str(), &fileStat) != 0) {
+      mapped_.reset();
+      return NULL;
+    }
+
+    // Snapshots are replaced by renaming new files over them
+    if (!mapped_ || fileStat.st_ino != mappedStat_.st_ino
+        || fileStat.st_mtime != mappedStat_.st_mtime
+        || fileStat.st_size != mappedStat_.st_size) {
+      mapped_.reset();
+      mappedStat_ = fileStat;
+      try {
+        mapped_.reset (new Snapshot (snapshotPath()));
+      } catch (std::runtime_error & e) {
+        std::cerr << "Not using snapshot: " << e.what() << std::endl;
+        return NULL;
+      }
+    }
+
+    return mapped_->id() == id ? mapped_.get() : NULL;
+  }
+
+  // Called before tags are modified: the snapshot is not up to date anymore
+  void invalidateSnapshot_ () {
+    if (snapshotCurrent_) {
+      setOption ("snapshotId", "");
+      snapshotCurrent_ = false;
+    }
   }
 
+public:
   void cleanIndex () {
+    if (symbols_) {
+      symbols_->clear();
+    }
+    invalidateSnapshot_();
+
     db_.execute ("DELETE FROM tags");
-    db_.execute ("UPDATE files SET indexed = 0");
+    db_.execute ("DELETE FROM diagnostics");
+    db_.execute ("DELETE FROM symbols");
+    db_.execute ("DELETE FROM kinds");
+    if (hasNameIndex_()) {
+      db_.execute ("INSERT INTO symbolNames (symbolNames) VALUES ('delete-all')");
+    }
+    db_.execute ("UPDATE files SET indexed = 0, hash = NULL");
+    symbolIds_.clear();
+    kindIds_.clear();
   }
 
   Sqlite::Transaction beginTransaction () {
     return Sqlite::Transaction(db_);
   }
 
+  enum LoadProfile {
+    Incremental,  // One transaction, all indexes maintained while inserting
+    Bulk          // Batched transactions, without durability guarantees
+  };
+
+  // A write-heavy session, such as an indexing run
+  //
+  // In the Bulk profile, fsync() is disabled for the duration of the load and
+  // rows are committed in large batches. Indexes which only serve queries are
+  // dropped, and rebuilt once at the end. Indexes used while loading (to
+  // replace the tags of a file, or to intern symbols) are kept.
+  //
+  // finish() should be called once all rows are loaded. If the load is
+  // abandoned instead (e.g. because of an exception), the destructor only ends
+  // the transaction and restores durability: dropped indexes are rebuilt when
+  // the database is opened again, or when the next load begins.
+  class Load {
+  public:
+    Load (Storage & storage, LoadProfile profile)
+      : db_ (storage.db_),
+        profile_ (profile),
+        pending_ (0),
+        nameIndex_ (storage.hasNameIndex_())
+    {
+      if (profile_ == Incremental) {
+        storage.repairIndexes_();
+      }
+      if (profile_ == Bulk) {
+        synchronous_ = db_.pragma ("synchronous");
+        db_.pragma ("synchronous", "OFF");
+        db_.execute ("DROP INDEX IF EXISTS tags_symbolId");
+        if (nameIndex_) {
+          db_.execute ("DROP TRIGGER IF EXISTS symbolNames_insert");
+        }
+      }
+      transaction_.reset (new Sqlite::Transaction (db_));
+    }
+
+    // Commit the last rows, and rebuild the indexes dropped by a Bulk load
+    void finish () {
+      transaction_.reset();
+      if (profile_ == Bulk) {
+        db_.execute ("CREATE INDEX IF NOT EXISTS tags_symbolId "
+                     "ON tags (symbolId)");
+        if (nameIndex_) {
+          db_.execute ("INSERT INTO symbolNames (symbolNames) VALUES ('rebuild')");
+          createNameTrigger_ (db_);
+        }
+        db_.pragma ("synchronous", synchronous_);
+        db_.execute ("PRAGMA wal_checkpoint(TRUNCATE)");
+      }
+    }
+
+    // May run while unwinding: errors are logged, not thrown
+    ~Load () {
+      try {
+        transaction_.reset();
+        if (profile_ == Bulk) {
+          db_.pragma ("synchronous", synchronous_);
+        }
+      } catch (std::exception & e) {
+        std::cerr << "Failed to end the load: " << e.what() << std::endl;
+      }
+    }
+
+    // Mark the end of a unit of work (e.g. a translation unit)
+    void step () {
+      if (profile_ == Bulk && ++pending_ >= batchSize_) {
+        transaction_.reset();
+        transaction_.reset (new Sqlite::Transaction (db_));
+        pending_ = 0;
+      }
+    }
+
+  private:
+    static const unsigned int batchSize_ = 256;
+
+    Sqlite::Database &                   db_;
+    LoadProfile                          profile_;
+    unsigned int                         pending_;
+    bool                                 nameIndex_;
+    std::string                          synchronous_;
+    std::unique_ptr<Sqlite::Transaction> transaction_;
+  };
+
   bool beginFile (const std::string & fileName) {
     int fileId = addFile_ (fileName);
 
     int indexed;
+    std::string hash;
     {
-      Sqlite::Statement stmt
-        = db_.prepare ("SELECT indexed FROM files WHERE id = ?")
+      Sqlite::Statement & stmt
+        = db_.cached ("SELECT indexed, IFNULL(hash, '') FROM files WHERE id = ?")
         .bind (fileId);
       stmt.step();
-      stmt >> indexed;
+      stmt >> indexed >> hash;
+      stmt.reset();
     }
 
     struct stat fileStat;
-    stat (fileName.c_str(), &fileStat);
+    if (stat (fileName.c_str(), &fileStat) != 0) {
+      return false;
+    }
     int modified = fileStat.st_mtime;
 
-    if (modified > indexed) {
-      db_.prepare ("DELETE FROM tags WHERE fileId=?").bind (fileId).step();
-      db_.prepare ("DELETE FROM includes WHERE sourceId=?").bind (fileId).step();
-      db_.prepare ("UPDATE files "
-                   "SET indexed=? "
-                   "WHERE id=?")
+    if (modified <= indexed) {
+      return false;
+    }
+
+    // The file was touched, but its contents did not change
+    const std::string newHash = hashFile_ (fileName);
+    if (newHash == hash) {
+      db_.cached ("UPDATE files SET indexed=? WHERE id=?")
         .bind (modified)
         .bind (fileId)
         .step();
-      return true;
-    } else {
       return false;
     }
+
+    if (symbols_) {
+      symbols_->clearFile (fileName);
+    }
+    invalidateSnapshot_();
+
+    db_.cached ("DELETE FROM tags WHERE fileId=?").bind (fileId).step();
+    db_.cached ("DELETE FROM includes WHERE sourceId=?").bind (fileId).step();
+    db_.cached ("UPDATE files "
+                 "SET indexed=?, hash=? "
+                 "WHERE id=?")
+      .bind (modified)
+      .bind (newHash)
+      .bind (fileId)
+      .step();
+    return true;
   }
 
   void addInclude (const int includedId,
                    const int sourceId)
   {
-    int res = db_.prepare ("SELECT * FROM includes "
-                           "WHERE sourceId=? "
-                           "  AND includedId=?")
-      .bind (sourceId) .bind (includedId)
-      .step ();
+    Sqlite::Statement & stmt
+      = db_.cached ("SELECT * FROM includes "
+                    "WHERE sourceId=? "
+                    "  AND includedId=?")
+      .bind (sourceId) .bind (includedId);
+    int res = stmt.step ();
+    stmt.reset();
     if (res == SQLITE_DONE) { // No matching row
-      db_.prepare ("INSERT INTO includes VALUES (?,?)")
+      db_.cached ("INSERT INTO includes VALUES (?,?)")
         .bind (sourceId) . bind (includedId)
         .step();
     }
@@ -179,7 +659,7 @@ public:
 
   void addInclude (const std::string & includedFile,
                    const std::string & sourceFile) {
-    int includedId = fileId_ (includedFile);
+    int includedId = addFile_ (includedFile);
     int sourceId   = fileId_ (sourceFile);
     if (includedId == -1 || sourceId == -1)
       throw std::runtime_error ("Cannot add inclusion for unknown files `"
@@ -187,62 +667,185 @@ public:
     addInclude (includedId, sourceId);
   }
 
+  // Names of all files known to the index
+  std::vector<std::string> fileNames () {
+    Sqlite::Statement & stmt = db_.cached ("SELECT name FROM files");
+
+    std::vector<std::string> res;
+    while (stmt.step() == SQLITE_ROW) {
+      std::string name;
+      stmt >> name;
+      res.push_back (name);
+    }
+    return res;
+  }
+
+  // Forget the tags of a file, which will be considered as never indexed.
+  // Its compilation command and inclusions are kept.
+  void clearFile (const std::string & fileName) {
+    if (symbols_) {
+      symbols_->clearFile (fileName);
+    }
+    invalidateSnapshot_();
+
+    const int fileId = fileId_ (fileName);
+    db_.cached ("DELETE FROM tags WHERE fileId=?").bind (fileId).step();
+    db_.cached ("UPDATE files SET indexed=0, hash=NULL WHERE id=?")
+      .bind (fileId)
+      .step();
+  }
+
+  // Whether the tags of a file are stored in the index
+  bool isIndexed (const std::string & fileName) {
+    Sqlite::Statement & stmt
+      = db_.cached ("SELECT indexed FROM files WHERE name=?")
+      .bind (fileName);
+
+    int indexed = 0;
+    if (stmt.step() == SQLITE_ROW) {
+      stmt >> indexed;
+    }
+    stmt.reset();
+    return indexed > 0;
+  }
+
+  struct IndexedFile {
+    std::string name;
+    std::string hash;    // of the contents of the file, when it was indexed
+    std::string source;  // a source file in which it was parsed
+  };
+
+  // Files whose tags are stored in the index
+  std::vector<IndexedFile> indexedFiles () {
+    Sqlite::Statement & stmt
+      = db_.cached ("SELECT file.name, IFNULL(file.hash, ''), "
+                    "  IFNULL((SELECT source.name FROM includes "
+                    "          INNER JOIN files AS source ON source.id = includes.sourceId "
+                    "          WHERE includes.includedId = file.id "
+                    "          ORDER BY includes.sourceId = includes.includedId DESC "
+                    "          LIMIT 1), '') "
+                    "FROM files AS file "
+                    "WHERE file.indexed > 0");
+
+    std::vector<IndexedFile> res;
+    while (stmt.step() == SQLITE_ROW) {
+      IndexedFile file;
+      stmt >> file.name >> file.hash >> file.source;
+      res.push_back (file);
+    }
+    return res;
+  }
+
+  // Hash of the contents of a file, as stored in the index
+  static std::string hashFile (const std::string & fileName) {
+    return hashFile_ (fileName);
+  }
+
   void removeFile (const std::string & fileName) {
+    if (symbols_) {
+      symbols_->clearFile (fileName);
+    }
+    invalidateSnapshot_();
+
     int fileId = fileId_ (fileName);
     db_
-      .prepare ("DELETE FROM commands WHERE fileId = ?")
+      .cached ("DELETE FROM commands WHERE fileId = ?")
       .bind (fileId)
       .step();
 
     db_
-      .prepare ("DELETE FROM includes WHERE sourceId = ?")
+      .cached ("DELETE FROM includes WHERE sourceId = ?")
       .bind (fileId)
       .step();
 
     db_
-      .prepare ("DELETE FROM includes WHERE includedId = ?")
+      .cached ("DELETE FROM includes WHERE includedId = ?")
       .bind (fileId)
       .step();
 
     db_
-      .prepare ("DELETE FROM tags WHERE fileId = ?")
+      .cached ("DELETE FROM tags WHERE fileId = ?")
       .bind (fileId)
       .step();
 
-    db_.prepare ("DELETE FROM files WHERE id = ?")
+    db_
+      .cached ("DELETE FROM diagnostics WHERE sourceId = ?")
+      .bind (fileId)
+      .step();
+
+    db_.cached ("DELETE FROM files WHERE id = ?")
       .bind (fileId)
       .step();
   }
 
-  void addTag (const std::string & usr,
-               const std::string & kind,
-               const std::string & spelling,
-               const std::string & fileName,
-               const int line1, const int col1, const int offset1,
-               const int line2, const int col2, const int offset2,
-               bool isDeclaration) {
+  typedef SymbolTable::Tag Tag;
+
+  // Tags are expected to be free of duplicates: they are not checked against
+  // the database, and beginFile() removed all previous tags for the file.
+  void addTags (const std::string & fileName,
+                const std::vector<Tag> & tags) {
     int fileId = fileId_ (fileName);
     if (fileId == -1) {
       return;
     }
+    invalidateSnapshot_();
+
+    if (symbols_) {
+      symbols_->addTags (fileName, tags);
+    }
+    Metrics::global().count ("tags.written", tags.size());
 
-    Sqlite::Statement stmt =
-      db_.prepare ("SELECT * FROM tags "
-                   "WHERE fileId=? "
-                   "  AND usr=?"
-                   "  AND offset1=?"
-                   "  AND offset2=?")
-      .bind (fileId).bind (usr).bind (offset1).bind (offset2);
-    if (stmt.step() == SQLITE_DONE) { // no matching row
-      db_.prepare ("INSERT INTO tags VALUES (?,?,?,?,?,?,?,?,?,?,?)")
-        .bind(fileId) .bind(usr)  .bind(kind)    .bind(spelling)
-        .bind(line1)  .bind(col1) .bind(offset1)
-        .bind(line2)  .bind(col2) .bind(offset2)
-        .bind(isDeclaration)
+    Sqlite::Statement & stmt =
+      db_.cached ("INSERT INTO tags VALUES (?,?,?,?,?,?,?,?,?,?)");
+
+    auto tag = tags.begin();
+    auto end = tags.end();
+    for ( ; tag != end ; ++tag) {
+      const int symbolId = symbolId_ (tag->usr, tag->spelling);
+      const int kindId   = kindId_ (tag->kind);
+      stmt.reset()
+        .bind(fileId)      .bind(symbolId)  .bind(kindId)
+        .bind(tag->line1)  .bind(tag->col1) .bind(tag->offset1)
+        .bind(tag->line2)  .bind(tag->col2) .bind(tag->offset2)
+        .bind(tag->isDeclaration)
         .step();
     }
   }
 
+  // Same as addTags(), but skip tags whose (usr, offset1, offset2) is already
+  // known in the file
+  void addMissingTags (const std::string & fileName,
+                       const std::vector<Tag> & tags) {
+    int fileId = fileId_ (fileName);
+    if (fileId == -1) {
+      return;
+    }
+    invalidateSnapshot_();
+
+    Sqlite::Statement & stmt =
+      db_.cached ("SELECT 1 FROM tags "
+                  "INNER JOIN symbols ON symbols.id = tags.symbolId "
+                  "WHERE tags.fileId=? AND tags.offset1=? AND tags.offset2=? "
+                  "  AND symbols.usr=?");
+
+    std::vector<Tag> missing;
+    auto tag = tags.begin();
+    auto end = tags.end();
+    for ( ; tag != end ; ++tag) {
+      stmt.reset()
+        .bind(fileId) .bind(tag->offset1) .bind(tag->offset2) .bind(tag->usr);
+      if (stmt.step() == SQLITE_DONE) {
+        missing.push_back (*tag);
+      }
+    }
+    stmt.reset();
+    Metrics::global().count ("tags.duplicates", tags.size() - missing.size());
+
+    if (!missing.empty()) {
+      addTags (fileName, missing);
+    }
+  }
+
   struct Reference {
     std::string file;
     int line1;
@@ -307,15 +910,26 @@ public:
 
   std::vector<RefDef> findDefinition (const std::string fileName,
                        int offset) {
+    if (symbols_) {
+      return refDefs_ (symbols_->findDefinition (fileName, offset), fileName);
+    }
+    if (const Snapshot * snapshot = snapshot_()) {
+      return refDefs_ (snapshot->findDefinition (fileName, offset), fileName);
+    }
+
     int fileId = fileId_ (fileName);
-    Sqlite::Statement stmt =
-      db_.prepare ("SELECT ref.offset1, ref.offset2, ref.kind, ref.spelling,"
-                   "       def.usr, defFile.name,"
+    Sqlite::Statement & stmt =
+      db_.cached ("SELECT ref.offset1, ref.offset2, refKind.name, refSymbol.spelling,"
+                   "       defSymbol.usr, defFile.name,"
                    "       def.line1, def.line2, def.col1, def.col2, "
-                   "       def.kind, def.spelling "
+                   "       defKind.name, defSymbol.spelling "
                    "FROM tags AS ref "
-                   "INNER JOIN tags AS def ON def.usr = ref.usr "
+                   "INNER JOIN symbols AS refSymbol ON refSymbol.id = ref.symbolId "
+                   "INNER JOIN symbols AS defSymbol ON defSymbol.usr = refSymbol.usr "
+                   "INNER JOIN tags AS def ON def.symbolId = defSymbol.id "
                    "INNER JOIN files AS defFile ON def.fileId = defFile.id "
+                   "INNER JOIN kinds AS refKind ON refKind.id = ref.kindId "
+                   "INNER JOIN kinds AS defKind ON defKind.id = def.kindId "
                    "WHERE def.isDecl = 1 "
                    "  AND ref.fileId = ?  "
                    "  AND ref.offset1 <= ? "
@@ -341,32 +955,386 @@ public:
     return ret;
   }
 
-  std::vector<Reference> grep (const std::string usr) {
-    Sqlite::Statement stmt =
-      db_.prepare("SELECT ref.line1, ref.line2, ref.col1, ref.col2, "
-                  "       ref.offset1, ref.offset2, refFile.name, ref.kind "
-                  "FROM tags AS ref "
+  // Call f(const Reference &) for each reference to a symbol, as rows are
+  // read from the database. Only references located in files whose name
+  // starts with filePrefix are considered; they are sorted by file name and
+  // offset, so that successive pages neither overlap nor skip references. The
+  // first `offset' of them are skipped, and at most `limit' are returned (0
+  // meaning no limit).
+  template <typename F>
+  void grep (const std::string & usr,
+             const std::string & filePrefix,
+             unsigned int offset,
+             unsigned int limit,
+             F f) {
+    if (symbols_) {
+      references_ (symbols_->grep (usr, filePrefix, offset, limit), f);
+      return;
+    }
+    if (const Snapshot * snapshot = snapshot_()) {
+      references_ (snapshot->grep (usr, filePrefix, offset, limit), f);
+      return;
+    }
+
+    Sqlite::Statement & stmt =
+      db_.cached ("SELECT ref.line1, ref.line2, ref.col1, ref.col2, "
+                  "       ref.offset1, ref.offset2, refFile.name, kinds.name "
+                  "FROM symbols "
+                  "INNER JOIN tags AS ref ON ref.symbolId = symbols.id "
                   "INNER JOIN files AS refFile ON ref.fileId = refFile.id "
-                  "WHERE ref.usr = ?")
-      .bind (usr);
+                  "INNER JOIN kinds ON kinds.id = ref.kindId "
+                  "WHERE symbols.usr = ? "
+                  "  AND substr(refFile.name, 1, ?) = ? "
+                  "ORDER BY refFile.name, ref.offset1 "
+                  "LIMIT ? OFFSET ?")
+      .bind (usr)
+      .bind ((int)filePrefix.size())
+      .bind (filePrefix)
+      .bind (limit > 0 ? (int)limit : -1)
+      .bind ((int)offset);
 
-    std::vector<Reference> ret;
+    // The same object is reused for all rows, so that its strings need not be
+    // allocated again
+    Reference ref;
     while (stmt.step() == SQLITE_ROW) {
-      Reference ref;
       stmt >> ref.line1 >> ref.line2 >> ref.col1 >> ref.col2
            >> ref.offset1 >> ref.offset2 >> ref.file >> ref.kind;
-      ret.push_back (ref);
+      f (ref);
+    }
+  }
+
+  std::vector<Reference> grep (const std::string & usr) {
+    std::vector<Reference> ret;
+    grep (usr, "", 0, 0, [&ret] (const Reference & ref) {
+        ret.push_back (ref);
+      });
+    return ret;
+  }
+
+  // References located at an offset in a file, most specific first. Only the
+  // USR of the referenced symbol is set in the definitions: they are looked up
+  // separately with findDeclarations(), possibly in another database.
+  std::vector<RefDef> findReferences (const std::string & fileName,
+                                      int offset) {
+    Sqlite::Statement & stmt =
+      db_.cached ("SELECT ref.line1, ref.line2, ref.col1, ref.col2, "
+                  "       ref.offset1, ref.offset2, kinds.name, symbols.spelling,"
+                  "       symbols.usr "
+                  "FROM files "
+                  "INNER JOIN tags AS ref ON ref.fileId = files.id "
+                  "INNER JOIN symbols ON symbols.id = ref.symbolId "
+                  "INNER JOIN kinds ON kinds.id = ref.kindId "
+                  "WHERE files.name = ? "
+                  "  AND ref.offset1 <= ? "
+                  "  AND ref.offset2 >= ? "
+                  "ORDER BY (ref.offset2 - ref.offset1)")
+      .bind (fileName)
+      .bind (offset)
+      .bind (offset);
+
+    std::vector<RefDef> ret;
+    while (stmt.step() == SQLITE_ROW) {
+      RefDef refDef;
+      Reference & ref = refDef.ref;
+      stmt >> ref.line1 >> ref.line2 >> ref.col1 >> ref.col2
+           >> ref.offset1 >> ref.offset2 >> ref.kind >> ref.spelling
+           >> refDef.def.usr;
+      ref.file = fileName;
+      ret.push_back (refDef);
+    }
+    return ret;
+  }
+
+  // Declarations of a symbol
+  std::vector<Definition> findDeclarations (const std::string & usr) {
+    Sqlite::Statement & stmt =
+      db_.cached ("SELECT files.name, def.line1, def.line2, def.col1, def.col2, "
+                  "       kinds.name, symbols.spelling "
+                  "FROM symbols "
+                  "INNER JOIN tags AS def ON def.symbolId = symbols.id "
+                  "INNER JOIN files ON files.id = def.fileId "
+                  "INNER JOIN kinds ON kinds.id = def.kindId "
+                  "WHERE symbols.usr = ? "
+                  "  AND def.isDecl = 1")
+      .bind (usr);
+
+    std::vector<Definition> ret;
+    while (stmt.step() == SQLITE_ROW) {
+      Definition def;
+      def.usr = usr;
+      stmt >> def.file >> def.line1 >> def.line2 >> def.col1 >> def.col2
+           >> def.kind >> def.spelling;
+      ret.push_back (def);
+    }
+    return ret;
+  }
+
+  // Pattern matched against symbol names by search()
+  struct NamePattern {
+    explicit NamePattern (const std::string & pattern)
+      : glob (lowerCase_ (pattern))
+    {
+      if (glob.find_first_of ("*?") == std::string::npos) {
+        glob = "*" + glob + "*";
+      }
+      core = glob;
+      core.erase (0, core.find_first_not_of ('*'));
+      core.erase (core.find_last_not_of ('*') + 1);
+    }
+
+    // Rank of a matching name (smaller is better)
+    std::tuple<bool, bool, size_t, std::string>
+    rank (const std::string & spelling) const {
+      const std::string name = lowerCase_ (spelling);
+      return std::make_tuple (name != core,
+                              fnmatch ((core + "*").c_str(), name.c_str(), 0) != 0,
+                              spelling.size(), spelling);
+    }
+
+    std::string glob;  // lower-case glob pattern
+    std::string core;  // glob without leading and trailing '*'
+  };
+
+  // Declarations of the symbols whose name matches a pattern
+  //
+  // The pattern is a case-insensitive glob ('*' and '?' wildcards); a pattern
+  // without wildcards matches names containing it. Results are ranked: exact
+  // matches first, then names starting with the pattern, then shorter names.
+  //
+  // kinds, if not empty, restricts the results to these kinds of declarations.
+  // At most limit declarations are returned (0 for no limit).
+  std::vector<Definition> search (const std::string & pattern,
+                                  const std::vector<std::string> & kinds,
+                                  unsigned int limit) {
+    const NamePattern name (pattern);
+
+    std::string kindList;
+    for (auto kind = kinds.begin() ; kind != kinds.end() ; ++kind) {
+      kindList += "," + *kind;
+    }
+    if (kindList != "") {
+      kindList += ",";
+    }
+
+    // The trigram index can only select names containing at least 3 known
+    // characters; other patterns are matched against all names
+    const std::string query = nameQuery_ (name.glob);
+    const bool useIndex = query != "" && hasNameIndex_();
+    const std::string prefix = name.core + "*";
+
+    static const std::string select
+      = "SELECT symbols.usr, files.name, def.line1, def.line2, "
+        "       def.col1, def.col2, kinds.name, symbols.spelling ";
+    static const std::string filter
+      = "INNER JOIN tags AS def ON def.symbolId = symbols.id "
+        "INNER JOIN files ON files.id = def.fileId "
+        "INNER JOIN kinds ON kinds.id = def.kindId "
+        "WHERE lower(symbols.spelling) GLOB ? "
+        "  AND def.isDecl = 1 "
+        "  AND (? = '' OR instr(?, ',' || kinds.name || ',') > 0) "
+        "ORDER BY lower(symbols.spelling) = ? DESC, "
+        "         lower(symbols.spelling) GLOB ? DESC, "
+        "         length(symbols.spelling), symbols.spelling, "
+        "         files.name, def.line1 "
+        "LIMIT ?";
+    static const std::string fromIndex
+      = select
+      + "FROM symbolNames "
+        "INNER JOIN symbols ON symbols.id = symbolNames.rowid "
+        "  AND symbolNames MATCH ? "
+      + filter;
+    static const std::string fromSymbols
+      = select + "FROM symbols " + filter;
+
+    Sqlite::Statement & stmt
+      = db_.cached ((useIndex ? fromIndex : fromSymbols).c_str());
+
+    if (useIndex) {
+      stmt.bind (query);
+    }
+    stmt.bind (name.glob)
+      .bind (kindList)
+      .bind (kindList)
+      .bind (name.core)
+      .bind (prefix)
+      .bind (limit > 0 ? int (limit) : -1);
+
+    std::vector<Definition> ret;
+    while (stmt.step() == SQLITE_ROW) {
+      Definition def;
+      stmt >> def.usr >> def.file >> def.line1 >> def.line2 >> def.col1 >> def.col2
+           >> def.kind >> def.spelling;
+      ret.push_back (def);
+    }
+    return ret;
+  }
+
+  struct Diagnostic {
+    // Replace the code between two locations
+    struct FixIt {
+      std::string file;
+      int line1;
+      int col1;
+      int offset1;
+      int line2;
+      int col2;
+      int offset2;
+      std::string replacement;
+
+      Json::Value json () const {
+        Json::Value json;
+        json["file"]        = file;
+        json["line1"]       = line1;
+        json["col1"]        = col1;
+        json["offset1"]     = offset1;
+        json["line2"]       = line2;
+        json["col2"]        = col2;
+        json["offset2"]     = offset2;
+        json["replacement"] = replacement;
+        return json;
+      }
+    };
+
+    std::string file;      // where the diagnostic is located
+    std::string source;    // translation unit in which it was emitted
+    int severity;          // as a CXDiagnosticSeverity (1: note ... 4: fatal)
+    int line;
+    int col;
+    int offset;
+    std::string message;
+    std::string option;    // command-line option enabling it, if any
+    std::vector<FixIt> fixIts;
+
+    Json::Value json () const {
+      Json::Value json;
+      json["file"]     = file;
+      json["source"]   = source;
+      json["severity"] = severityName (severity);
+      json["line"]     = line;
+      json["col"]      = col;
+      json["offset"]   = offset;
+      json["message"]  = message;
+      json["option"]   = option;
+      json["fixIts"]   = Json::Value (Json::arrayValue);
+      for (auto it = fixIts.begin() ; it != fixIts.end() ; ++it) {
+        json["fixIts"].append (it->json());
+      }
+      return json;
+    }
+
+    static std::string severityName (int severity) {
+      switch (severity) {
+      case 1: return "note";
+      case 2: return "warning";
+      case 3: return "error";
+      case 4: return "fatal";
+      }
+      return "ignored";
+    }
+
+    // Inverse of severityName()
+    static int severityLevel (const std::string & name) {
+      for (int severity = 0 ; severity <= 4 ; ++severity) {
+        if (severityName (severity) == name) {
+          return severity;
+        }
+      }
+      throw std::runtime_error ("Unknown diagnostic severity: `" + name + "'");
+    }
+  };
+
+  // Replace the diagnostics emitted when parsing a source file
+  void setDiagnostics (const std::string & sourceName,
+                       const std::vector<Diagnostic> & diagnostics) {
+    const int sourceId = fileId_ (sourceName);
+    if (sourceId == -1) {
+      return;
+    }
+
+    db_.cached ("DELETE FROM diagnostics WHERE sourceId=?").bind (sourceId).step();
+
+    Json::FastWriter writer;
+    for (auto it = diagnostics.begin() ; it != diagnostics.end() ; ++it) {
+      std::string fixIts;
+      if (!it->fixIts.empty()) {
+        Json::Value json (Json::arrayValue);
+        for (auto fixIt = it->fixIts.begin() ; fixIt != it->fixIts.end() ; ++fixIt) {
+          json.append (fixIt->json());
+        }
+        fixIts = writer.write (json);
+      }
+
+      db_.cached ("INSERT INTO diagnostics "
+                  "  (sourceId, file, severity, line, col, offset, message, option, fixIts) "
+                  "VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?)")
+        .bind (sourceId)
+        .bind (it->file)
+        .bind (it->severity)
+        .bind (it->line)
+        .bind (it->col)
+        .bind (it->offset)
+        .bind (it->message)
+        .bind (it->option)
+        .bind (fixIts)
+        .step();
+    }
+  }
+
+  // Diagnostics located in a file (in all files if fileName is empty), of at
+  // least a given severity, sorted by location
+  std::vector<Diagnostic> diagnostics (const std::string & fileName,
+                                       int severity) {
+    static const std::string select
+      = "SELECT diagnostics.file, source.name, severity, line, col, offset, "
+        "       message, option, fixIts "
+        "FROM diagnostics "
+        "INNER JOIN files AS source ON source.id = diagnostics.sourceId "
+        "WHERE severity >= ? ";
+    static const std::string order
+      = "ORDER BY diagnostics.file, offset";
+
+    Sqlite::Statement & stmt = fileName == ""
+      ? db_.cached ((select + order).c_str()).bind (severity)
+      : db_.cached ((select + "AND diagnostics.file = ? " + order).c_str())
+          .bind (severity)
+          .bind (fileName);
+
+    std::vector<Diagnostic> ret;
+    while (stmt.step() == SQLITE_ROW) {
+      Diagnostic diagnostic;
+      std::string fixIts;
+      stmt >> diagnostic.file >> diagnostic.source >> diagnostic.severity
+           >> diagnostic.line >> diagnostic.col >> diagnostic.offset
+           >> diagnostic.message >> diagnostic.option >> fixIts;
+
+      Json::Value json;
+      Json::Reader reader;
+      if (fixIts != "" && reader.parse (fixIts, json)) {
+        for (unsigned int i = 0 ; i < json.size() ; ++i) {
+          Diagnostic::FixIt fixIt;
+          fixIt.file        = json[i]["file"].asString();
+          fixIt.line1       = json[i]["line1"].asInt();
+          fixIt.col1        = json[i]["col1"].asInt();
+          fixIt.offset1     = json[i]["offset1"].asInt();
+          fixIt.line2       = json[i]["line2"].asInt();
+          fixIt.col2        = json[i]["col2"].asInt();
+          fixIt.offset2     = json[i]["offset2"].asInt();
+          fixIt.replacement = json[i]["replacement"].asString();
+          diagnostic.fixIts.push_back (fixIt);
+        }
+      }
+      ret.push_back (diagnostic);
     }
     return ret;
   }
 
   void setOption (const std::string & name, const std::string & value) {
-    db_.prepare ("DELETE FROM options "
+    db_.cached ("DELETE FROM options "
                  "WHERE name = ?")
       .bind (name)
       .step();
 
-    db_.prepare ("INSERT INTO options "
+    db_.cached ("INSERT INTO options "
                  "VALUES (?, ?)")
       .bind (name)
       .bind (value)
@@ -379,8 +1347,8 @@ public:
 
 
   std::string getOption (const std::string & name) {
-    Sqlite::Statement stmt =
-      db_.prepare ("SELECT value FROM options "
+    Sqlite::Statement & stmt =
+      db_.cached ("SELECT value FROM options "
                    "WHERE name = ?")
       .bind (name);
 
@@ -391,6 +1359,8 @@ public:
       throw std::runtime_error ("No stored value for option: `" + name + "'");
     }
 
+    // Do not leave a pending read, which would prevent schema changes
+    stmt.reset();
     return ret;
   }
 
@@ -401,10 +1371,535 @@ public:
     return ret;
   }
 
+  // Path of the database file
+  const std::string & path () const {
+    return path_;
+  }
+
+  // Check that the database can be queried by this version: read-only
+  // connections can not upgrade it
+  void checkSchema () {
+    const int version = schemaVersion();
+    if (version != schemaVersion_) {
+      std::ostringstream msg;
+      msg << "Database `" << path_ << "' uses schema version " << version
+          << " (expected " << schemaVersion_ << "): it should be indexed again";
+      throw std::runtime_error (msg.str());
+    }
+  }
+
+  // Statistics of the statement cache of this connection
+  unsigned long statementCacheHits () const {
+    return db_.cacheHits();
+  }
+
+  unsigned long statementCacheMisses () const {
+    return db_.cacheMisses();
+  }
+
+  // Names of the SQLite tunables which can be configured
+  static std::vector<std::string> tunables () {
+    std::vector<std::string> names;
+    for (const Tunable * t = tunables_() ; t->name != NULL ; ++t) {
+      names.push_back (t->name);
+    }
+    return names;
+  }
+
+  // Pragma values are inserted as is in SQL code: only simple values (names
+  // and integers) are accepted.
+  static void checkPragma (const std::string & name, const std::string & value) {
+    if (tunable_ (name) == NULL) {
+      throw std::runtime_error ("Unknown SQLite tunable: `" + name + "'");
+    }
+
+    const bool valid = value != ""
+      && std::all_of (value.begin(), value.end(), [] (char c) {
+          return isalnum (c) || c == '-' || c == '_';
+        });
+    if (!valid) {
+      throw std::runtime_error ("Invalid value for SQLite tunable `" + name
+                                + "': `" + value + "'");
+    }
+  }
+
+  // Current value of a tunable
+  std::string pragma (const std::string & name) {
+    checkPragma (name, "0");
+    return db_.pragma (name);
+  }
+
+  // Change a tunable, and store its value for the next connections
+  std::string setPragma (const std::string & name, const std::string & value) {
+    checkPragma (name, value);
+    setOption ("pragma." + name, value);
+    return db_.pragma (name, value);
+  }
+
 private:
+  struct Tunable {
+    const char * name;
+    const char * defaultValue;  // NULL to keep SQLite's default
+    bool         readOnly;      // Also applied to read-only connections
+  };
+
+  // The page size only affects new databases, and databases vacuumed outside
+  // of WAL mode. With WAL, a NORMAL synchronous mode is safe against
+  // corruption, and only loses the last transactions on power failure.
+  static const Tunable * tunables_ () {
+    static const Tunable tunables[] = {
+      {"journal_mode", "WAL",    false},
+      {"synchronous",  "NORMAL", false},
+      {"cache_size",   NULL,     true},
+      {"mmap_size",    NULL,     true},
+      {"temp_store",   NULL,     true},
+      {"page_size",    NULL,     false},
+      {NULL,           NULL,     false}
+    };
+    return tunables;
+  }
+
+  static const Tunable * tunable_ (const std::string & name) {
+    for (const Tunable * t = tunables_() ; t->name != NULL ; ++t) {
+      if (name == t->name) {
+        return t;
+      }
+    }
+    return NULL;
+  }
+
+  // Apply the tunables given to the constructor, those stored in the options
+  // table, or their defaults, in this order of precedence
+  void configure_ (Mode mode) {
+    for (const Tunable * t = tunables_() ; t->name != NULL ; ++t) {
+      if (mode != ReadWrite && !t->readOnly) {
+        continue;
+      }
+
+      auto given = pragmas_.find (t->name);
+      std::string value;
+      if (given != pragmas_.end()) {
+        value = given->second;
+      } else {
+        try {
+          value = getOption (std::string ("pragma.") + t->name);
+          checkPragma (t->name, value);
+        } catch (std::runtime_error &) {
+          if (t->defaultValue == NULL) {
+            continue;
+          }
+          value = t->defaultValue;
+        }
+      }
+
+      db_.pragma (t->name, value);
+    }
+  }
+
+  // Results of the symbol table or snapshot
+  typedef std::vector<std::pair<SymbolTable::Location, SymbolTable::Location> >
+                                                                  LocationPairs;
+
+  std::vector<RefDef> refDefs_ (const LocationPairs & found,
+                                const std::string & fileName) {
+    std::vector<RefDef> ret;
+    for (auto it = found.begin() ; it != found.end() ; ++it) {
+      const SymbolTable::Tag & refTag = it->first.tag;
+      const SymbolTable::Tag & defTag = it->second.tag;
+
+      RefDef refDef;
+      Reference & ref = refDef.ref;
+      Definition & def = refDef.def;
+      ref.file     = fileName;
+      ref.line1    = refTag.line1;
+      ref.line2    = refTag.line2;
+      ref.col1     = refTag.col1;
+      ref.col2     = refTag.col2;
+      ref.offset1  = refTag.offset1;
+      ref.offset2  = refTag.offset2;
+      ref.kind     = refTag.kind;
+      ref.spelling = refTag.spelling;
+      def.usr      = defTag.usr;
+      def.file     = it->second.file;
+      def.line1    = defTag.line1;
+      def.line2    = defTag.line2;
+      def.col1     = defTag.col1;
+      def.col2     = defTag.col2;
+      def.kind     = defTag.kind;
+      def.spelling = defTag.spelling;
+      ret.push_back (refDef);
+    }
+    return ret;
+  }
+
+  template <typename F>
+  void references_ (const std::vector<SymbolTable::Location> & found, F & f) {
+    Reference ref;
+    for (auto it = found.begin() ; it != found.end() ; ++it) {
+      ref.file    = it->file;
+      ref.line1   = it->tag.line1;
+      ref.line2   = it->tag.line2;
+      ref.col1    = it->tag.col1;
+      ref.col2    = it->tag.col2;
+      ref.offset1 = it->tag.offset1;
+      ref.offset2 = it->tag.offset2;
+      ref.kind    = it->tag.kind;
+      f (ref);
+    }
+  }
+
+  // Version of the database layout created by this code. Databases created by
+  // older versions are upgraded by migrate_().
+  static const int schemaVersion_ = 5;
+
+  int schemaVersion () {
+    int version = 0;
+    try {
+      std::istringstream (getOption ("schemaVersion")) >> version;
+    } catch (std::runtime_error &) {
+      // Databases created before schema versioning
+    }
+    return version;
+  }
+
+  // Upgrade the database schema, one version at a time
+  void migrate_ () {
+    const int version = schemaVersion();
+
+    if (version > schemaVersion_) {
+      std::ostringstream msg;
+      msg << "Database schema version " << version
+          << " is more recent than supported (" << schemaVersion_ << ")";
+      throw std::runtime_error (msg.str());
+    }
+
+    if (version < 1) {
+      // Secondary indexes
+      Sqlite::Transaction transaction (db_);
+
+      // Old databases might contain duplicate file names, which would prevent
+      // the creation of a unique index. Rows referencing a duplicate are
+      // repointed to the first file of the same name, so that none is left
+      // orphaned.
+      db_.execute ("CREATE TEMP TABLE duplicateFiles ("
+                   "  id     INTEGER PRIMARY KEY,"
+                   "  keepId INTEGER"
+                   ")");
+      db_.execute ("INSERT INTO duplicateFiles "
+                   "SELECT files.id, keep.id FROM files "
+                   "INNER JOIN (SELECT name, MIN(id) AS id FROM files GROUP BY name) AS keep "
+                   "        ON keep.name = files.name "
+                   "WHERE files.id <> keep.id");
+      const char * references[][2] = {{"commands", "fileId"},
+                                      {"includes", "sourceId"},
+                                      {"includes", "includedId"},
+                                      {"tags",     "fileId"}};
+      for (unsigned int i = 0 ; i < 4 ; ++i) {
+        const std::string table  = references[i][0];
+        const std::string column = references[i][1];
+        db_.execute (("UPDATE " + table + " SET " + column + " = "
+                      "  (SELECT keepId FROM duplicateFiles WHERE id = " + column + ") "
+                      "WHERE " + column + " IN (SELECT id FROM duplicateFiles)").c_str());
+      }
+      db_.execute ("DELETE FROM files "
+                   "WHERE id IN (SELECT id FROM duplicateFiles)");
+      db_.execute ("DROP TABLE duplicateFiles");
+
+      db_.execute ("CREATE UNIQUE INDEX IF NOT EXISTS files_name "
+                   "ON files (name)");
+      db_.execute ("CREATE INDEX IF NOT EXISTS commands_fileId "
+                   "ON commands (fileId)");
+      db_.execute ("CREATE INDEX IF NOT EXISTS includes_includedId "
+                   "ON includes (includedId)");
+      db_.execute ("CREATE INDEX IF NOT EXISTS includes_sourceId "
+                   "ON includes (sourceId)");
+      db_.execute ("CREATE INDEX IF NOT EXISTS tags_usr "
+                   "ON tags (usr)");
+      db_.execute ("CREATE INDEX IF NOT EXISTS tags_location "
+                   "ON tags (fileId, offset1, offset2)");
+      setOption ("schemaVersion", "1");
+    }
+
+    if (version < 2) {
+      // Content hashes, to avoid re-indexing files which were only touched
+      Sqlite::Transaction transaction (db_);
+      db_.execute ("ALTER TABLE files ADD COLUMN hash TEXT");
+      setOption ("schemaVersion", "2");
+    }
+
+    if (version < 3) {
+      // USRs, spellings and kinds are stored once, and referenced by tags
+      {
+        Sqlite::Transaction transaction (db_);
+        db_.execute ("CREATE TABLE symbols ("
+                     "  id       INTEGER PRIMARY KEY,"
+                     "  usr      TEXT,"
+                     "  spelling TEXT"
+                     ")");
+        db_.execute ("CREATE UNIQUE INDEX symbols_usr "
+                     "ON symbols (usr, spelling)");
+        db_.execute ("CREATE TABLE kinds ("
+                     "  id   INTEGER PRIMARY KEY,"
+                     "  name TEXT UNIQUE"
+                     ")");
+
+        db_.execute ("INSERT INTO symbols (usr, spelling) "
+                     "SELECT DISTINCT usr, spelling FROM tags");
+        db_.execute ("INSERT INTO kinds (name) "
+                     "SELECT DISTINCT kind FROM tags");
+
+        db_.execute ("CREATE TABLE newTags ("
+                     "  fileId   INTEGER REFERENCES files(id),"
+                     "  symbolId INTEGER REFERENCES symbols(id),"
+                     "  kindId   INTEGER REFERENCES kinds(id),"
+                     "  line1    INTEGER,"
+                     "  col1     INTEGER,"
+                     "  offset1  INTEGER,"
+                     "  line2    INTEGER,"
+                     "  col2     INTEGER,"
+                     "  offset2  INTEGER,"
+                     "  isDecl   BOOLEAN"
+                     ")");
+        db_.execute ("INSERT INTO newTags "
+                     "SELECT tags.fileId, symbols.id, kinds.id, "
+                     "       tags.line1, tags.col1, tags.offset1, "
+                     "       tags.line2, tags.col2, tags.offset2, tags.isDecl "
+                     "FROM tags "
+                     "INNER JOIN symbols ON symbols.usr = tags.usr "
+                     "                  AND symbols.spelling = tags.spelling "
+                     "INNER JOIN kinds ON kinds.name = tags.kind");
+        db_.execute ("DROP TABLE tags");
+        db_.execute ("ALTER TABLE newTags RENAME TO tags");
+
+        db_.execute ("CREATE INDEX tags_symbolId "
+                     "ON tags (symbolId)");
+        db_.execute ("CREATE INDEX tags_location "
+                     "ON tags (fileId, offset1, offset2)");
+        setOption ("schemaVersion", "3");
+      }
+
+      // Give the space back to the file system
+      db_.execute ("VACUUM");
+    }
+
+    if (version < 4) {
+      // Trigram index of symbol names, for search(). SQLite may have been
+      // built without FTS5, in which case names are scanned.
+      Sqlite::Transaction transaction (db_);
+      try {
+        db_.execute ("CREATE VIRTUAL TABLE symbolNames USING fts5 ("
+                     "  spelling,"
+                     "  content='symbols', content_rowid='id',"
+                     "  tokenize='trigram'"
+                     ")");
+        db_.execute ("INSERT INTO symbolNames (symbolNames) VALUES ('rebuild')");
+        createNameTrigger_ (db_);
+      } catch (Sqlite::Error & e) {
+        std::cerr << "Warning: symbol names will not be indexed: " << e.what()
+                  << std::endl;
+      }
+      setOption ("schemaVersion", "4");
+    }
+
+    if (version < 5) {
+      // Diagnostics emitted while indexing, queried by diagnostics()
+      Sqlite::Transaction transaction (db_);
+      db_.execute ("CREATE TABLE diagnostics ("
+                   "  sourceId INTEGER REFERENCES files(id),"
+                   "  file     TEXT,"
+                   "  severity INTEGER,"
+                   "  line     INTEGER,"
+                   "  col      INTEGER,"
+                   "  offset   INTEGER,"
+                   "  message  TEXT,"
+                   "  option   TEXT,"
+                   "  fixIts   TEXT"
+                   ")");
+      db_.execute ("CREATE INDEX diagnostics_sourceId "
+                   "ON diagnostics (sourceId)");
+      db_.execute ("CREATE INDEX diagnostics_file "
+                   "ON diagnostics (file, offset)");
+      setOption ("schemaVersion", "5");
+    }
+  }
+
+  // Symbols are never deleted individually (only by cleanIndex()), so that
+  // only insertions need to be mirrored in the name index
+  static void createNameTrigger_ (Sqlite::Database & db) {
+    db.execute ("CREATE TRIGGER IF NOT EXISTS symbolNames_insert "
+                "AFTER INSERT ON symbols BEGIN "
+                "  INSERT INTO symbolNames (rowid, spelling) "
+                "  VALUES (new.id, new.spelling); "
+                "END");
+  }
+
+  bool hasNameIndex_ () {
+    return hasSchemaObject_ ("table", "symbolNames");
+  }
+
+  bool hasSchemaObject_ (const std::string & type, const std::string & name) {
+    Sqlite::Statement & stmt
+      = db_.cached ("SELECT COUNT(*) FROM sqlite_master "
+                    "WHERE type = ? AND name = ?")
+      .bind (type)
+      .bind (name);
+    stmt.step();
+    int count;
+    stmt >> count;
+    stmt.reset();
+    return count > 0;
+  }
+
+  // Recreate the index and trigger dropped by a Bulk load which was abandoned
+  // (e.g. because the server was killed), so that later loads keep them up to
+  // date
+  void repairIndexes_ () {
+    if (!hasSchemaObject_ ("index", "tags_symbolId")) {
+      std::cerr << "Rebuilding the index of tags by symbol" << std::endl;
+      db_.execute ("CREATE INDEX tags_symbolId "
+                   "ON tags (symbolId)");
+    }
+
+    if (hasNameIndex_() && !hasSchemaObject_ ("trigger", "symbolNames_insert")) {
+      std::cerr << "Rebuilding the index of symbol names" << std::endl;
+      Sqlite::Transaction transaction (db_);
+      db_.execute ("INSERT INTO symbolNames (symbolNames) VALUES ('rebuild')");
+      createNameTrigger_ (db_);
+    }
+  }
+
+  // Full-text query selecting names which contain all literal runs of at
+  // least 3 characters of a glob pattern (empty if there are none)
+  static std::string nameQuery_ (const std::string & glob) {
+    std::string query;
+    std::string run;
+    for (size_t i = 0 ; i <= glob.size() ; ++i) {
+      const char c = i < glob.size() ? glob[i] : '*';
+      if (c == '[') {
+        // Character class: matches any single character
+        i = std::min (glob.find (']', i + 2), glob.size());
+      } else if (c != '*' && c != '?') {
+        run += c;
+        continue;
+      }
+      if (run.size() >= 3) {
+        std::string quoted;
+        for (auto it = run.begin() ; it != run.end() ; ++it) {
+          quoted += *it;
+          if (*it == '"') {
+            quoted += '"';
+          }
+        }
+        query += (query == "" ? "\"" : " AND \"") + quoted + "\"";
+      }
+      run.clear();
+    }
+    return query;
+  }
+
+  static std::string lowerCase_ (std::string s) {
+    std::transform (s.begin(), s.end(), s.begin(), ::tolower);
+    return s;
+  }
+
+  // Interned symbols and kinds. IDs are remembered, so that tags can be
+  // inserted without querying the database for each of them.
+  int symbolId_ (const std::string & usr, const std::string & spelling) {
+    std::string key = usr;
+    key += '\0';
+    key += spelling;
+
+    auto it = symbolIds_.find (key);
+    if (it != symbolIds_.end()) {
+      return it->second;
+    }
+
+    int id = -1;
+    Sqlite::Statement & stmt
+      = db_.cached ("SELECT id FROM symbols WHERE usr=? AND spelling=?")
+      .bind (usr)
+      .bind (spelling);
+    if (stmt.step() == SQLITE_ROW) {
+      stmt >> id;
+      stmt.reset();
+    } else {
+      db_.cached ("INSERT INTO symbols (usr, spelling) VALUES (?, ?)")
+        .bind (usr)
+        .bind (spelling)
+        .step();
+      id = db_.lastInsertRowId();
+    }
+
+    // Bound the memory used by the map
+    if (symbolIds_.size() >= maxInternedSymbols_) {
+      symbolIds_.clear();
+    }
+    symbolIds_[key] = id;
+    return id;
+  }
+
+  int kindId_ (const std::string & kind) {
+    auto it = kindIds_.find (kind);
+    if (it != kindIds_.end()) {
+      return it->second;
+    }
+
+    int id = -1;
+    Sqlite::Statement & stmt
+      = db_.cached ("SELECT id FROM kinds WHERE name=?")
+      .bind (kind);
+    if (stmt.step() == SQLITE_ROW) {
+      stmt >> id;
+      stmt.reset();
+    } else {
+      db_.cached ("INSERT INTO kinds (name) VALUES (?)")
+        .bind (kind)
+        .step();
+      id = db_.lastInsertRowId();
+    }
+
+    kindIds_[kind] = id;
+    return id;
+  }
+
+  // 64-bit FNV-1a hash of the contents of a file
+  static std::string hashFile_ (const std::string & fileName) {
+    std::ifstream file (fileName, std::ios::binary);
+
+    uint64_t hash = 14695981039346656037ULL;
+    char buffer[65536];
+    while (file.read (buffer, sizeof (buffer)) || file.gcount() > 0) {
+      const std::streamsize count = file.gcount();
+      for (std::streamsize i = 0 ; i < count ; ++i) {
+        hash ^= (unsigned char) buffer[i];
+        hash *= 1099511628211ULL;
+      }
+    }
+
+    std::ostringstream res;
+    res << std::hex << hash;
+    return res.str();
+  }
+
+  // Immutable databases can be opened on read-only file systems: SQLite does
+  // not even try to lock them
+  static std::string immutableUri_ (const std::string & path) {
+    std::ostringstream uri;
+    uri << "file:";
+    for (auto c = path.begin() ; c != path.end() ; ++c) {
+      if (*c == '%' || *c == '?' || *c == '#') {
+        uri << '%' << std::hex << std::uppercase << (int)(unsigned char)*c;
+      } else {
+        uri << *c;
+      }
+    }
+    uri << "?immutable=1";
+    return uri.str();
+  }
+
   int fileId_ (const std::string & fileName) {
-    Sqlite::Statement stmt
-      = db_.prepare ("SELECT id FROM files WHERE name=?")
+    Sqlite::Statement & stmt
+      = db_.cached ("SELECT id FROM files WHERE name=?")
       .bind (fileName);
 
     int id = -1;
@@ -412,13 +1907,15 @@ private:
       stmt >> id;
     }
 
+    // Do not leave a pending read, which would prevent schema changes
+    stmt.reset();
     return id;
   }
 
   int addFile_ (const std::string & fileName) {
     int id = fileId_ (fileName);
     if (id == -1) {
-      db_.prepare ("INSERT INTO files VALUES (NULL, ?, 0)")
+      db_.cached ("INSERT INTO files (name, indexed) VALUES (?, 0)")
         .bind (fileName)
         .step();
 
@@ -452,4 +1949,16 @@ private:
   }
 
   Sqlite::Database db_;
+  std::string      path_;
+  SymbolTable *    symbols_;
+  Pragmas          pragmas_;
+
+  bool                      useSnapshot_;
+  std::unique_ptr<Snapshot> mapped_;           // snapshot file, if mapped
+  struct stat               mappedStat_;
+  bool                      snapshotCurrent_;  // snapshotId not cleared yet
+
+  static const size_t maxInternedSymbols_ = 1 << 20;
+  std::unordered_map<std::string, int> symbolIds_;
+  std::unordered_map<std::string, int> kindIds_;
 };
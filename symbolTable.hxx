@@ -0,0 +1,365 @@
+#pragma once
+
+#include <algorithm>
+#include <mutex>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/** @brief Resident copy of the tags index
+ *
+ * USRs, kinds, spellings and file names are interned into integer IDs. For each
+ * file, tags are stored in an array sorted by starting offset, which allows
+ * fast point lookups. Each USR is associated to the list of its references and
+ * definitions.
+ *
+ * The symbol table is kept in sync with the database by Storage, and can be
+ * used concurrently from several threads.
+ */
+class SymbolTable {
+public:
+  /** @brief Tag in a source file */
+  struct Tag {
+    std::string usr;
+    std::string kind;
+    std::string spelling;
+    int line1;
+    int col1;
+    int offset1;
+    int line2;
+    int col2;
+    int offset2;
+    bool isDeclaration;
+  };
+
+  /** @brief Tag, along with the name of the file where it is located */
+  struct Location {
+    std::string file;
+    Tag         tag;
+  };
+
+  /** @brief Remove all tags */
+  void clear () {
+    std::lock_guard<std::mutex> lock (mutex_);
+    files_.clear();
+    references_.clear();
+    definitions_.clear();
+  }
+
+  /** @brief Remove all tags in a file
+   *
+   * @param fileName  name of the file
+   */
+  void clearFile (const std::string & fileName) {
+    std::lock_guard<std::mutex> lock (mutex_);
+    auto file = files_.find (fileNames_.find (fileName));
+    if (file == files_.end()) {
+      return;
+    }
+
+    removePostings_ (file->first, file->second);
+    files_.erase (file);
+  }
+
+  /** @brief Add tags to a file
+   *
+   * @param fileName  name of the file
+   * @param tags      tags located in the file
+   */
+  void addTags (const std::string & fileName, const std::vector<Tag> & tags) {
+    std::lock_guard<std::mutex> lock (mutex_);
+    const int fileId = fileNames_.id (fileName);
+    File & file = files_[fileId];
+    removePostings_ (fileId, file);
+
+    auto tag = tags.begin();
+    auto end = tags.end();
+    for ( ; tag != end ; ++tag) {
+      Entry entry;
+      entry.offset1  = tag->offset1;
+      entry.offset2  = tag->offset2;
+      entry.usr      = usrs_.id (tag->usr);
+      entry.kind     = kinds_.id (tag->kind);
+      entry.spelling = spellings_.id (tag->spelling);
+      entry.line1    = tag->line1;
+      entry.col1     = tag->col1;
+      entry.line2    = tag->line2;
+      entry.col2     = tag->col2;
+      entry.isDecl   = tag->isDeclaration;
+      file.entries.push_back (entry);
+      file.maxSpan = std::max (file.maxSpan, entry.offset2 - entry.offset1);
+    }
+
+    std::sort (file.entries.begin(), file.entries.end(),
+               [] (const Entry & a, const Entry & b) {
+                 return a.offset1 < b.offset1;
+               });
+
+    for (unsigned int i = 0 ; i < file.entries.size() ; ++i) {
+      const Entry & entry = file.entries[i];
+      references_[entry.usr].push_back (Posting (fileId, i));
+      if (entry.isDecl) {
+        definitions_[entry.usr].push_back (Posting (fileId, i));
+      }
+    }
+  }
+
+  /** @brief Find the definitions of the symbols referenced at a location
+   *
+   * @param fileName  name of the file
+   * @param offset    offset in the file
+   *
+   * @return (reference, definition) pairs, from the most specific reference
+   *         to the least specific one
+   */
+  std::vector<std::pair<Location, Location> > findDefinition (const std::string & fileName,
+                                                              int offset) const {
+    std::lock_guard<std::mutex> lock (mutex_);
+    std::vector<std::pair<Location, Location> > res;
+
+    auto file = files_.find (fileNames_.find (fileName));
+    if (file == files_.end()) {
+      return res;
+    }
+
+    // Tags starting after the offset can not contain it, nor can tags
+    // starting more than maxSpan bytes before it
+    const std::vector<Entry> & entries = file->second.entries;
+    std::vector<const Entry *> refs;
+    auto it = std::upper_bound (entries.begin(), entries.end(), offset,
+                                [] (int offset, const Entry & entry) {
+                                  return offset < entry.offset1;
+                                });
+    while (it != entries.begin()) {
+      --it;
+      if (it->offset1 < offset - file->second.maxSpan) {
+        break;
+      }
+      if (it->offset2 >= offset) {
+        refs.push_back (&*it);
+      }
+    }
+
+    std::stable_sort (refs.begin(), refs.end(),
+                      [] (const Entry * a, const Entry * b) {
+                        return a->offset2 - a->offset1 < b->offset2 - b->offset1;
+                      });
+
+    for (auto ref = refs.begin() ; ref != refs.end() ; ++ref) {
+      auto defs = definitions_.find ((*ref)->usr);
+      if (defs == definitions_.end()) {
+        continue;
+      }
+
+      for (auto def = defs->second.begin() ; def != defs->second.end() ; ++def) {
+        const Entry & defEntry = files_.find (def->first)->second.entries[def->second];
+        res.push_back (std::make_pair (location_ (file->first, **ref),
+                                       location_ (def->first, defEntry)));
+      }
+    }
+
+    return res;
+  }
+
+  /** @brief Find all references to a symbol
+   *
+   * @param usr         Unified Symbol Resolution of the symbol
+   * @param filePrefix  only consider files whose name starts with this prefix
+   * @param offset      number of matching references to skip
+   * @param limit       maximum number of references to return (0 for no limit)
+   *
+   * @return tags referencing the symbol, sorted by file name and offset
+   */
+  std::vector<Location> grep (const std::string & usr,
+                              const std::string & filePrefix = "",
+                              unsigned int offset = 0,
+                              unsigned int limit = 0) const {
+    std::lock_guard<std::mutex> lock (mutex_);
+    std::vector<Location> res;
+
+    auto refs = references_.find (usrs_.find (usr));
+    if (refs == references_.end()) {
+      return res;
+    }
+
+    // File entries are sorted by offset, so that sorting by entry index sorts
+    // by offset
+    std::vector<std::pair<const std::string *, Posting> > matches;
+    for (auto ref = refs->second.begin() ; ref != refs->second.end() ; ++ref) {
+      const std::string & fileName = fileNames_.str (ref->first);
+      if (fileName.compare (0, filePrefix.size(), filePrefix) == 0) {
+        matches.push_back (std::make_pair (&fileName, *ref));
+      }
+    }
+    std::sort (matches.begin(), matches.end(),
+               [] (const std::pair<const std::string *, Posting> & a,
+                   const std::pair<const std::string *, Posting> & b) {
+                 const int cmp = a.first->compare (*b.first);
+                 return cmp < 0 || (cmp == 0 && a.second.second < b.second.second);
+               });
+
+    for (size_t i = offset ; i < matches.size() ; ++i) {
+      if (limit > 0 && res.size() >= limit) {
+        break;
+      }
+
+      const Posting & ref = matches[i].second;
+      res.push_back (location_ (ref.first,
+                                files_.find (ref.first)->second.entries[ref.second]));
+    }
+    return res;
+  }
+
+  /** @brief Estimate the memory used by the symbol table
+   *
+   * This walks all files and symbols (but not all tags), and blocks other
+   * threads meanwhile.
+   *
+   * @return an approximation of the memory usage (in bytes)
+   */
+  size_t memoryUsage () const {
+    std::lock_guard<std::mutex> lock (mutex_);
+    size_t res = fileNames_.memoryUsage() + usrs_.memoryUsage()
+      +          kinds_.memoryUsage()     + spellings_.memoryUsage();
+
+    for (auto file = files_.begin() ; file != files_.end() ; ++file) {
+      res += nodeSize_ (sizeof (*file))
+        +    file->second.entries.capacity() * sizeof (Entry);
+    }
+
+    const PostingLists * lists[] = {&references_, &definitions_};
+    for (unsigned int i = 0 ; i < 2 ; ++i) {
+      for (auto postings = lists[i]->begin() ; postings != lists[i]->end() ; ++postings) {
+        res += nodeSize_ (sizeof (*postings))
+          +    postings->second.capacity() * sizeof (Posting);
+      }
+    }
+    return res;
+  }
+
+private:
+  // Approximate size of a hash table node holding a value of the given size,
+  // along with its bucket
+  static size_t nodeSize_ (size_t valueSize) {
+    return valueSize + 2 * sizeof (void *);
+  }
+
+  // Bidirectional mapping between strings and integer IDs. Strings are never
+  // removed, so that IDs remain valid.
+  class Interner {
+  public:
+    int id (const std::string & str) {
+      auto it = ids_.find (str);
+      if (it != ids_.end()) {
+        return it->second;
+      }
+
+      strings_.push_back (str);
+      ids_[str] = strings_.size() - 1;
+      return strings_.size() - 1;
+    }
+
+    // Same as id(), but return -1 for unknown strings
+    int find (const std::string & str) const {
+      auto it = ids_.find (str);
+      return it == ids_.end() ? -1 : it->second;
+    }
+
+    const std::string & str (int id) const {
+      return strings_[id];
+    }
+
+    // Strings are stored twice: in the vector, and as keys of the map
+    size_t memoryUsage () const {
+      size_t res = strings_.capacity() * sizeof (std::string);
+      for (auto it = strings_.begin() ; it != strings_.end() ; ++it) {
+        res += 2 * it->capacity()
+          +    nodeSize_ (sizeof (std::pair<const std::string, int>));
+      }
+      return res;
+    }
+
+  private:
+    std::vector<std::string>             strings_;
+    std::unordered_map<std::string, int> ids_;
+  };
+
+  struct Entry {
+    int  offset1;
+    int  offset2;
+    int  usr;
+    int  kind;
+    int  spelling;
+    int  line1;
+    int  col1;
+    int  line2;
+    int  col2;
+    bool isDecl;
+  };
+
+  struct File {
+    File () : maxSpan (0) {}
+
+    std::vector<Entry> entries; // sorted by offset1
+    int                maxSpan; // maximum value of (offset2 - offset1)
+  };
+
+  // (file ID, index in the file entries)
+  typedef std::pair<int, unsigned int> Posting;
+  typedef std::unordered_map<int, std::vector<Posting> > PostingLists;
+
+  // Remove from the posting lists all references to the entries of a file
+  void removePostings_ (int fileId, const File & file) {
+    std::set<int> usrs;
+    for (auto entry = file.entries.begin() ; entry != file.entries.end() ; ++entry) {
+      usrs.insert (entry->usr);
+    }
+
+    PostingLists * lists[] = {&references_, &definitions_};
+    for (auto usr = usrs.begin() ; usr != usrs.end() ; ++usr) {
+      for (unsigned int i = 0 ; i < 2 ; ++i) {
+        auto postings = lists[i]->find (*usr);
+        if (postings == lists[i]->end()) {
+          continue;
+        }
+
+        std::vector<Posting> & v = postings->second;
+        v.erase (std::remove_if (v.begin(), v.end(),
+                                 [fileId] (const Posting & p) {
+                                   return p.first == fileId;
+                                 }),
+                 v.end());
+        if (v.empty()) {
+          lists[i]->erase (postings);
+        }
+      }
+    }
+  }
+
+  Location location_ (int fileId, const Entry & entry) const {
+    Location location;
+    location.file              = fileNames_.str (fileId);
+    location.tag.usr           = usrs_.str (entry.usr);
+    location.tag.kind          = kinds_.str (entry.kind);
+    location.tag.spelling      = spellings_.str (entry.spelling);
+    location.tag.line1         = entry.line1;
+    location.tag.col1          = entry.col1;
+    location.tag.offset1       = entry.offset1;
+    location.tag.line2         = entry.line2;
+    location.tag.col2          = entry.col2;
+    location.tag.offset2       = entry.offset2;
+    location.tag.isDeclaration = entry.isDecl;
+    return location;
+  }
+
+  Interner                      fileNames_;
+  Interner                      usrs_;
+  Interner                      kinds_;
+  Interner                      spellings_;
+  std::unordered_map<int, File> files_;
+  PostingLists                  references_;
+  PostingLists                  definitions_;
+  mutable std::mutex            mutex_;
+};
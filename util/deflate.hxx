@@ -0,0 +1,129 @@
+#pragma once
+
+#include <zlib.h>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+/** @addtogroup util
+ *  @{
+ */
+
+/** @brief Streaming zlib compressor
+ *
+ * All data is compressed in a single zlib stream, which can be flushed at any
+ * point: the receiving Inflater can then decompress everything sent so far,
+ * without waiting for the end of the stream.
+ *
+ * Example use:
+ * @snippet test_util.cxx Deflate
+ */
+class Deflater {
+public:
+  /** @brief Constructor
+   *
+   * @param level  compression level, from 1 (fastest) to 9 (smallest)
+   */
+  Deflater (int level = Z_DEFAULT_COMPRESSION) {
+    std::memset (&stream_, 0, sizeof (stream_));
+    if (deflateInit (&stream_, level) != Z_OK) {
+      throw std::runtime_error ("Could not initialize zlib compression");
+    }
+  }
+
+  ~Deflater () {
+    deflateEnd (&stream_);
+  }
+
+  /** @brief Compress data
+   *
+   * @param data   data to add to the stream
+   * @param flush  @c Z_SYNC_FLUSH to make all data decompressible on the
+   *               receiving side, @c Z_FINISH to end the stream, or
+   *               @c Z_NO_FLUSH to let zlib buffer data
+   *
+   * @return the compressed bytes produced by this call
+   */
+  std::string compress (const std::string & data, int flush = Z_SYNC_FLUSH) {
+    stream_.next_in  = (Bytef *) data.data();
+    stream_.avail_in = data.size();
+
+    std::string res;
+    int ret;
+    do {
+      unsigned char buffer[1 << 14];
+      stream_.next_out  = buffer;
+      stream_.avail_out = sizeof (buffer);
+      ret = deflate (&stream_, flush);
+      if (ret == Z_STREAM_ERROR) {
+        throw std::runtime_error ("zlib compression error");
+      }
+      res.append ((const char *) buffer, sizeof (buffer) - stream_.avail_out);
+    } while (stream_.avail_out == 0 || (flush == Z_FINISH && ret != Z_STREAM_END));
+    return res;
+  }
+
+private:
+  Deflater (const Deflater &);
+  Deflater & operator= (const Deflater &);
+
+  z_stream stream_;
+};
+
+
+/** @brief Streaming zlib decompressor
+ *
+ * Decompress a stream produced by a Deflater, as chunks of it are received.
+ */
+class Inflater {
+public:
+  /** @brief Constructor
+   */
+  Inflater () {
+    std::memset (&stream_, 0, sizeof (stream_));
+    if (inflateInit (&stream_) != Z_OK) {
+      throw std::runtime_error ("Could not initialize zlib decompression");
+    }
+  }
+
+  ~Inflater () {
+    inflateEnd (&stream_);
+  }
+
+  /** @brief Decompress data
+   *
+   * @param data  next chunk of the compressed stream
+   *
+   * @return the decompressed bytes available after this chunk
+   *
+   * @throw std::runtime_error if the stream is corrupted
+   */
+  std::string decompress (const std::string & data) {
+    stream_.next_in  = (Bytef *) data.data();
+    stream_.avail_in = data.size();
+
+    // Keep going as long as the output buffer gets filled: zlib may hold more
+    // decompressed data
+    std::string res;
+    int ret;
+    do {
+      unsigned char buffer[1 << 14];
+      stream_.next_out  = buffer;
+      stream_.avail_out = sizeof (buffer);
+      ret = inflate (&stream_, Z_SYNC_FLUSH);
+      if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR) {
+        throw std::runtime_error ("zlib decompression error");
+      }
+      res.append ((const char *) buffer, sizeof (buffer) - stream_.avail_out);
+    } while (stream_.avail_out == 0 && ret == Z_OK);
+    return res;
+  }
+
+private:
+  Inflater (const Inflater &);
+  Inflater & operator= (const Inflater &);
+
+  z_stream stream_;
+};
+
+/** @} */
@@ -0,0 +1,184 @@
+#pragma once
+
+#include "util.hxx"
+#include <sys/inotify.h>
+#include <poll.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/** @addtogroup util
+ *  @{
+ */
+
+/** @brief Watch a set of files for changes (using inotify)
+ *
+ * The directories containing the files are watched, rather than the files
+ * themselves: this catches editors replacing files by renaming a new version
+ * over them, as well as files being removed and created again.
+ *
+ * Changes are debounced: wait() returns once no change happened for a
+ * while, so that bursts of changes (e.g. a version control checkout) are
+ * reported at once.
+ *
+ * Example use:
+ * @snippet test_util.cxx FileWatcher
+ */
+class FileWatcher {
+public:
+  /** @brief Constructor
+   *
+   * @throw std::runtime_error if inotify is not available
+   */
+  FileWatcher ()
+    : fd_ (inotify_init1 (IN_NONBLOCK | IN_CLOEXEC)),
+      warned_ (false)
+  {
+    if (fd_ < 0) {
+      throw std::runtime_error (std::string ("Could not initialize inotify: ")
+                                + strerror (errno));
+    }
+  }
+
+  ~FileWatcher () {
+    close (fd_);
+  }
+
+  /** @brief Set the watched files
+   *
+   * @param files  absolute paths of the watched files (previously watched
+   *               files which are not in the list are not watched anymore)
+   */
+  void watch (const std::vector<std::string> & files) {
+    files_.clear();
+    std::set<std::string> directories;
+    for (auto file = files.begin() ; file != files.end() ; ++file) {
+      const size_t slash = file->rfind ('/');
+      if (slash == std::string::npos) {
+        continue;
+      }
+      files_.insert (*file);
+      directories.insert (slash == 0 ? "/" : file->substr (0, slash));
+    }
+
+    // Stop watching directories which are not needed anymore
+    for (auto it = directories_.begin() ; it != directories_.end() ; ) {
+      if (directories.count (it->second) == 0) {
+        inotify_rm_watch (fd_, it->first);
+        it = directories_.erase (it);
+      } else {
+        ++it;
+      }
+    }
+
+    std::set<std::string> watched;
+    for (auto it = directories_.begin() ; it != directories_.end() ; ++it) {
+      watched.insert (it->second);
+    }
+
+    for (auto dir = directories.begin() ; dir != directories.end() ; ++dir) {
+      if (watched.count (*dir) > 0) {
+        continue;
+      }
+
+      const int wd = inotify_add_watch (fd_, dir->c_str(),
+                                        IN_CLOSE_WRITE | IN_ATTRIB
+                                        | IN_MOVED_TO | IN_MOVED_FROM
+                                        | IN_CREATE | IN_DELETE);
+      if (wd < 0) {
+        // Most likely, the limit of watches per user was reached
+        if (!warned_) {
+          std::cerr << "Warning: could not watch directory `" << *dir << "': "
+                    << strerror (errno) << std::endl;
+          warned_ = true;
+        }
+        continue;
+      }
+      directories_[wd] = *dir;
+    }
+  }
+
+  /** @brief Number of watched directories
+   */
+  size_t directories () const {
+    return directories_.size();
+  }
+
+  /** @brief Wait for changes
+   *
+   * @param timeout  maximum time to wait for a first change (in milliseconds)
+   * @param quiet    time without changes after which they are reported (in
+   *                 milliseconds)
+   * @param maxDelay maximum time during which changes are accumulated, even
+   *                 if they keep happening (in milliseconds)
+   *
+   * @return the watched files which changed (empty if none changed before the
+   *         timeout)
+   */
+  std::set<std::string> wait (int timeout, int quiet, int maxDelay) {
+    std::set<std::string> changed;
+    if (!poll_ (timeout)) {
+      return changed;
+    }
+
+    Timer timer;
+    read_ (changed);
+    while (timer.get() * 1000 < maxDelay && poll_ (quiet)) {
+      read_ (changed);
+    }
+    return changed;
+  }
+
+private:
+  FileWatcher (const FileWatcher &);
+  FileWatcher & operator= (const FileWatcher &);
+
+  bool poll_ (int timeout) {
+    struct pollfd fds;
+    fds.fd     = fd_;
+    fds.events = POLLIN;
+    return ::poll (&fds, 1, timeout) > 0;
+  }
+
+  void read_ (std::set<std::string> & changed) {
+    char buffer[1 << 16] __attribute__ ((aligned (__alignof__ (struct inotify_event))));
+
+    ssize_t len;
+    while ((len = ::read (fd_, buffer, sizeof (buffer))) > 0) {
+      for (char * p = buffer ; p < buffer + len ; ) {
+        const struct inotify_event * event = (const struct inotify_event *) p;
+        p += sizeof (struct inotify_event) + event->len;
+
+        // Events were lost: anything may have changed
+        if (event->mask & IN_Q_OVERFLOW) {
+          changed.insert (files_.begin(), files_.end());
+          continue;
+        }
+
+        auto dir = directories_.find (event->wd);
+        if (dir == directories_.end() || event->len == 0) {
+          continue;
+        }
+
+        const std::string path = (dir->second == "/" ? "" : dir->second)
+          + "/" + event->name;
+        if (files_.count (path) > 0) {
+          changed.insert (path);
+        }
+      }
+    }
+  }
+
+  int                        fd_;
+  bool                       warned_;
+  std::set<std::string>      files_;
+  std::map<int, std::string> directories_;  // by watch descriptor
+};
+
+/** @} */
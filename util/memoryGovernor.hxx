@@ -0,0 +1,289 @@
+#pragma once
+
+#include <malloc.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+
+/** @addtogroup util
+ *  @{
+ */
+
+/** @brief Memory budget shared by the caches of a process
+ *
+ * Caches register with the governor, along with their share of the budget, a
+ * function reporting their memory usage and a function setting their memory
+ * limit. rebalance(), which should be called periodically, gives each cache
+ * its share of the part of the budget which is not used outside of caches.
+ *
+ * Several caches can be registered under the same name (e.g. one per thread):
+ * they share a single share of the budget, each being allowed to use what the
+ * others do not.
+ *
+ * Structures which can not be shrunk can be registered without a limit
+ * function, so that their usage is reported. Their memory is accounted for
+ * like memory used outside of caches.
+ *
+ * Under memory pressure, the memory given to caches is halved at each
+ * rebalancing; it then grows back by steps of 1/8 of the budget.
+ *
+ * All methods are thread-safe. Limit functions are called with an internal
+ * lock held: they should not call the governor.
+ *
+ * Example use:
+ * @snippet test_util.cxx MemoryGovernor
+ */
+class MemoryGovernor {
+public:
+  typedef std::function<size_t ()>       Usage;
+  typedef std::function<void (size_t)>   Limit;
+
+  /** @brief Memory usage and limit of a group of caches
+   */
+  struct Report {
+    size_t usage;  ///< memory used by the caches (in bytes)
+    size_t limit;  ///< memory given to the caches at the last rebalancing
+  };
+
+  /** @brief Constructor
+   *
+   * @param budget  memory budget of the process (in bytes); 0 disables
+   *                rebalancing
+   */
+  MemoryGovernor (size_t budget = 0)
+    : budget_ (budget),
+      scale_ (1),
+      rss_ (0),
+      nextId_ (0)
+  { }
+
+  /** @brief Process-wide governor
+   *
+   * @return the governor shared by all threads
+   */
+  static MemoryGovernor & global () {
+    static MemoryGovernor governor;
+    return governor;
+  }
+
+  /** @brief Set the memory budget of the process
+   *
+   * @param budget  memory budget (in bytes); 0 disables rebalancing
+   */
+  void setBudget (size_t budget) {
+    std::lock_guard<std::mutex> lock (mutex_);
+    budget_ = budget;
+  }
+
+  /** @brief Register a cache
+   *
+   * @param name   name of the cache group, as reported by report()
+   * @param share  relative share of the budget of the group
+   * @param usage  function returning the memory usage of the cache
+   * @param limit  function setting the memory limit of the cache (empty if
+   *               the cache can not be shrunk)
+   *
+   * @return an identifier for remove()
+   */
+  int add (const std::string & name, double share, Usage usage,
+           Limit limit = Limit()) {
+    std::lock_guard<std::mutex> lock (mutex_);
+    const Cache cache = {name, usage, limit};
+    caches_[nextId_] = cache;
+    shares_[name] = share;
+    return nextId_++;
+  }
+
+  /** @brief Unregister a cache
+   *
+   * @param id  identifier returned by add()
+   */
+  void remove (int id) {
+    std::lock_guard<std::mutex> lock (mutex_);
+    caches_.erase (id);
+  }
+
+  /** @brief Divide the budget among caches
+   *
+   * @param rss       resident set size of the process (in bytes)
+   * @param pressure  whether the system is short of memory
+   */
+  void rebalance (size_t rss, bool pressure) {
+    std::lock_guard<std::mutex> lock (mutex_);
+    rss_ = rss;
+    if (budget_ == 0) {
+      return;
+    }
+
+    std::map<int, size_t> usages;
+    std::map<std::string, size_t> groupUsages;
+    size_t cachesUsage = 0;
+    for (auto it = caches_.begin() ; it != caches_.end() ; ++it) {
+      if (!it->second.limit) {
+        continue;
+      }
+      const size_t usage = it->second.usage();
+      usages[it->first] = usage;
+      groupUsages[it->second.name] += usage;
+      cachesUsage += usage;
+    }
+
+    // Adapt to memory pressure: multiplicative decrease, additive increase
+    if (pressure || rss > budget_) {
+      scale_ = std::max (scale_ / 2, 1. / 64);
+    } else {
+      scale_ = std::min (scale_ + 1. / 8, 1.);
+    }
+
+    // Memory used outside of caches can not be reclaimed
+    const size_t other = rss > cachesUsage ? rss - cachesUsage : 0;
+    const double available = budget_ > other ? (budget_ - other) * scale_ : 0;
+
+    double totalShares = 0;
+    for (auto it = groupUsages.begin() ; it != groupUsages.end() ; ++it) {
+      totalShares += shares_[it->first];
+    }
+
+    limits_.clear();
+    for (auto it = groupUsages.begin() ; it != groupUsages.end() ; ++it) {
+      limits_[it->first] = totalShares > 0
+        ? size_t (available * shares_[it->first] / totalShares)
+        : 0;
+    }
+
+    for (auto it = caches_.begin() ; it != caches_.end() ; ++it) {
+      if (!it->second.limit) {
+        continue;
+      }
+      const size_t group  = limits_[it->second.name];
+      const size_t others = groupUsages[it->second.name] - usages[it->first];
+      it->second.limit (group > others ? group - others : 0);
+    }
+  }
+
+  /** @brief Memory usage and limit of each group of caches
+   *
+   * @return a report for each cache name
+   */
+  std::map<std::string, Report> report () const {
+    std::lock_guard<std::mutex> lock (mutex_);
+    std::map<std::string, Report> res;
+    for (auto it = caches_.begin() ; it != caches_.end() ; ++it) {
+      Report & report = res[it->second.name];
+      report.usage += it->second.usage();
+    }
+    for (auto it = res.begin() ; it != res.end() ; ++it) {
+      auto limit = limits_.find (it->first);
+      it->second.limit = limit != limits_.end() ? limit->second : 0;
+    }
+    return res;
+  }
+
+  /** @brief Memory budget of the process (in bytes) */
+  size_t budget () const {
+    std::lock_guard<std::mutex> lock (mutex_);
+    return budget_;
+  }
+
+  /** @brief Fraction of the available memory currently given to caches */
+  double scale () const {
+    std::lock_guard<std::mutex> lock (mutex_);
+    return scale_;
+  }
+
+  /** @brief Resident set size given to the last rebalancing (in bytes) */
+  size_t rss () const {
+    std::lock_guard<std::mutex> lock (mutex_);
+    return rss_;
+  }
+
+
+  /** @brief Resident set size of the current process
+   *
+   * @return the resident set size (in bytes), or 0 if it is unknown
+   */
+  static size_t residentSetSize () {
+    std::ifstream statm ("/proc/self/statm");
+    size_t size = 0, resident = 0;
+    statm >> size >> resident;
+    return resident * sysconf (_SC_PAGESIZE);
+  }
+
+  /** @brief Memory pressure of the cgroup of the process (or of the system)
+   *
+   * @return the percentage of time some tasks were stalled waiting for memory
+   *         during the last 10 seconds, or 0 if it is unknown
+   */
+  static double memoryPressure () {
+    std::ifstream pressure (cgroupPath_() + "memory.pressure");
+    if (!pressure) {
+      pressure.open ("/proc/pressure/memory");
+    }
+
+    // some avg10=0.00 avg60=0.00 avg300=0.00 total=0
+    std::string line;
+    while (std::getline (pressure, line)) {
+      const std::string prefix = "some avg10=";
+      if (line.compare (0, prefix.size(), prefix) == 0) {
+        return std::strtod (line.c_str() + prefix.size(), NULL);
+      }
+    }
+    return 0;
+  }
+
+  /** @brief Memory limit of the cgroup of the process
+   *
+   * @return the limit (in bytes), or 0 if there is none
+   */
+  static size_t cgroupLimit () {
+    std::ifstream max (cgroupPath_() + "memory.max");
+    std::string value;
+    max >> value;
+    return value == "" || value == "max" ? 0 : std::stoull (value);
+  }
+
+  /** @brief Give memory freed by the process back to the system
+   */
+  static void releaseFreeMemory () {
+    malloc_trim (0);
+  }
+
+private:
+  MemoryGovernor (const MemoryGovernor &);
+  MemoryGovernor & operator= (const MemoryGovernor &);
+
+  // Directory of the (cgroup v2) cgroup of the process, with a final '/'
+  static std::string cgroupPath_ () {
+    // 0::/user.slice/...
+    std::ifstream cgroup ("/proc/self/cgroup");
+    std::string line;
+    while (std::getline (cgroup, line)) {
+      if (line.compare (0, 3, "0::") == 0) {
+        return "/sys/fs/cgroup" + line.substr (3) + "/";
+      }
+    }
+    return "/sys/fs/cgroup/";
+  }
+
+  struct Cache {
+    std::string name;
+    Usage       usage;
+    Limit       limit;
+  };
+
+  size_t                         budget_;
+  double                         scale_;
+  size_t                         rss_;
+  int                            nextId_;
+  std::map<int, Cache>           caches_;
+  std::map<std::string, double>  shares_;
+  std::map<std::string, size_t>  limits_;  // of each group
+  mutable std::mutex             mutex_;
+};
+
+/** @} */
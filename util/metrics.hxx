@@ -0,0 +1,216 @@
+#pragma once
+
+#include "util.hxx"
+#include <cmath>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/** @addtogroup util
+ *  @{
+ */
+
+/** @brief Distribution of durations
+ *
+ * Durations are counted in logarithmic buckets (four per power of two, from
+ * one microsecond to about an hour), so that percentiles can be estimated in
+ * constant memory.
+ */
+class Histogram {
+public:
+  /** @brief Summary of a distribution
+   */
+  struct Summary {
+    unsigned long count;  ///< number of recorded durations
+    double        sum;    ///< total duration (in seconds)
+    double        min;    ///< shortest duration (in seconds)
+    double        max;    ///< longest duration (in seconds)
+    double        p50;    ///< estimated median (in seconds)
+    double        p90;    ///< estimated 90th percentile (in seconds)
+    double        p99;    ///< estimated 99th percentile (in seconds)
+  };
+
+  /** @brief Constructor
+   */
+  Histogram ()
+    : buckets_ (nBuckets_, 0),
+      count_ (0),
+      sum_ (0),
+      min_ (0),
+      max_ (0)
+  { }
+
+  /** @brief Record a duration
+   *
+   * @param seconds  duration (in seconds)
+   */
+  void add (double seconds) {
+    if (count_ == 0 || seconds < min_) min_ = seconds;
+    if (count_ == 0 || seconds > max_) max_ = seconds;
+    ++count_;
+    sum_ += seconds;
+    ++buckets_[bucket_ (seconds)];
+  }
+
+  /** @brief Summarize the distribution
+   *
+   * @return the summary of all recorded durations
+   */
+  Summary summary () const {
+    Summary res;
+    res.count = count_;
+    res.sum   = sum_;
+    res.min   = min_;
+    res.max   = max_;
+    res.p50   = percentile_ (0.50);
+    res.p90   = percentile_ (0.90);
+    res.p99   = percentile_ (0.99);
+    return res;
+  }
+
+private:
+  static const size_t nBuckets_ = 128;
+
+  static size_t bucket_ (double seconds) {
+    const double us = seconds * 1e6;
+    if (us <= 1) {
+      return 0;
+    }
+    const size_t i = 1 + (size_t) (4 * std::log2 (us));
+    return i < nBuckets_ ? i : nBuckets_ - 1;
+  }
+
+  // Estimated as the middle of the bucket, within the observed range
+  double percentile_ (double p) const {
+    if (count_ == 0) {
+      return 0;
+    }
+
+    const unsigned long rank = (unsigned long) std::ceil (p * count_);
+    unsigned long seen = 0;
+    size_t i = 0;
+    for ( ; i < nBuckets_ - 1 ; ++i) {
+      seen += buckets_[i];
+      if (seen >= rank) {
+        break;
+      }
+    }
+
+    const double value = i == 0 ? 1e-6 : std::exp2 ((i - 0.5) / 4) * 1e-6;
+    return value < min_ ? min_ : (value > max_ ? max_ : value);
+  }
+
+  std::vector<unsigned long> buckets_;
+  unsigned long              count_;
+  double                     sum_;
+  double                     min_;
+  double                     max_;
+};
+
+
+/** @brief Registry of named counters and duration histograms
+ *
+ * All methods are thread-safe. A process-wide registry is available through
+ * global().
+ *
+ * Example use:
+ * @snippet test_util.cxx Metrics
+ */
+class Metrics {
+public:
+  /** @brief Process-wide registry
+   *
+   * @return the registry shared by all threads
+   */
+  static Metrics & global () {
+    static Metrics metrics;
+    return metrics;
+  }
+
+  /** @brief Increment a counter
+   *
+   * @param name  counter name
+   * @param n     increment (which may be negative, for gauges)
+   */
+  void count (const std::string & name, long n = 1) {
+    std::lock_guard<std::mutex> lock (mutex_);
+    counters_[name] += n;
+  }
+
+  /** @brief Record a duration
+   *
+   * @param name     histogram name
+   * @param seconds  duration (in seconds)
+   */
+  void time (const std::string & name, double seconds) {
+    std::lock_guard<std::mutex> lock (mutex_);
+    histograms_[name].add (seconds);
+  }
+
+  /** @brief Get the values of all counters
+   *
+   * @return counter values, by name
+   */
+  std::map<std::string, long> counters () const {
+    std::lock_guard<std::mutex> lock (mutex_);
+    return counters_;
+  }
+
+  /** @brief Get summaries of all histograms
+   *
+   * @return histogram summaries, by name
+   */
+  std::map<std::string, Histogram::Summary> histograms () const {
+    std::lock_guard<std::mutex> lock (mutex_);
+    std::map<std::string, Histogram::Summary> res;
+    for (auto it = histograms_.begin() ; it != histograms_.end() ; ++it) {
+      res[it->first] = it->second.summary();
+    }
+    return res;
+  }
+
+  /** @brief Clear all histograms
+   *
+   * Counters are kept, since some of them measure current quantities (such as
+   * memory usage).
+   */
+  void reset () {
+    std::lock_guard<std::mutex> lock (mutex_);
+    histograms_.clear();
+  }
+
+  /** @brief Time a scope
+   *
+   * The duration between construction and destruction is recorded in a
+   * histogram.
+   */
+  class ScopedTimer {
+  public:
+    /** @brief Constructor
+     *
+     * @param name     histogram name
+     * @param metrics  registry in which the duration is recorded
+     */
+    ScopedTimer (const std::string & name, Metrics & metrics = Metrics::global())
+      : name_ (name),
+        metrics_ (metrics)
+    { }
+
+    ~ScopedTimer () {
+      metrics_.time (name_, timer_.get());
+    }
+
+  private:
+    std::string name_;
+    Metrics &   metrics_;
+    Timer       timer_;
+  };
+
+private:
+  mutable std::mutex                 mutex_;
+  std::map<std::string, long>        counters_;
+  std::map<std::string, Histogram>   histograms_;
+};
+
+/** @} */
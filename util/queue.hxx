@@ -0,0 +1,119 @@
+#pragma once
+
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+
+/** @addtogroup util
+ *  @{
+ */
+
+/** @brief Thread-safe FIFO queue
+ *
+ * Producers push() elements which are retrieved, in the same order, by
+ * consumers calling pop(). Consumers block until an element is available, or
+ * the queue is closed. Bounded queues also make producers block while they
+ * are full, so that fast producers do not buffer everything in memory.
+ *
+ * Example use:
+ * @snippet test_util.cxx Queue
+ */
+template <typename T>
+class Queue {
+public:
+  /** @brief Constructor
+   *
+   * Create an empty, open queue.
+   *
+   * @param capacity  maximal number of elements in the queue (0 for an
+   *                  unbounded queue)
+   */
+  Queue (size_t capacity = 0)
+    : capacity_ (capacity),
+      closed_ (false)
+  { }
+
+  /** @brief Add an element at the end of the queue
+   *
+   * In a bounded queue, block while the queue is full (and open). One of the
+   * consumers waiting in pop() is woken up.
+   *
+   * @param x  element to add
+   */
+  void push (T x) {
+    {
+      std::unique_lock<std::mutex> lock (mutex_);
+      notFull_.wait (lock, [this] {
+          return closed_ || capacity_ == 0 || queue_.size() < capacity_;
+        });
+      queue_.push_back (std::move (x));
+    }
+    cond_.notify_one();
+  }
+
+  /** @brief Retrieve the first element of the queue
+   *
+   * Block until an element is available, or the queue is closed.
+   *
+   * @param x  variable where the element will be stored
+   *
+   * @return @c false if the queue was closed and no element remains
+   */
+  bool pop (T & x) {
+    std::unique_lock<std::mutex> lock (mutex_);
+    cond_.wait (lock, [this] { return closed_ || !queue_.empty(); });
+
+    if (queue_.empty()) {
+      return false;
+    }
+
+    x = std::move (queue_.front());
+    queue_.pop_front();
+    notFull_.notify_one();
+    return true;
+  }
+
+  /** @brief Retrieve the first element of the queue, if any
+   *
+   * Contrary to pop(), this never blocks.
+   *
+   * @param x  variable where the element will be stored
+   *
+   * @return @c false if the queue was empty
+   */
+  bool tryPop (T & x) {
+    std::lock_guard<std::mutex> lock (mutex_);
+    if (queue_.empty()) {
+      return false;
+    }
+
+    x = std::move (queue_.front());
+    queue_.pop_front();
+    notFull_.notify_one();
+    return true;
+  }
+
+  /** @brief Close the queue
+   *
+   * Elements already in the queue can still be retrieved, after which all
+   * consumers are released from pop().
+   */
+  void close () {
+    {
+      std::lock_guard<std::mutex> lock (mutex_);
+      closed_ = true;
+    }
+    cond_.notify_all();
+    notFull_.notify_all();
+  }
+
+private:
+  std::deque<T>           queue_;
+  const size_t            capacity_;
+  bool                    closed_;
+  std::mutex              mutex_;
+  std::condition_variable cond_;     // not empty (or closed)
+  std::condition_variable notFull_;  // not full (or closed)
+};
+
+/** @} */
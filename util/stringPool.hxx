@@ -0,0 +1,161 @@
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+/** @addtogroup util
+ *  @{
+ */
+
+/** @brief Non-owning view of a character string
+ *
+ * The viewed characters must outlive the view.
+ */
+class StringView {
+public:
+  /** @brief Constructor of an empty view
+   */
+  StringView ()
+    : data_ (""),
+      size_ (0)
+  { }
+
+  /** @brief Constructor
+   *
+   * @param data  first character
+   * @param size  number of characters
+   */
+  StringView (const char * data, size_t size)
+    : data_ (data),
+      size_ (size)
+  { }
+
+  /** @brief Constructor from a null-terminated string
+   *
+   * @param data  null-terminated string
+   */
+  StringView (const char * data)
+    : data_ (data),
+      size_ (std::strlen (data))
+  { }
+
+  const char * data () const { return data_; }
+  size_t       size () const { return size_; }
+  bool         empty () const { return size_ == 0; }
+
+  /** @brief Copy the viewed characters
+   *
+   * @return a new std::string
+   */
+  std::string str () const {
+    return std::string (data_, size_);
+  }
+
+  bool operator== (const StringView & other) const {
+    return size_ == other.size_
+      && std::memcmp (data_, other.data_, size_) == 0;
+  }
+
+  bool operator!= (const StringView & other) const {
+    return !(*this == other);
+  }
+
+  /** @brief Hash function (FNV-1a), for use in unordered containers
+   */
+  struct Hash {
+    size_t operator() (const StringView & s) const {
+      size_t h = 14695981039346656037ULL;
+      for (size_t i = 0 ; i < s.size_ ; ++i) {
+        h = (h ^ (unsigned char) s.data_[i]) * 1099511628211ULL;
+      }
+      return h;
+    }
+  };
+
+private:
+  const char * data_;
+  size_t       size_;
+};
+
+
+/** @brief Pool of interned strings
+ *
+ * Strings are copied once into large blocks of memory owned by the pool, and
+ * referred to by non-owning views. Interning a string which is already in the
+ * pool does not allocate memory, and returns the same view: interned strings
+ * can be compared by address.
+ *
+ * All views are invalidated when the pool is destroyed.
+ *
+ * Example use:
+ * @snippet test_util.cxx StringPool
+ */
+class StringPool {
+public:
+  /** @brief Constructor
+   *
+   * @param blockSize  size of the memory blocks holding strings
+   */
+  StringPool (size_t blockSize = 1 << 16)
+    : blockSize_ (blockSize),
+      next_ (NULL),
+      free_ (0)
+  { }
+
+  /** @brief Intern a string
+   *
+   * @param s  characters to intern (copied if not already in the pool)
+   *
+   * @return a view of the interned copy, valid as long as the pool
+   */
+  StringView intern (const StringView & s) {
+    auto it = strings_.find (s);
+    if (it != strings_.end()) {
+      return *it;
+    }
+
+    const StringView copy (store_ (s), s.size());
+    strings_.insert (copy);
+    return copy;
+  }
+
+  /** @brief Number of distinct strings in the pool
+   */
+  size_t size () const {
+    return strings_.size();
+  }
+
+private:
+  StringPool (const StringPool &);
+  StringPool & operator= (const StringPool &);
+
+  // Copy characters at the end of the current block, followed by '\0'
+  const char * store_ (const StringView & s) {
+    const size_t needed = s.size() + 1;
+    if (needed > free_) {
+      const size_t size = std::max (blockSize_, needed);
+      blocks_.push_back (std::unique_ptr<char[]> (new char[size]));
+      free_ = size;
+      next_ = blocks_.back().get();
+    }
+
+    char * res = next_;
+    std::memcpy (res, s.data(), s.size());
+    res[s.size()] = '\0';
+    next_ += needed;
+    free_ -= needed;
+    return res;
+  }
+
+  const size_t                                         blockSize_;
+  std::vector<std::unique_ptr<char[]> >                blocks_;
+  char *                                               next_;
+  size_t                                               free_;
+  std::unordered_set<StringView, StringView::Hash>     strings_;
+};
+
+/** @} */
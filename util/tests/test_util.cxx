@@ -3,7 +3,18 @@
  * This example shows how to use the classes of the @ref util module
  */
 #include "util/util.hxx"
+#include "util/queue.hxx"
+#include "util/metrics.hxx"
+#include "util/deflate.hxx"
+#include "util/fileWatcher.hxx"
+#include "util/stringPool.hxx"
+#include "util/memoryGovernor.hxx"
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
 #include <sstream>
+#include <thread>
 
 void check (bool expr) {
   if (!expr) {
@@ -40,6 +51,42 @@ void testString () {
 }
 
 
+void testShellSplit () {
+  std::cout << "Testing shellSplit..." << std::endl;
+
+  //![shellSplit]
+  std::vector<std::string> words
+    = shellSplit ("g++ -DNAME='\"a b\"' -I \"dir with spaces\" -c main.cxx");
+
+  check (words.size() == 6);
+  check (words[1] == "-DNAME=\"a b\"");
+  check (words[3] == "dir with spaces");
+  //![shellSplit]
+
+
+  // Additional tests
+  check (shellSplit ("").empty());
+  check (shellSplit ("  a\tb  ").size() == 2);
+
+  words = shellSplit ("a '' \"\" b");
+  check (words.size() == 4 && words[1] == "" && words[2] == "");
+
+  words = shellSplit ("a\\ b \"c\\\"d\\e\" f\\\nf");
+  check (words.size() == 3);
+  check (words[0] == "a b");
+  check (words[1] == "c\"d\\e");
+  check (words[2] == "ff");
+
+  bool thrown = false;
+  try {
+    shellSplit ("a 'b");
+  } catch (std::runtime_error &) {
+    thrown = true;
+  }
+  check (thrown);
+}
+
+
 void testTee () {
   std::cout << "Testing Tee" << std::endl;
 
@@ -53,11 +100,319 @@ void testTee () {
 }
 
 
+void testQueue () {
+  std::cout << "Testing Queue..." << std::endl;
+
+  //![Queue]
+  Queue<int> queue;
+
+  // Consume elements in a separate thread until the queue is closed
+  int sum = 0;
+  std::thread consumer ([&] {
+      int x;
+      while (queue.pop (x)) {
+        sum += x;
+      }
+    });
+
+  for (int i=1 ; i<=10 ; ++i) {
+    queue.push (i);
+  }
+  queue.close();
+  consumer.join();
+  //![Queue]
+
+  check (sum == 55);
+
+  // Additional tests
+  int x;
+  check (queue.pop (x) == false);
+
+  Queue<int> other;
+  check (other.tryPop (x) == false);
+  other.push (42);
+  check (other.tryPop (x) && x == 42);
+  check (other.tryPop (x) == false);
+
+  // A bounded queue makes producers wait for consumers
+  Queue<int> bounded (2);
+  std::atomic<int> pushed (0);
+  std::thread producer ([&] {
+      for (int i=1 ; i<=10 ; ++i) {
+        bounded.push (i);
+        ++pushed;
+      }
+      bounded.close();
+    });
+  while (pushed < 2) {
+    std::this_thread::yield();
+  }
+  std::this_thread::sleep_for (std::chrono::milliseconds (10));
+  check (pushed == 2);
+
+  sum = 0;
+  while (bounded.pop (x)) {
+    sum += x;
+  }
+  producer.join();
+  check (sum == 55);
+}
+
+
+void testMetrics () {
+  std::cout << "Testing Metrics..." << std::endl;
+
+  //![Metrics]
+  Metrics metrics;
+
+  // Count events, ...
+  metrics.count ("requests");
+  metrics.count ("bytes", 1024);
+
+  // and record durations, either explicitly or for a whole scope
+  metrics.time ("parse", 0.5);
+  {
+    Metrics::ScopedTimer timer ("query", metrics);
+    // do something
+  }
+
+  Histogram::Summary parse = metrics.histograms()["parse"];
+  std::cout << "parse: " << parse.count << " times, median "
+            << parse.p50 << "s." << std::endl;
+  //![Metrics]
+
+  check (metrics.counters()["requests"] == 1);
+  check (metrics.counters()["bytes"] == 1024);
+  check (metrics.histograms()["query"].count == 1);
+  check (parse.count == 1 && parse.p50 == 0.5 && parse.p99 == 0.5);
+
+
+  // Additional tests
+  Histogram histogram;
+  for (int i = 1 ; i <= 100 ; ++i) {
+    histogram.add (i * 1e-3);
+  }
+  Histogram::Summary summary = histogram.summary();
+  check (summary.count == 100);
+  check (summary.min == 1e-3 && summary.max == 0.1);
+  check (summary.p50 > 0.045 && summary.p50 < 0.056);
+  check (summary.p90 > 0.082 && summary.p90 < 0.099);
+  check (summary.p99 > 0.09 && summary.p99 <= 0.1);
+
+  metrics.reset();
+  check (metrics.histograms().empty());
+  check (metrics.counters()["requests"] == 1);
+}
+
+
+void testDeflate () {
+  std::cout << "Testing Deflate..." << std::endl;
+
+  //![Deflate]
+  Deflater deflater;
+  Inflater inflater;
+
+  // Each chunk can be decompressed as soon as it has been received
+  std::string received = inflater.decompress (deflater.compress ("Hello, "));
+  check (received == "Hello, ");
+
+  received += inflater.decompress (deflater.compress ("world!", Z_FINISH));
+  check (received == "Hello, world!");
+  //![Deflate]
+
+
+  // Additional tests: large, compressible data
+  std::string data;
+  for (int i = 0 ; i < 100000 ; ++i) {
+    data += "line " + std::to_string (i % 100) + "\n";
+  }
+  Deflater bigDeflater;
+  const std::string compressed = bigDeflater.compress (data, Z_FINISH);
+  check (compressed.size() < data.size() / 10);
+
+  Inflater bigInflater;
+  std::string decompressed;
+  for (size_t i = 0 ; i < compressed.size() ; i += 1000) {
+    decompressed += bigInflater.decompress (compressed.substr (i, 1000));
+  }
+  check (decompressed == data);
+
+  Inflater corrupted;
+  bool thrown = false;
+  try {
+    corrupted.decompress ("not a zlib stream");
+  } catch (std::runtime_error &) {
+    thrown = true;
+  }
+  check (thrown);
+}
+
+
+void testStringPool () {
+  std::cout << "Testing StringPool..." << std::endl;
+
+  //![StringPool]
+  StringPool pool;
+
+  // Interning the same characters twice gives the same view
+  const std::string usr = "c:@N@LibClang@S@Cursor@F@USR#1";
+  const StringView a = pool.intern (StringView (usr.data(), usr.size()));
+  const StringView b = pool.intern ("c:@N@LibClang@S@Cursor@F@USR#1");
+  check (a.data() == b.data());
+  check (a.data() != usr.data());
+  check (a.str() == usr);
+
+  const StringView c = pool.intern ("c:@F@main");
+  check (c != a);
+  check (pool.size() == 2);
+  //![StringPool]
+
+
+  // Additional tests: strings larger than blocks, many strings
+  StringPool small (16);
+  const StringView big = small.intern ("a string longer than a block");
+  check (big.str() == "a string longer than a block");
+  check (big.data()[big.size()] == '\0');
+
+  std::vector<StringView> views;
+  for (int i = 0 ; i < 1000 ; ++i) {
+    const std::string s = "s" + std::to_string (i);
+    views.push_back (small.intern (StringView (s.data(), s.size())));
+  }
+  check (small.size() == 1001);
+  for (int i = 0 ; i < 1000 ; ++i) {
+    check (views[i].str() == "s" + std::to_string (i));
+    check (small.intern (views[i].str().c_str()).data() == views[i].data());
+  }
+  check (StringView().empty());
+}
+
+
+void testMemoryGovernor () {
+  std::cout << "Testing MemoryGovernor..." << std::endl;
+
+  //![MemoryGovernor]
+  MemoryGovernor governor (1000);
+
+  // Two caches, the first one getting 3/4 of the budget
+  size_t usage1 = 600, limit1 = 0;
+  size_t usage2 = 100, limit2 = 0;
+  governor.add ("first", 3,
+                [&] () { return usage1; },
+                [&] (size_t limit) { limit1 = limit; });
+  governor.add ("second", 1,
+                [&] () { return usage2; },
+                [&] (size_t limit) { limit2 = limit; });
+
+  // 200 bytes are used outside of caches: 800 are left for them
+  governor.rebalance (900, false);
+  check (limit1 == 600 && limit2 == 200);
+  check (governor.report()["first"].usage == 600);
+  check (governor.report()["second"].limit == 200);
+
+  // Under memory pressure, caches are given half as much memory
+  governor.rebalance (900, true);
+  check (limit1 == 300 && limit2 == 100);
+  //![MemoryGovernor]
+
+
+  // Additional tests: caches of the same group share their part of the budget
+  size_t usage3 = 50, limit3 = 0;
+  const int id = governor.add ("second", 1,
+                               [&] () { return usage3; },
+                               [&] (size_t limit) { limit3 = limit; });
+  governor.rebalance (950, false);
+  check (governor.scale() == 0.625);
+  check (limit2 == 125 - 50 && limit3 == 125 - 100);
+  check (governor.report()["second"].usage == 150);
+
+  // Memory comes back gradually
+  governor.remove (id);
+  governor.rebalance (900, false);
+  governor.rebalance (900, false);
+  governor.rebalance (900, false);
+  check (governor.scale() == 1 && limit1 == 600);
+
+  // The budget is exceeded
+  governor.rebalance (2000, false);
+  check (limit1 == 0 && limit2 == 0);
+
+  MemoryGovernor disabled;
+  disabled.add ("first", 1,
+                [&] () { return usage1; },
+                [&] (size_t limit) { limit1 = limit; });
+  limit1 = 42;
+  disabled.rebalance (900, true);
+  check (limit1 == 42);
+
+  // Memory which can not be reclaimed is only reported
+  MemoryGovernor resident (1000);
+  resident.add ("first", 1,
+                [&] () { return usage1; },
+                [&] (size_t limit) { limit1 = limit; });
+  resident.add ("table", 0, [] () -> size_t { return 100; });
+  resident.rebalance (900, false);
+  check (limit1 == 700);
+  check (resident.report()["table"].usage == 100);
+  check (resident.report()["table"].limit == 0);
+
+  check (MemoryGovernor::residentSetSize() > 0);
+  check (MemoryGovernor::memoryPressure() >= 0);
+}
+
+
+void testFileWatcher () {
+  std::cout << "Testing FileWatcher..." << std::endl;
+
+  char tmp[] = "/tmp/test_util.XXXXXX";
+  check (mkdtemp (tmp) != NULL);
+  const std::string dir (tmp);
+  const std::string watched = dir + "/watched.cxx";
+  const std::string other   = dir + "/other.cxx";
+  std::ofstream (watched.c_str()) << "int i;" << std::endl;
+
+  //![FileWatcher]
+  FileWatcher watcher;
+  watcher.watch (std::vector<std::string> (1, watched));
+
+  // Modify the file
+  std::ofstream (watched.c_str()) << "int j;" << std::endl;
+
+  // Wait at most 1s for changes, and report them after 50ms without changes
+  std::set<std::string> changed = watcher.wait (1000, 50, 1000);
+  check (changed.size() == 1 && changed.count (watched) == 1);
+  //![FileWatcher]
+
+
+  // Additional tests: files outside the watched set are ignored
+  std::ofstream (other.c_str()) << "int k;" << std::endl;
+  check (watcher.wait (100, 50, 1000).empty());
+
+  // Removed files are reported, even when they are replaced
+  rename (other.c_str(), watched.c_str());
+  check (watcher.wait (1000, 50, 1000).count (watched) == 1);
+  check (watcher.directories() == 1);
+
+  watcher.watch (std::vector<std::string>());
+  check (watcher.directories() == 0);
+
+  unlink (watched.c_str());
+  rmdir (dir.c_str());
+}
+
+
 int main () {
   try {
     testTimer();
     testString();
+    testShellSplit();
     testTee();
+    testQueue();
+    testMetrics();
+    testDeflate();
+    testStringPool();
+    testMemoryGovernor();
+    testFileWatcher();
   }
   catch (...) {
     std::cerr << "Caught exception!" << std::endl;
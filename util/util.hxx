@@ -2,6 +2,9 @@
 
 #include <sys/time.h>
 #include <iostream>
+#include <string>
+#include <vector>
+#include <stdexcept>
 
 /** @defgroup util Utilities
  *  @brief Various utilities
@@ -78,6 +81,92 @@ struct String : public std::string {
 };
 
 
+/** @brief Split a command line into words
+ *
+ * Words are split as a POSIX shell would do, without performing any
+ * expansion: words are separated by blanks, single quotes preserve their
+ * contents literally, and backslashes escape the next character (inside double
+ * quotes, only if it has a special meaning).
+ *
+ * Example use:
+ * @snippet test_util.cxx shellSplit
+ *
+ * @param command  command line
+ *
+ * @return  the vector of words
+ * @throw std::runtime_error for unterminated quotes
+ */
+inline std::vector<std::string> shellSplit (const std::string & command) {
+  std::vector<std::string> words;
+  std::string word;
+  bool inWord = false;
+
+  auto c   = command.begin();
+  auto end = command.end();
+  for ( ; c != end ; ++c) {
+    switch (*c) {
+    case ' ': case '\t': case '\n':
+      if (inWord) {
+        words.push_back (word);
+        word.clear();
+        inWord = false;
+      }
+      break;
+
+    case '\'':
+      inWord = true;
+      for (++c ; c != end && *c != '\'' ; ++c) {
+        word += *c;
+      }
+      if (c == end) {
+        throw std::runtime_error ("unterminated single quote in: " + command);
+      }
+      break;
+
+    case '"':
+      inWord = true;
+      for (++c ; c != end && *c != '"' ; ++c) {
+        if (*c == '\\' && c+1 != end
+            && (c[1] == '"' || c[1] == '\\' || c[1] == '$' || c[1] == '`'
+                || c[1] == '\n')) {
+          ++c;
+          if (*c == '\n') {
+            continue;
+          }
+        }
+        word += *c;
+      }
+      if (c == end) {
+        throw std::runtime_error ("unterminated double quote in: " + command);
+      }
+      break;
+
+    case '\\':
+      if (c+1 == end) {
+        break;
+      }
+      ++c;
+      if (*c == '\n') {
+        // Line continuation
+        break;
+      }
+      inWord = true;
+      word += *c;
+      break;
+
+    default:
+      inWord = true;
+      word += *c;
+    }
+  }
+
+  if (inWord) {
+    words.push_back (word);
+  }
+  return words;
+}
+
+
 /** @brief Output stream duplicator
  *
  * Stream which duplicates its output to two streams.